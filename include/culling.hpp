@@ -0,0 +1,73 @@
+#pragma once
+#include "usings.hpp"
+#include <GL/glew.h>
+#include <array>
+
+class Shader;
+struct DrawElementsIndirectCommand;
+struct IndirectDrawData;
+
+// the six planes of a view projection's frustum, normals point inwards so a
+// point is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them.
+using Frustum = std::array<vec4, 6>;
+Frustum frustum_planes(const mat4 &view_projection);
+bool sphere_in_frustum(const Frustum &frustum, const vec3 &center,
+                       const float radius);
+
+// per draw input of cull.comp next to the IndirectDrawData: the object space
+// bounding sphere, & the bucket (one multi draw) the draw belongs to.
+struct CullData {
+  vec4 sphere;
+  GLuint bucket;
+  // where the bucket's commands start, survivors get packed from here.
+  GLuint bucket_first;
+  GLuint padding[2];
+};
+
+// culls the indirect draws in a compute shader, against the frustum & if asked
+// against a hi-z pyramid of last frame's depth. survivors are written to
+// commands & draws, and counts holds how many survived per bucket.
+class GpuCulling {
+  GpuCulling(const GpuCulling &) = delete;
+  GpuCulling &operator=(const GpuCulling &) = delete;
+
+public:
+  bool enabled = true;
+  // also test against last frame's depth. things that show up from behind
+  // an occluder can be a frame late.
+  bool hiz_enabled = false;
+  // reads the survivors back every frame and compares them to the cpu's
+  // frustum test. stalls the pipeline, it's for debugging & ci (llvmpipe has
+  // everything this needs).
+  bool validate = false;
+  // the survivors of the last validated frame, and the mismatches seen.
+  size_t visible_count = 0, validation_errors = 0;
+
+  // outputs, for the multi draws.
+  GLuint commands, draws, counts;
+
+  // compute shaders & ssbos.
+  static bool supported();
+  // survivors can only be packed if the number of draws can come from a
+  // buffer, otherwise culled commands just get an instance count of 0.
+  static bool compaction_supported();
+
+  GpuCulling();
+  ~GpuCulling();
+  void cull(const vector<DrawElementsIndirectCommand> &in_commands,
+            const vector<IndirectDrawData> &in_draws,
+            const vector<CullData> &cull_data, const size_t bucket_count,
+            const mat4 &view_projection);
+  // call after the opaque pass, downsamples its depth for next frame.
+  void build_hiz(const mat4 &view_projection);
+
+private:
+  shared_ptr<Shader> cull_shader, hiz_shader;
+  GLuint in_commands_buffer, in_draws_buffer, cull_data_buffer;
+  // the depth copied out of the default framebuffer & the max depth pyramid.
+  GLuint depth_texture = 0, hiz_texture = 0;
+  int hiz_width = 0, hiz_height = 0, hiz_levels = 0;
+  // the view the pyramid was built from, 'occluded' means occluded from there.
+  mat4 hiz_view_projection;
+  bool hiz_valid = false;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include "usings.hpp"
+#include <GL/glew.h>
+#include <array>
+#include <mutex>
+
+class Shader;
+
+// immediate mode debug drawing, callable from any component or thread. what
+// gets submitted is drawn once, over the frame it was submitted in.
+namespace debug {
+void line(const vec3 &start, const vec3 &end, const vec4 &color = vec4(1));
+// an axis aligned box, or the unit cube centered on the origin under transform.
+void box(const vec3 &center, const vec3 &size, const vec4 &color = vec4(1));
+void box(const mat4 &transform, const vec4 &color = vec4(1));
+void sphere(const vec3 &center, const float radius,
+            const vec4 &color = vec4(1));
+} // namespace debug
+
+enum class DebugShape {
+  Line,
+  Box,
+  Sphere,
+  Count,
+};
+
+// one unit shape, scaled & placed by the transform.
+struct DebugInstance {
+  mat4 model;
+  vec4 color;
+};
+
+// the unit shapes live in one vertex & index buffer, uploaded once. every
+// frame the instances are streamed into one buffer, grouped by shape, and
+// each shape is a single instanced draw of lines.
+class DebugDraw {
+public:
+  static DebugDraw &current() {
+    static DebugDraw instance;
+    return instance;
+  }
+  DebugDraw(const DebugDraw &) = delete;
+  DebugDraw &operator=(const DebugDraw &) = delete;
+  ~DebugDraw();
+
+  // drawn over everything by default, on is hidden by the scene's depth.
+  bool depth_tested = false;
+  // how many shapes the last frame drew.
+  size_t instance_count = 0;
+
+  void add(const DebugShape shape, const mat4 &model, const vec4 &color);
+  // draws & clears everything submitted so far, call on the render thread.
+  void render(const mat4 &view_projection);
+  // deletes the gl objects while there's still a context, the singleton
+  // itself only goes at exit. the next render builds them again.
+  void release();
+
+private:
+  DebugDraw() = default;
+  // where a shape's lines sit in the shared buffers.
+  struct ShapeRange {
+    GLint base_vertex = 0;
+    size_t first_index = 0, index_count = 0;
+  };
+  std::array<ShapeRange, (size_t)DebugShape::Count> ranges;
+  std::array<vector<DebugInstance>, (size_t)DebugShape::Count> pending;
+  // swapped with pending under the lock, so submitting never waits on a draw.
+  std::array<vector<DebugInstance>, (size_t)DebugShape::Count> drawing;
+  std::mutex mutex;
+  GLuint vao = 0, vertex_buffer = 0, index_buffer = 0, instance_buffer = 0;
+  size_t instance_capacity = 0;
+  shared_ptr<Shader> shader;
+  // builds the shapes & the vao, once there's a context.
+  void init();
+  void bind_instances(const size_t first_instance) const;
+};
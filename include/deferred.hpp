@@ -0,0 +1,55 @@
+#pragma once
+#include "usings.hpp"
+#include <GL/glew.h>
+
+class Shader;
+class MeshBuffer;
+struct RenderView;
+
+// how the deferred path lights the clustered point lights.
+enum class DeferredLighting {
+  // in the fullscreen pass, from the froxels like forward does.
+  Clustered,
+  // a sphere per light, blended on top of the fullscreen pass.
+  Volumes,
+};
+
+// deferred shading, instead of lighting every fragment as it's drawn. the
+// opaque pass only writes albedo & normals (the GBUFFER variants), and the
+// lighting happens once per pixel afterwards, reading those back.
+// the g-buffer is 8 bytes a pixel plus depth: rgba8 albedo with a set when
+// the material is lit, and an rg16 octahedral normal. positions come from
+// the depth. its textures are transients of the frame graph.
+struct GBuffer {
+  GLuint albedo = 0, normal = 0, depth = 0;
+  // all three attached, the depth gets blitted from it.
+  GLuint framebuffer = 0;
+  int width = 0, height = 0;
+};
+
+class DeferredShading {
+  DeferredShading(const DeferredShading &) = delete;
+  DeferredShading &operator=(const DeferredShading &) = delete;
+
+public:
+  // the depth is the default framebuffer's format, so it can be blitted over.
+  static constexpr GLenum ALBEDO_FORMAT = GL_RGBA8, NORMAL_FORMAT = GL_RG16,
+                          DEPTH_FORMAT = GL_DEPTH24_STENCIL8;
+  bool enabled = false;
+  DeferredLighting lighting = DeferredLighting::Clustered;
+
+  DeferredShading() = default;
+  ~DeferredShading();
+  // lights the g-buffer into the default framebuffer, which gets its depth.
+  void light(MeshBuffer &buffer, const RenderView &view, const GBuffer &gbuffer);
+
+private:
+  // the fullscreen triangle has no attributes, but core needs a vao bound.
+  GLuint empty_vao = 0;
+  GLuint sphere_vao = 0, sphere_vertices = 0, sphere_indices = 0;
+  GLsizei sphere_index_count = 0;
+  shared_ptr<Shader> lit_shader, shadowed_shader, volume_shader;
+  void init();
+  void bind_gbuffer(const Shader &shader, const RenderView &view,
+                    const GBuffer &gbuffer) const;
+};
@@ -33,6 +33,32 @@ struct BlockPlacer : public Component {
   void deserialize(const YAML::Node &in) override;
 };
 
+// spawns a grid of objects that each have their own material, transform &
+// color, and averages the frame time so the draw paths can be compared.
+struct DrawBenchmark : public Component {
+  DrawBenchmark() {}
+  ~DrawBenchmark() override {}
+  int object_count = 10000;
+  vector<shared_ptr<Node>> objects = {};
+  // point lights scattered over the grid, for the clustered lighting.
+  int light_count = 256;
+  vector<shared_ptr<Node>> lights = {};
+  // frame times since the last reset.
+  float total_time = 0.0f;
+  size_t frame_count = 0;
+  void spawn();
+  void spawn_lights();
+  void on_gui() override;
+  void awake() override {}
+  void update(const float &dt) override;
+  void serialize(YAML::Emitter &out) override {
+    out << YAML::BeginMap;
+    out << YAML::Key << "type" << YAML::Value << "DrawBenchmark";
+    out << YAML::EndMap;
+  }
+  void deserialize(const YAML::Node &in) override {}
+};
+
 // this file is used for testing components, making temporary classes etc.
 class Player : public Component {
 public:
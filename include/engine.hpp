@@ -13,8 +13,9 @@ struct Engine {
   
   // these are just quick and easy defaults / fallbacks
   shared_ptr<Shader> m_shader;
-  optional<shared_ptr<Texture>> m_texture;
   shared_ptr<Material> m_material;
+  // only decoded the first time something asks for it.
+  optional<shared_ptr<Texture>> default_texture();
   
   bool running = true;
   static std::string RESOURCE_DIR_PATH;
@@ -0,0 +1,26 @@
+#pragma once
+#include "usings.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// watches directories with inotify on a background thread and queues up the
+// paths of files that finished being written, for the main thread to drain.
+class FileWatcher {
+public:
+  FileWatcher();
+  ~FileWatcher();
+  // watching the same directory twice is a no-op.
+  void watch_directory(const string &directory);
+  // returns the changed paths since the last call, each path at most once.
+  vector<string> poll_changes();
+
+private:
+  int inotify_fd = -1;
+  std::atomic<bool> running = true;
+  std::thread thread;
+  std::mutex mutex;
+  unordered_map<int, string> directories;
+  vector<string> changes;
+  void watch_loop();
+};
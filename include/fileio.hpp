@@ -3,6 +3,7 @@
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <vector>
 
 static const bool file_exists(const std::string &name) {
   std::ifstream f(name.c_str());
@@ -33,4 +34,25 @@ static const void write_file(const std::string filePath, const char *data) {
     }
     fileStream.write(data, strlen(data));
     fileStream.close();
+}
+static std::vector<char> read_binary_file(const std::string filePath) {
+  std::ifstream fileStream(filePath,
+                           std::ios::in | std::ios::binary | std::ios::ate);
+  if (!fileStream.is_open()) {
+    std::cerr << "Could not read file " << filePath << ". File does not exist."
+              << std::endl;
+    return {};
+  }
+  std::vector<char> buffer(fileStream.tellg());
+  fileStream.seekg(0, std::ios::beg);
+  fileStream.read(buffer.data(), buffer.size());
+  return buffer;
+}
+static void write_binary_file(const std::string filePath, const std::vector<char> &data) {
+    std::ofstream fileStream(filePath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!fileStream.is_open()) {
+        std::cerr << "Could not write file " << filePath << "." << std::endl;
+        return;
+    }
+    fileStream.write(data.data(), data.size());
 }
\ No newline at end of file
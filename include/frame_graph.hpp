@@ -0,0 +1,132 @@
+#pragma once
+#include "gpu_timer.hpp"
+#include "usings.hpp"
+#include <GL/glew.h>
+#include <functional>
+#include <map>
+
+// a texture in the graph, an index into its resources for this frame.
+using FrameResource = size_t;
+
+// what a transient texture looks like. textures with the same one can share
+// memory when they're never alive at the same time.
+struct TextureDesc {
+  int width = 0, height = 0;
+  GLenum format = GL_RGBA8;
+  bool operator==(const TextureDesc &) const = default;
+  bool is_depth() const;
+  size_t bytes() const;
+};
+
+class FrameGraph;
+
+// what a pass says it does with the graph's resources, in its setup.
+class PassBuilder {
+public:
+  // a transient texture, alive from this pass to the last one using it. it's
+  // cleared (to 0, or depth to 1) before this pass runs.
+  FrameResource create(const std::string &name, const TextureDesc &desc);
+  FrameResource read(const FrameResource resource);
+  FrameResource write(const FrameResource resource);
+  // keeps the pass even if nothing reads what it writes.
+  void side_effect();
+
+private:
+  PassBuilder(FrameGraph &graph, const size_t pass) : graph(graph), pass(pass) {}
+  FrameGraph &graph;
+  size_t pass;
+  friend class FrameGraph;
+};
+
+struct PassStats {
+  std::string name;
+  // nothing needed what it writes, so it didn't run.
+  bool culled = false;
+  float cpu_ms = 0.0f, gpu_ms = 0.0f;
+  // transient textures created & clears done before it.
+  size_t created = 0, clears = 0;
+};
+
+// the frame as a list of passes that declare what they read & write, rebuilt
+// every frame. compiling it culls the passes nobody needs, works out how
+// long each transient texture lives & gives textures whose lifetimes don't
+// overlap the same memory. the textures themselves are pooled across frames.
+// passes run in the order they're added, which has to be an order where
+// everything is written before it's read. each one starts with the default
+// framebuffer bound.
+class FrameGraph {
+  FrameGraph(const FrameGraph &) = delete;
+  FrameGraph &operator=(const FrameGraph &) = delete;
+
+public:
+  // off gives every transient texture its own memory, to compare against.
+  bool aliasing = true;
+  // pooled textures unused for this many frames are freed. ones a frame
+  // asked for at a different size are freed right away.
+  size_t max_idle_frames = 60;
+  // from the last frame that was executed.
+  vector<PassStats> stats;
+  // what the transient textures asked for, & what backs them.
+  size_t requested_bytes = 0, allocated_bytes = 0;
+  size_t pooled_textures = 0;
+
+  FrameGraph() = default;
+  ~FrameGraph();
+  // drops last frame's passes & resources, the pool stays.
+  void reset();
+  // something the graph doesn't own. texture 0 with a clear color is the
+  // default framebuffer, cleared to it (& depth to 1) before its first write.
+  // without one it's only there to order & cull the passes using it.
+  FrameResource import(const std::string &name, const GLuint texture,
+                       const optional<vec4> &clear_color = {});
+  // what ends up on screen, passes writing it are always kept.
+  void present(const FrameResource resource);
+  void add_pass(const std::string &name,
+                const std::function<void(PassBuilder &)> &setup,
+                std::function<void(FrameGraph &)> execute);
+  void compile();
+  void execute();
+
+  // for the passes, while they execute.
+  GLuint texture(const FrameResource resource) const;
+  const TextureDesc &desc(const FrameResource resource) const;
+  // a framebuffer with these attached, depth formats as depth and the rest
+  // as color attachments in order. cached, 0 for the default framebuffer and
+  // when the driver won't take them together (which is cached as well).
+  GLuint framebuffer(const vector<FrameResource> &attachments);
+
+private:
+  struct Resource {
+    std::string name;
+    TextureDesc desc;
+    bool imported = false, presented = false;
+    optional<vec4> clear_color;
+    GLuint texture = 0;
+    // the passes (in order) that create it & use it last.
+    size_t first = 0, last = 0;
+  };
+  struct Pass {
+    std::string name;
+    vector<FrameResource> creates, reads, writes;
+    std::function<void(FrameGraph &)> execute;
+    bool side_effect = false, culled = false;
+  };
+  struct PooledTexture {
+    TextureDesc desc;
+    GLuint texture = 0;
+    size_t idle_frames = 0;
+    bool in_use = false;
+  };
+  vector<Resource> resources;
+  vector<Pass> passes;
+  vector<PooledTexture> pool;
+  std::map<vector<GLuint>, GLuint> framebuffers;
+  std::map<std::string, GpuTimer> timers;
+  bool compiled = false;
+  GLuint acquire(const TextureDesc &desc);
+  void release(const GLuint texture);
+  // frees the pooled textures that are stale.
+  void evict(const std::function<bool(const PooledTexture &)> &stale);
+  void clear(const FrameResource resource);
+  friend class PassBuilder;
+};
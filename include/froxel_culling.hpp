@@ -0,0 +1,30 @@
+#pragma once
+#include "usings.hpp"
+#include <cstdint>
+
+// the sphere vs froxel test LightClusters culls its lights with. nothing in
+// here touches gl, so tools/check_froxel_culling.cpp can run it without a
+// context.
+
+// froxel bounds in view space, struct of arrays so 4 neighbours in x are
+// tested at once. x fastest, then y, then the slices.
+struct FroxelBounds {
+  vector<float> min_x, min_y, min_z, max_x, max_y, max_z;
+};
+
+// the boxes around grid_x by grid_y tiles of the projection, in grid_z slices
+// spaced exponentially from near to far.
+FroxelBounds build_froxel_bounds(const mat4 &projection, const float near,
+                                 const float far, const int grid_x,
+                                 const int grid_y, const int grid_z);
+
+// ors bit into masks[i * words] for every froxel first + i, i < count, the
+// sphere (view space center, radius) touches. count is a multiple of 4.
+void cull_froxels(const FroxelBounds &bounds, const size_t first,
+                  const size_t count, const vec4 &sphere, const uint64_t bit,
+                  uint64_t *masks, const size_t words);
+// the plain c version. the sse2 one above has to set the same bits.
+void cull_froxels_scalar(const FroxelBounds &bounds, const size_t first,
+                         const size_t count, const vec4 &sphere,
+                         const uint64_t bit, uint64_t *masks,
+                         const size_t words);
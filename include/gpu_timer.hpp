@@ -0,0 +1,27 @@
+#pragma once
+#include "usings.hpp"
+#include <GL/glew.h>
+#include <array>
+
+// times a pass on the gpu with GL_TIME_ELAPSED queries. results are read a
+// few frames late so we never wait on the gpu for them. timers can't nest or
+// overlap, only one query of the kind can be active at a time.
+class GpuTimer {
+  GpuTimer(const GpuTimer &) = delete;
+  GpuTimer &operator=(const GpuTimer &) = delete;
+
+public:
+  // the most recent result that's come back.
+  float ms = 0.0f;
+
+  GpuTimer() = default;
+  ~GpuTimer();
+  void begin();
+  void end();
+
+private:
+  static constexpr size_t LATENCY = 3;
+  std::array<GLuint, LATENCY> queries = {};
+  std::array<bool, LATENCY> pending = {};
+  size_t frame = 0;
+};
\ No newline at end of file
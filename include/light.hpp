@@ -9,13 +9,17 @@ struct Light : public Component {
   float intensity;
   float range;
   bool cast_shadows;
+  // shines along the node's -z from infinitely far away, instead of out from
+  // its position.
+  bool directional = false;
   Light(const vec3 &color = {1, 1, 1}, const float &intensity = 1.0f,
         const float &range = 1.0f, const bool &cast_shadows = true)
       : color(color), intensity(intensity), range(range),
         cast_shadows(cast_shadows) {
         }
-  ~Light() override {}
-  void awake() override {}
+  // registered with the renderer's light clusters while awake.
+  ~Light() override;
+  void awake() override;
   void update(const float &dt) override {}
   void on_collision(const physics::Collision &collision) override {}
   void serialize(YAML::Emitter &out) override {
@@ -25,6 +29,9 @@ struct Light : public Component {
     out << YAML::Key << "intensity" << YAML::Value << intensity;
     out << YAML::Key << "range" << YAML::Value << range;
     out << YAML::Key << "cast_shadows" << YAML::Value << cast_shadows;
+    if (directional) {
+      out << YAML::Key << "directional" << YAML::Value << true;
+    }
     out << YAML::EndMap;
   }
   void deserialize(const YAML::Node &in) override {
@@ -32,5 +39,8 @@ struct Light : public Component {
     intensity = in["intensity"].as<float>();
     range = in["range"].as<float>();
     cast_shadows = in["cast_shadows"].as<bool>();
+    if (in["directional"]) {
+      directional = in["directional"].as<bool>();
+    }
   }
 };
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+#include "froxel_culling.hpp"
+#include "thread_pool.hpp"
+#include "usings.hpp"
+#include <GL/glew.h>
+#include <array>
+
+class Shader;
+struct Light;
+struct RenderView;
+
+// clustered forward lighting. the view frustum is split into GRID_X by GRID_Y
+// tiles on screen and GRID_Z slices in depth, spaced exponentially. every
+// frame the point lights in view are culled into those froxels on the cpu,
+// and the fragment shader only loops over the lights of its own froxel.
+// the scene's main light isn't one of them, it keeps its own uniforms &
+// shadows. other directional lights are ignored.
+class LightClusters {
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+
+public:
+  // GRID_X is a multiple of 4, the simd lanes.
+  static constexpr int GRID_X = 16, GRID_Y = 9, GRID_Z = 24;
+  static constexpr int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+  // a froxel's lights are a bitmask while culling, this many bits. lights
+  // past it are dropped.
+  static constexpr size_t MAX_LIGHTS = 1024;
+  // a light reaches this many times its range, past that it's faded to 0.
+  static constexpr float RANGE_SCALE = 10.0f;
+
+  bool enabled = true;
+  // where the last slice ends, the camera's far plane is usually much too far
+  // to slice up. fragments further away use the last slice.
+  float max_distance = 300.0f;
+  // the point lights in view & the light indices of all froxels, last frame.
+  size_t visible_count = 0, index_count = 0;
+  float cull_ms = 0.0f;
+
+  LightClusters();
+  ~LightClusters();
+  void add(Light *light);
+  void remove(const Light *light);
+  // culls the lights into the froxels of the view & uploads the result.
+  void update(const RenderView &view);
+  // binds the buffers & sets the cluster uniforms of a LIT variant.
+  void apply_uniforms(const Shader &shader) const;
+
+private:
+  vector<Light *> lights;
+  // per visible light: world position & culling radius, then color *
+  // intensity & range.
+  vector<vec4> light_data;
+  // the visible lights in view space, for culling.
+  vector<vec4> view_spheres;
+  vector<std::array<int, 2>> light_slices;
+  // rebuilt when the projection changes.
+  FroxelBounds bounds;
+  mat4 bounds_projection = mat4(0.0f);
+  float near = 0.1f, far = 300.0f;
+  // per slice, the bits of its froxels, their (first, count) into the
+  // slice's indices, and those. merged after every slice is done.
+  std::array<vector<uint64_t>, GRID_Z> slice_masks;
+  std::array<vector<uint32_t>, GRID_Z> slice_grids;
+  std::array<vector<uint16_t>, GRID_Z> slice_indices;
+  vector<uint32_t> grid;
+  vector<uint16_t> indices;
+  // buffer textures, 3.3 has no ssbos.
+  GLuint light_buffer, grid_buffer, index_buffer;
+  GLuint light_texture, grid_texture, index_texture;
+  mat4 view_matrix;
+  // for the view direction of the specular, the main light's too.
+  vec3 camera_position;
+  vec4 cluster_scale;
+  // the frame waits on these, like the occlusion culler's.
+  ThreadPool pool;
+  void cull_slice(const int slice, const size_t words);
+};
@@ -8,11 +8,93 @@
 struct Material;
 
 
+// this is the exact layout MeshBuffer uploads, so meshes are imported straight
+// into it and never re-interleaved.
+struct Vertex {
+  vec3 position = vec3(0);
+  vec2 texcoord = vec2(0);
+  vec3 normal = vec3(0);
+};
+static_assert(sizeof(Vertex) == (3 + 2 + 3) * sizeof(float));
+
+// compact alternative to Vertex : positions quantized to 16 bit against the mesh
+// bounds, half float uvs and an octahedral normal packed as GL_INT_2_10_10_10_REV.
+struct PackedVertex {
+  uint16_t position[4] = {}; // w is padding, keeps the uvs 4 byte aligned.
+  uint16_t texcoord[2] = {};
+  uint32_t normal = 0;
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+enum class VertexFormat {
+  Float,
+  Packed,
+};
+
+// a range of the mesh's indices, simplified from the one before it.
+struct MeshLod {
+  size_t first_index = 0, index_count = 0;
+  // object space distance the simplified surface can be off from full detail.
+  float error = 0.0f;
+};
+
+struct MeshImportOptions {
+  VertexFormat format = VertexFormat::Float;
+  bool keep_cpu_copy = false;
+  // reorder indices & vertices for the post-transform cache, overdraw & fetch.
+  bool optimize = true;
+  // how many lods to generate, including the full detail one. we stop early
+  // once simplifying stops paying off.
+  size_t lod_count = 4;
+  // bake the submeshes' transforms in & import them as one range, drawn in
+  // one go. off keeps them apart in submeshes, and each one's renderer gets a
+  // node of its own.
+  bool merge_submeshes = true;
+  // keep the full detail triangles on the cpu, for meshes whose renderers
+  // are occluders. off for everything else, it's a copy that's never freed.
+  bool occluder = false;
+};
+
 struct Mesh : public std::enable_shared_from_this<Mesh> {
-  vector<float> vertices = {};
-  vector<float> texcoords = {};
-  vector<float> normals = {};
+  // cpu side copies. these get dropped once the MeshBuffer has uploaded them,
+  // unless keep_cpu_copy is set (physics, picking etc. that need to read them).
+  // only one of vertices / packed_vertices is filled, depending on format,
+  // and only one of indices / short_indices, depending on the vertex count.
+  vector<Vertex> vertices = {};
+  vector<PackedVertex> packed_vertices = {};
   vector<unsigned int> indices = {};
+  vector<uint16_t> short_indices = {};
+  size_t vertex_count = 0, index_count = 0;
+  bool has_short_indices = false;
+  VertexFormat format = VertexFormat::Float;
+  bool keep_cpu_copy = false;
+  
+  // all lods index the same vertices, lods[0] is full detail.
+  vector<MeshLod> lods = {};
+  
+  // the full detail triangles on their own, kept on the cpu for software
+  // occlusion culling even when the rest of the cpu copy is released. only
+  // filled when imported with occluder set.
+  vector<vec3> occluder_vertices = {};
+  vector<uint32_t> occluder_indices = {};
+  
+  // object space bounds, packed positions are quantized against these.
+  vec3 bounds_min = vec3(0), bounds_max = vec3(0);
+  // worst case error of the packed format vs the float one, measured at import.
+  float max_position_error = 0.0f, max_normal_error_degrees = 0.0f;
+  // the post-transform cache's acmr & atvr before & after optimizing, 0 when
+  // optimize was off.
+  vec2 acmr = vec2(0), atvr = vec2(0);
+  
+  // where this mesh lives in the MeshBuffer, valid once uploaded is set.
+  bool uploaded = false;
+  int base_vertex = 0;
+  size_t index_offset = 0; // in bytes, indices of both widths share a buffer.
+  // base vertex into the position only stream the shadow pass draws from.
+  int position_base = 0;
+  
+  // only filled when merge_submeshes was off, transform is relative to the
+  // root then.
   vector<shared_ptr<Mesh>> submeshes = {};
   mat4 transform = glm::identity<mat4>();
   std::string path;
@@ -21,11 +103,38 @@ struct Mesh : public std::enable_shared_from_this<Mesh> {
     
   }
   ~Mesh() {}
-  static void load_into(shared_ptr<Mesh> &mesh, const std::string &path);
+  void release_cpu_data();
+  size_t index_size() const { return has_short_indices ? sizeof(uint16_t) : sizeof(unsigned int); }
+  const void *index_data() const;
+  vec3 bounds_center() const { return (bounds_min + bounds_max) * 0.5f; }
+  float bounds_radius() const { return glm::length(bounds_max - bounds_min) * 0.5f; }
+  // position scale & offset the vertex shader uses to undo the quantization.
+  vec3 position_scale() const;
+  vec3 position_offset() const;
+  Vertex unpack(const PackedVertex &vertex) const;
+  // fills the mesh with geometry built at runtime instead of imported, in the
+  // float format with full detail only. occluder data is left to the caller.
+  void set_data(vector<Vertex> &&new_vertices, vector<unsigned int> &&new_indices);
+  
+  // meshes are cached per path, vertex format, merging & occluder, keep_cpu_copy only has an
+  // effect the first time a path gets loaded.
+  static shared_ptr<Mesh> get(const std::string &path, const MeshImportOptions &options = {});
+  static void load_into(shared_ptr<Mesh> &mesh, const std::string &path, const MeshImportOptions &options = {});
 
 private:
-  static void process_node(shared_ptr<Mesh> &parent, const aiNode *node, const aiScene *scene);
-  static void process_mesh(shared_ptr<Mesh> &new_mesh, aiMesh *mesh);
+  void compute_bounds();
+  void generate_lods(const size_t lod_count);
+  void build_occluder();
+  void pack_vertices();
+  // bounds, optimization, lods, index width & packing, once all the
+  // geometry is in.
+  void finish_import(const MeshImportOptions &options);
+  static std::string cache_key(const std::string &path, const MeshImportOptions &options);
+  static void process_node(shared_ptr<Mesh> &parent, const aiNode *node, const aiScene *scene,
+                           const MeshImportOptions &options, const mat4 &parent_transform);
+  // appends the mesh's vertices & indices, with the transform baked in.
+  static void process_mesh(shared_ptr<Mesh> &out_mesh, aiMesh *mesh,
+                           const mat4 &transform);
 };
 
 class MeshRenderer : public Component, public std::enable_shared_from_this<MeshRenderer> {
@@ -33,8 +142,28 @@ public:
   shared_ptr<Mesh> mesh;
   shared_ptr<Material> material;
   vec4 color = vec4(1);
+  // rasterized into the occlusion buffer, so it can hide what's behind it.
+  // meant for big opaque things like walls & floors. the mesh has to be
+  // imported with occluder set as well, the constructor & yaml do that.
+  bool occluder = false;
+  // test the bounding box with a hardware occlusion query, and skip the next
+  // frame's draw on the gpu when nothing of it passed. meant for expensive
+  // meshes, the draw can't be batched anymore.
+  bool occlusion_query = false;
+  // the query issued on our bounds & the frame it was, MeshBuffer owns it.
+  unsigned int query = 0;
+  size_t query_frame = 0;
+  // a node per submesh instead of drawing the merged mesh, for when they
+  // need to be moved around on their own.
+  bool submesh_nodes = false;
+  // merged into a static batch, which gets drawn in our place.
+  bool batched = false;
+  // the lod drawn last frame, MeshBuffer picks a new one every frame.
+  size_t lod = 0;
   MeshRenderer() = default;
-  MeshRenderer(const shared_ptr<Material> &material, const std::string &mesh_path);
+  MeshRenderer(const shared_ptr<Material> &material, const std::string &mesh_path,
+               const VertexFormat format = VertexFormat::Float,
+               const bool submesh_nodes = false, const bool occluder = false);
   ~MeshRenderer() override;
   void awake() override;
   void update(const float &dt) override {}
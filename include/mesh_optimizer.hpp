@@ -0,0 +1,48 @@
+#pragma once
+#include "mesh.hpp"
+#include "usings.hpp"
+
+// index & vertex reordering that runs on meshes at import time, so the gpu
+// does less vertex shading, overdraw and vertex fetching when drawing them.
+namespace mesh_optimizer {
+
+struct CacheStats {
+  // average cache miss ratio (vertex shader invocations per triangle) and
+  // average transformed vertex ratio (invocations per unique vertex).
+  // 0.5 & 1.0 are the best case for both.
+  float acmr = 0.0f, atvr = 0.0f;
+};
+
+// simulates a fifo post-transform cache like most hardware has.
+CacheStats analyze_vertex_cache(const vector<unsigned int> &indices,
+                                const size_t vertex_count,
+                                const size_t cache_size = 16);
+
+// Tom Forsyth's linear-speed vertex cache optimisation.
+void optimize_vertex_cache(vector<unsigned int> &indices,
+                           const size_t vertex_count);
+
+// splits the (cache optimized) triangles into clusters at points where the
+// cache hit rate allows it, then sorts clusters so the ones facing away from the
+// mesh centre draw first. threshold is how much acmr we'll trade for that.
+void optimize_overdraw(vector<unsigned int> &indices,
+                       const vector<Vertex> &vertices,
+                       const float threshold = 1.05f);
+
+// reorders vertices to the order they are first referenced in, dropping
+// unreferenced ones & remapping the indices to match.
+void optimize_vertex_fetch(vector<Vertex> &vertices,
+                           vector<unsigned int> &indices);
+
+// quadric error metric edge collapse (Garland & Heckbert). vertices only ever
+// collapse onto a neighbour, so the result indexes the same vertex buffer and
+// lods can share it. stops at target_index_count or once collapsing would move
+// the surface further than target_error, and returns the indices of the result.
+// out_error is set to the object space error of the result.
+vector<unsigned int> simplify(const vector<unsigned int> &indices,
+                              const vector<Vertex> &vertices,
+                              const size_t target_index_count,
+                              const float target_error,
+                              float *out_error = nullptr);
+
+} // namespace mesh_optimizer
@@ -18,6 +18,7 @@ private:
   quat local_rotation = glm::identity<quat>();
   vec4 local_perspective;
   bool transform_composed = false;
+  bool static_geometry = false;
   void decompose();
   void compose();
   bool has_cyclic_inclusion(const shared_ptr<Node> &node) const;
@@ -45,6 +46,11 @@ public:
   void serialize(YAML::Emitter &out);
   void deserialize(const YAML::Node &in);
   void add_child(shared_ptr<Node> child);
+
+  // static nodes never move, their mesh renderers get merged into the
+  // MeshBuffer's static batches. applies to the children too.
+  bool is_static() const { return static_geometry; }
+  void set_static(const bool value);
   
   static shared_ptr<Node> instantiate(const vec3 &pos = glm::zero<vec3>(),
                                       const vec3 &scale = glm::one<vec3>(),
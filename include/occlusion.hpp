@@ -0,0 +1,49 @@
+#pragma once
+#include "thread_pool.hpp"
+#include "usings.hpp"
+
+struct Mesh;
+
+// a front facing occluder triangle in depth buffer pixels, y up, z in [0, 1].
+struct OccluderTriangle {
+  vec3 v[3];
+  float min_y, max_y;
+};
+
+// software occlusion culling. the occluders in view get rasterized into a
+// small depth buffer on the cpu every frame, then each other object's bounds
+// are tested against it before it's submitted.
+class OcclusionCuller {
+  OcclusionCuller(const OcclusionCuller &) = delete;
+  OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+
+public:
+  // multiples of 4 (simd lanes) & BAND_HEIGHT, roughly the window's aspect.
+  static constexpr int WIDTH = 256, HEIGHT = 192;
+  // rows of the buffer one job rasterizes.
+  static constexpr int BAND_HEIGHT = 8;
+
+  bool enabled = true;
+  // how long the last frame spent rasterizing (setup included) & testing,
+  // filled in by MeshBuffer which makes the calls.
+  float raster_ms = 0.0f, test_ms = 0.0f;
+  size_t occluder_count = 0, triangle_count = 0;
+
+  OcclusionCuller();
+  // clears the depth buffer & the occluders of the last frame.
+  void begin(const mat4 &view_projection);
+  void add_occluder(const Mesh &mesh, const mat4 &model);
+  // rasterizes everything added since begin, split into bands over the pool.
+  void rasterize();
+  // false if the mesh's bounds are hidden behind the occluders everywhere.
+  bool visible(const Mesh &mesh, const mat4 &model) const;
+
+private:
+  mat4 view_projection;
+  vector<float> depth;
+  vector<OccluderTriangle> triangles;
+  // the frame waits on these, so they shouldn't queue up behind texture
+  // decodes on the shared pool.
+  ThreadPool pool;
+  void rasterize_band(const int row_begin, const int row_end);
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include "usings.hpp"
+#include <GL/glew.h>
+
+class Shader;
+struct Mesh;
+
+// hardware occlusion queries on mesh bounds. a query is drawn as the mesh's
+// bounding box this frame, and next frame's draw of the mesh is made
+// conditional on it with GL_QUERY_NO_WAIT, so the cpu never waits on a result.
+// query objects are pooled, and only reused once their result has come back.
+class OcclusionQueries {
+  OcclusionQueries(const OcclusionQueries &) = delete;
+  OcclusionQueries &operator=(const OcclusionQueries &) = delete;
+
+public:
+  bool enabled = true;
+  // how many frames results take to become available after the query is
+  // issued, averaged, and how many of the results that came back last frame
+  // said the box was hidden.
+  float average_latency = 0.0f;
+  size_t finished = 0, hidden = 0;
+  size_t allocated() const { return allocated_count; }
+
+  // GL_ANY_SAMPLES_PASSED_CONSERVATIVE where the driver has it.
+  static GLenum target();
+
+  OcclusionQueries();
+  ~OcclusionQueries();
+  // call once a frame. collects the results of released queries that are
+  // done, without waiting on the ones that aren't, & notes when the issued
+  // ones become available.
+  void update(const size_t frame);
+  // bounding boxes get drawn without touching the color or depth buffers
+  // between these two.
+  void begin_tests(const mat4 &view_projection);
+  void end_tests();
+  // issues a query on the mesh's bounding box, returns the query.
+  GLuint test(const Mesh &mesh, const mat4 &transform, const size_t frame);
+  // hands the query back once nothing is going to use it anymore.
+  void release(const GLuint query);
+
+private:
+  struct Query {
+    GLuint id;
+    size_t issued_frame;
+    // its latency went into the average already.
+    bool measured = false;
+  };
+  vector<GLuint> free_queries;
+  // issued ones, by id, and released ones still waiting on their result.
+  unordered_map<GLuint, Query> issued;
+  vector<Query> retiring;
+  size_t allocated_count = 0;
+  GLuint box_vao, box_vertices, box_indices;
+  shared_ptr<Shader> box_shader;
+};
@@ -10,6 +10,7 @@
 #include <GLFW/glfw3.h>
 
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/norm.hpp>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
@@ -19,7 +20,18 @@
 
 #define IMGUI_HAS_DOCK
 
+#include "culling.hpp"
+#include "debug_draw.hpp"
+#include "deferred.hpp"
+#include "frame_graph.hpp"
+#include "light_clusters.hpp"
+#include "occlusion.hpp"
+#include "occlusion_queries.hpp"
 #include "shader.hpp"
+#include "shadows.hpp"
+#include "static_batching.hpp"
+#include "texture_atlas.hpp"
+#include "texture_compression.hpp"
 #include <yaml-cpp/yaml.h>
 
 static int EXIT_CODE = 0;
@@ -31,22 +43,90 @@ struct MeshRenderer;
 
 class Texture {
 public:
-  GLuint texture;
-  int width, height, channel_count;
-  unsigned char *data;
+  GLuint texture = 0;
+  int width = 0, height = 0, channel_count = 0, levels = 0;
+  GLenum internal_format = GL_RGBA8, format = GL_RGBA;
+  // video memory used by every mip level, a rough figure for the stats.
+  size_t gpu_bytes = 0;
+  // streamed textures fill in from the smallest level up, this is the
+  // finest level so far. levels means nothing has arrived yet.
+  int resident_level = 0;
   std::string path;
+  // loads & uploads everything right away, on this thread.
   void load_texture(const std::string &path);
+  texture_compression::BlockFormat compression =
+      texture_compression::BlockFormat::None;
+  // creates the texture with room for every level, but no contents.
+  void allocate(const int width, const int height, const int channel_count,
+                const int levels,
+                const texture_compression::BlockFormat compression =
+                    texture_compression::BlockFormat::None);
+  // where the baked (block compressed) copy of an image would be.
+  static std::string baked_path(const std::string &path);
+  // set when the texture was packed into the TextureAtlas instead of
+  // getting a texture of its own.
+  AtlasSlot atlas;
+  bool atlased() const { return atlas.valid(); }
+  // atlased textures only count once every level is in.
+  bool resident() const {
+    return atlased() ? resident_level == 0
+                     : texture != 0 && resident_level < levels;
+  }
+  // the texture to bind, which is a placeholder until some of it is resident.
+  GLuint handle() const;
   Texture() = default;
   Texture(const std::string path);
   ~Texture();
   YAML::Node serialize();
   void deserialize(const YAML::Node &in);
+  
+  // loads each path once, everyone asking for it after that shares it.
+  // the texture streams in over the next frames, see TextureStreamer.
+  static shared_ptr<Texture> get(const std::string &path);
+  static unordered_map<std::string, shared_ptr<Texture>> cache;
+  static size_t total_gpu_bytes();
+};
+
+// a uniform the material sets on its shader beyond the ones the engine
+// knows about. the type comes from the shader, so value is read as a float,
+// vecN or an int (from x) to match it.
+struct MaterialParameter {
+  std::string name;
+  vec4 value;
+};
+
+// one compiled permutation of the material's shader, with the parameters
+// resolved to slots in that program's uniform table (-1 if it lacks them).
+struct MaterialVariant {
+  shared_ptr<Shader> shader;
+  vector<int> slots;
+  // the shader generation the slots were resolved against.
+  size_t generation = 0;
 };
 
 class Material {
 public:
+  // the shader the variants are compiled from, its sources & defines.
   shared_ptr<Shader> shader;
   optional<shared_ptr<Texture>> texture;
+  vector<MaterialParameter> parameters;
+  bool lit = true;
+  unordered_map<ShaderFeatures, MaterialVariant> variants;
+  void set_parameter(const std::string &name, const vec4 &value);
+  // the features this material needs no matter what it's drawn with.
+  ShaderFeatures features() const;
+  // the smallest variant that covers the material's features & the ones the
+  // draw asks for (packed vertices, instancing..), compiled on first use.
+  // ATLASED takes the place of TEXTURED.
+  MaterialVariant &variant(const ShaderFeatures draw_features);
+  // true once the texture can be sampled from the atlas.
+  bool atlased() const {
+    return texture.has_value() && texture.value()->atlased() &&
+           texture.value()->resident();
+  }
+  // where the texture sits in the atlas, the identity rect if it doesn't.
+  const AtlasSlot &atlas_slot() const;
+  void apply_parameters(MaterialVariant &variant) const;
   Material(); // This should only be used when deserializing.
   Material(shared_ptr<Shader> shader,
            optional<shared_ptr<Texture>> texture = std::nullopt)
@@ -61,6 +141,97 @@ public:
   void deserialize(const YAML::Node &in);
 };
 
+// everything a pass needs to know about the point of view it renders from.
+struct RenderView {
+  mat4 view_projection;
+  mat4 view, projection;
+  vec3 position;
+  // how many pixels one unit of world space covers at a distance of one,
+  // used to turn object space errors & sizes into screen space ones.
+  float pixels_per_unit;
+};
+
+struct RenderStats {
+  size_t draw_calls = 0;
+  size_t triangles = 0;
+  // what we would have drawn without lods.
+  size_t full_detail_triangles = 0;
+  // objects that were drawn as part of an instanced batch.
+  size_t instanced_objects = 0;
+  // objects that went through glMultiDrawElementsIndirect.
+  size_t indirect_objects = 0;
+  // objects outside the frustum, only counted when the cpu culls.
+  size_t culled_objects = 0;
+  // objects hidden behind occluders in the software depth buffer.
+  size_t occluded_objects = 0;
+  // objects drawn conditionally on last frame's occlusion query.
+  size_t queried_objects = 0;
+  // draws & casters of every shadow view, cached ones aren't counted.
+  size_t shadow_draw_calls = 0;
+  size_t shadow_casters = 0;
+};
+
+// per instance attributes for instanced draws, see vertex.glsl.
+struct InstanceData {
+  mat4 model;
+  vec4 color;
+  mat3 normal;
+  vec4 atlas_rect;
+  float atlas_layer;
+};
+
+// what glMultiDrawElementsIndirect reads for each draw, laid out as GL wants it.
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+// per draw data for INDIRECT variants, DrawData in vertex.glsl. it's read as
+// std430, so the mat3's columns are padded out to vec4s & the struct to 16.
+struct IndirectDrawData {
+  mat4 model;
+  vec4 normal[3];
+  vec4 color;
+  vec4 atlas_rect;
+  vec4 position_scale;
+  vec4 position_offset;
+  float atlas_layer;
+  float padding[3];
+};
+static_assert(sizeof(IndirectDrawData) == 192, "must match std430 DrawData");
+
+// a mesh renderer that survived to be drawn this frame.
+struct DrawItem {
+  MeshRenderer *renderer;
+  mat4 transform;
+  mat3 normal_matrix;
+};
+
+// a renderer that can cast a shadow this frame, gathered once by prepare for
+// every shadow view to cull from.
+struct ShadowCaster {
+  MeshRenderer *renderer;
+  mat4 transform;
+  vec4 sphere;
+  bool is_static;
+};
+
+// the inverse transpose of the model matrix's upper 3x3, which keeps normals
+// perpendicular to the surface under non uniform scale.
+mat3 normal_matrix(const mat4 &model);
+
+// a growable gpu buffer. there is no cpu side copy, we just track how full it is.
+struct GpuBuffer {
+  GLuint id = 0;
+  size_t count = 0, capacity = 0;
+  // grows the buffer (by doubling) so it holds at least `required` elements,
+  // copying the old contents over on the gpu. returns true if `id` changed.
+  bool reserve(const size_t required, const size_t element_size);
+};
+
 class MeshBuffer {
   MeshBuffer(const MeshBuffer &) = delete;
   MeshBuffer(MeshBuffer &&) = delete;
@@ -68,173 +239,108 @@ class MeshBuffer {
   MeshBuffer &operator=(MeshBuffer &&) = delete;
 
 public:
-  GLuint vbo, vao, ebo;
-  vector<unsigned int> indices = {};
-  vector<float> interleaved_data = {};
+  // one vao per vertex format, both share the index buffer.
+  // the index buffer holds 16 & 32 bit indices, so it's sized in bytes.
+  GLuint vao, packed_vao;
+  GpuBuffer vertices, packed_vertices, indices;
+  // every mesh's positions again as plain vec3s, which is all the shadow
+  // pass reads. it has a vao of its own.
+  GpuBuffer positions;
+  GLuint shadow_vao;
+  // refilled every frame with the transforms & colors of instanced batches.
+  GLuint instance_vbo;
   vector<shared_ptr<MeshRenderer>> meshes = {};
+  RenderStats stats;
+  
+  // renderers sharing a mesh, lod & material get drawn with one instanced
+  // draw once there are at least this many of them.
+  bool instancing_enabled = true;
+  size_t min_instances = 2;
+  
+  // draws everything sharing a program, textures & vao with one
+  // glMultiDrawElementsIndirect, when the driver can.
+  GLuint indirect_buffer, draw_data_buffer;
+  bool indirect_enabled = true;
+  // needs 4.3 for multi draw indirect & ssbos, plus gl_DrawIDARB.
+  static bool indirect_supported();
+  
+  // skips meshes whose bounding sphere is outside the view. on the gpu when
+  // drawing indirect & compute shaders are there, on the cpu otherwise.
+  bool culling_enabled = true;
+  GpuCulling gpu_culling;
+  OcclusionCuller occlusion;
+  // for renderers with occlusion_query set.
+  OcclusionQueries occlusion_queries;
+  // outlines the bounds of everything drawn, through debug::box.
+  bool draw_bounds = false;
+  // renderers on static nodes, merged & drawn in their place.
+  StaticBatcher static_batches;
+  ShadowMaps shadows;
+  // the lights other than the scene's main one, see Light::awake.
+  LightClusters light_clusters;
+  DeferredShading deferred;
+  
+  // a lod gets picked once its error projects to fewer pixels than this.
+  bool lods_enabled = true;
+  float lod_threshold = 1.0f;
+  // fraction the threshold is widened around the current lod by, so meshes
+  // right at the threshold don't pop back and forth.
+  float lod_hysteresis = 0.25f;
   MeshBuffer();
   
   ~MeshBuffer();
 
-  void refresh();
-  void interleave_mesh(const shared_ptr<Mesh> &mesh);
-  void erase_interleaved_data(const size_t index, const shared_ptr<Mesh> &mesh);
+  // appends the mesh to the gpu buffers once, every renderer using it shares the range.
+  void upload_mesh(const shared_ptr<Mesh> &mesh);
+  // writes an uploaded mesh over its own range again, the caller makes sure
+  // it didn't outgrow it.
+  void overwrite_mesh(const shared_ptr<Mesh> &mesh);
   void init();
-  void update_data();
   void erase_mesh(const MeshRenderer *mesh);
-  void render(const mat4 &viewProjectionMatrix) const;
-};
-
-struct Gizmo {
-  weak_ptr<Node> node;
-  vector<float> vertices;
-  vector<unsigned int> indices;
-  vec4 color = {1, 1, 1, 1};
-  static shared_ptr<Shader> shader;
-  static Gizmo create_line(weak_ptr<Node> &owner, const vec3 &start,
-                           const vec3 &end, const vec4 &color) {
-    Gizmo gizmo(owner);
-    auto vertices = {vec4(start, 1.0f), vec4(end, 1.0f)};
-    for (const auto &vertex : vertices) {
-      gizmo.vertices.push_back(vertex.x);
-      gizmo.vertices.push_back(vertex.y);
-      gizmo.vertices.push_back(vertex.z);
-    }
-    gizmo.indices = {0, 1};
-    gizmo.color = color;
-    return gizmo;
-  }
-  static Gizmo create_sphere(weak_ptr<Node> &owner, const float radius,
-                             const float height, const int segments = 32,
-                             const int rings = 32) {
-    Gizmo gizmo(owner);
-    for (int i = 0; i <= segments; i++) {
-      float theta = (float)i / (float)segments * 2.0f * glm::pi<float>();
-      for (int j = 0; j <= rings; j++) {
-        float phi = (float)j / (float)rings * glm::pi<float>();
-        float x = cosf(theta) * sinf(phi);
-        float y = cosf(phi);
-        float z = sinf(theta) * sinf(phi);
-        vec4 vertex = vec4(x * radius, y * radius, z * radius, 1.0f);
-        gizmo.vertices.push_back(vertex.x);
-        gizmo.vertices.push_back(vertex.y);
-        gizmo.vertices.push_back(vertex.z);
-      }
-    }
-    for (int i = 0; i < segments; i++) {
-      for (int j = 0; j < rings; j++) {
-        gizmo.indices.push_back(i * (rings + 1) + j);
-        gizmo.indices.push_back((i + 1) * (rings + 1) + j);
-        gizmo.indices.push_back((i + 1) * (rings + 1) + (j + 1));
-        gizmo.indices.push_back(i * (rings + 1) + j);
-        gizmo.indices.push_back((i + 1) * (rings + 1) + (j + 1));
-        gizmo.indices.push_back(i * (rings + 1) + (j + 1));
-      }
-    }
-    return gizmo;
-  }
-  static Gizmo create_cube(weak_ptr<Node> &owner, const vec3 &size,
-                           const vec4 &color) {
-    Gizmo gizmo(owner);
-    Mesh mesh(std::string("res/prim_mesh/cube.obj"));
-    gizmo.vertices = mesh.vertices;
-    gizmo.indices = mesh.indices;
-    gizmo.color = color;
-    return gizmo;
-  }
-  Gizmo(weak_ptr<Node> &owner) : node(owner) {}
-  ~Gizmo() {}
-};
-
-class GizmoBuffer {
-public:
-  GLuint modelVBO, VBO, VAO, EBO;
-  vector<float> vertices = {};
-  vector<unsigned int> indices = {};
-  vector<glm::mat4> modelMatrices = {};
-  vector<Gizmo> gizmos = {};
-  GizmoBuffer() {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &modelVBO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-  }
-  ~GizmoBuffer() {
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-  }
-  void update_data() {
-    modelMatrices.clear();
-    vertices.clear();
-    indices.clear();
-
-    for (auto &gizmo : this->gizmos) {
-      auto node = gizmo.node.lock();
-      modelMatrices.insert(modelMatrices.end(), node->get_transform());
-      vertices.insert(vertices.end(), gizmo.vertices.begin(),
-                      gizmo.vertices.end());
-      indices.insert(indices.end(), gizmo.indices.begin(), gizmo.indices.end());
-    }
-
-    glBindVertexArray(VAO);
-
-    // vertices
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
-                 vertices.data(), GL_STATIC_DRAW);
-    // indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 indices.data(), GL_STATIC_DRAW);
-
-    // matrices
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
-                          (void *)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float),
-                          (void *)(vertices.size() * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
-  }
-  void render(const mat4 &viewProjectionMatrix)  {
-    glDisable(GL_DEPTH_TEST);
-    glPolygonMode(GL_FRONT, GL_LINE);
-    glBindVertexArray(VAO);
-    const auto shader = Gizmo::shader->program_id;
-    glUseProgram(shader);
-
-    const auto colorLocation = glGetUniformLocation(shader, "color");
-    const auto mmXLocation = glGetUniformLocation(shader, "modelMatrix");
-    const auto viewProjectionMatrixLocation =
-        glGetUniformLocation(shader, "viewProjectionMatrix");
-
-    void *indexOffset = 0;
-    for (auto &gizmo : gizmos) {
-
-      const auto indexCount = gizmo.indices.size();
-      const auto node = gizmo.node.lock();
-      const auto transform_matrix = node->get_transform();
-
-      glUniform4fv(colorLocation, 1, glm::value_ptr(gizmo.color));
-
-      glUniformMatrix4fv(viewProjectionMatrixLocation, 1, GL_FALSE,
-                         glm::value_ptr(viewProjectionMatrix));
-
-      glUniformMatrix4fv(mmXLocation, 1, GL_FALSE,
-                         glm::value_ptr(transform_matrix));
-
-      glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, indexOffset);
-
-      indexOffset = (char *)indexOffset + indexCount * sizeof(unsigned int);
-    }
-
-    gizmos.clear();
-  }
+  size_t select_lod(const MeshRenderer &mesh_renderer, const mat4 &transform,
+                    const RenderView &view) const;
+  // everything on the cpu before the frame graph's passes run: picks the
+  // draws & lods, culls, and updates the light clusters.
+  void prepare(const RenderView &view);
+  // the draws prepare picked, shaded or into the g-buffer.
+  void render_opaque(const RenderView &view, const bool gbuffer);
+  // draws the casters in the view depth only, into whatever framebuffer is
+  // bound, with the shadow shader already in use. static casters are the
+  // static batches & renderers on static nodes. culls from the casters
+  // prepare gathered, so it has to run after it.
+  void render_depth(const mat4 &view_projection, const ShadowCasters casters);
+
+private:
+  vector<DrawItem> draws;
+  // draws of renderers with occlusion queries, drawn on their own.
+  vector<DrawItem> queried_draws;
+  size_t frame = 0;
+  // how prepare decided this frame gets drawn.
+  bool indirect = false, gpu_culled = false;
+  vector<InstanceData> instance_data;
+  vector<DrawElementsIndirectCommand> commands;
+  vector<IndirectDrawData> draw_data;
+  vector<CullData> cull_data;
+  vector<ShadowCaster> shadow_casters;
+  vector<DrawItem> shadow_draws;
+  vector<mat4> shadow_instances;
+  GLuint shadow_instance_vbo;
+  // features every draw asks for on top of its own this frame, SHADOWED
+  // once the shadow maps are in or GBUFFER.
+  ShaderFeatures pass_features = 0;
+  void upload_positions(const Mesh &mesh);
+  void bind_shadow_instances(const size_t first_instance) const;
+  // drops draws the occluders hide, before anything gets submitted.
+  void cull_occluded(const RenderView &view);
+  void render_batched(const RenderView &view);
+  void render_queried(const RenderView &view);
+  void render_indirect(const RenderView &view, const bool gpu_culled);
+  // points the instance attributes of the bound vao at the first instance,
+  // instead of relying on base instance which 3.3 doesn't have.
+  void bind_instances(const size_t first_instance) const;
+  // turns the instance attributes of the bound vao on for an instanced draw,
+  // & back off after it.
+  void enable_instances(const bool enabled) const;
 };
 
 class Renderer {
@@ -246,7 +352,7 @@ class Renderer {
 public:
   GLFWwindow *window;
   MeshBuffer *mesh_buffer;
-  GizmoBuffer *gizmo_buffer;
+  FrameGraph *frame_graph;
   float dt, framerate;
   const char *title;
   int screenWidth;
@@ -258,14 +364,16 @@ public:
            void (*update_loop)(const float &dt));
   ~Renderer();
 
-  void add_gizmo(const Gizmo &gizmo);
   int run();
   void init_opengl();
   void init_imgui();
 
-  void draw_meshes(const mat4 &viewProjectionMatrix) const;
-  void draw_gizmos(const mat4 &viewProjectionMatrix) const;
+  // rebuilds the frame graph & runs it, the scene then the ui.
+  void render_frame(const RenderView &view, const vec3 &sky_color);
+  // everything submitted through debug:: this frame.
+  void draw_debug(const mat4 &viewProjectionMatrix) const;
   void draw_imgui();
+  void draw_stats();
 
   static void resizeCallback(GLFWwindow *window, int width, int height);
 
@@ -275,7 +383,14 @@ public:
   static void apply_lighting_uniforms(const shared_ptr<Shader> &shader,
                                       const GLuint &program_id);
 
-  static void
-  apply_uniforms(const mat4 &viewProjectionMatrix,
-                 const std::shared_ptr<MeshRenderer> &mesh_renderer);
+  // everything that's the same for every object drawn with this material
+  // variant & mesh, so instanced batches only set it once.
+  static void apply_material_uniforms(const mat4 &viewProjectionMatrix,
+                                      Material &material,
+                                      MaterialVariant &variant,
+                                      const Mesh &mesh);
+  static void apply_uniforms(const mat4 &viewProjectionMatrix,
+                             const MeshRenderer &mesh_renderer,
+                             MaterialVariant &variant,
+                             const DrawItem &draw);
 };
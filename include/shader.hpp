@@ -2,21 +2,184 @@
 #include <GLFW/glfw3.h>
 
 #include "usings.hpp"
+#include <array>
 #include <unordered_map>
 #include <yaml-cpp/yaml.h>
 #include "fileio.hpp"
+#include "file_watcher.hpp"
+
+// a program that's been handed to the driver but maybe not finished yet.
+// with GL_KHR_parallel_shader_compile the driver builds these in the
+// background, and we only ask for the results once it says it's done.
+// compute programs only use vertex, for their one stage.
+struct ShaderBuild {
+  GLuint vertex = 0, fragment = 0, program = 0;
+  std::string binary_key;
+  bool from_binary = false;
+  bool is_complete() const;
+};
+
+// compile time switches for the engine's shaders, each one becomes a #define
+// of the same name. every combination that's used is its own program.
+using ShaderFeatures = uint32_t;
+enum ShaderFeature : ShaderFeatures {
+  TEXTURED = 1 << 0,
+  LIT = 1 << 1,
+  SHADOWED = 1 << 2,
+  // model matrix & color come from per instance attributes, not uniforms.
+  INSTANCED = 1 << 3,
+  PACKED_VERTICES = 1 << 4,
+  // samples a slot of the TextureAtlas instead of its own texture.
+  ATLASED = 1 << 5,
+  // per draw data comes from an ssbo indexed by gl_DrawIDARB, for
+  // glMultiDrawElementsIndirect. bumps the shaders to glsl 430.
+  INDIRECT = 1 << 6,
+  // writes albedo & normal to the g-buffer instead of lighting, for
+  // DeferredShading.
+  GBUFFER = 1 << 7,
+  SHADER_FEATURE_COUNT = 8,
+};
+vector<std::string> shader_feature_defines(const ShaderFeatures features);
+
+// uniforms the engine sets itself. these are looked up once per program and
+// addressed by index afterwards, instead of hashing a name on every draw.
+enum class Uniform : size_t {
+  ViewProjectionMatrix,
+  ModelMatrix,
+  NormalMatrix,
+  Color,
+  LightPosition,
+  LightColor,
+  LightRadius,
+  LightIntensity,
+  CastShadows,
+  TextureSampler,
+  PositionScale,
+  PositionOffset,
+  AtlasSampler,
+  AtlasRect,
+  AtlasLayer,
+  DrawOffset,
+  LightDirection,
+  DirectionalLight,
+  ShadowCascades,
+  ShadowCube,
+  ShadowMatrices,
+  ShadowFar,
+  ClusteredLights,
+  ClusterLights,
+  ClusterGrid,
+  ClusterIndices,
+  ViewMatrix,
+  ClusterScale,
+  GBufferAlbedo,
+  GBufferNormal,
+  GBufferDepth,
+  InverseViewProjection,
+  CameraPosition,
+  Count,
+};
+
+// one active uniform as reported by the program. uniforms inside a block have
+// no location, instead they have the block's index and their byte offset.
+struct UniformInfo {
+  std::string name;
+  GLenum type;
+  GLint size;
+  GLint location = -1;
+  GLint block_index = -1;
+  GLint block_offset = -1;
+};
+
+struct UniformBlockInfo {
+  std::string name;
+  GLuint index;
+  GLint size;
+  GLint binding;
+};
 
 class Shader {
 public:
-  GLuint program_id;
-  unordered_map<std::string, GLuint> uniform_locations = {};
+  GLuint program_id = 0;
+  // bumped every time program_id gets swapped, so things caching locations
+  // from this shader know to look them up again.
+  size_t generation = 0;
+  // everything glGetActiveUniform(s) reports, in the program's own order.
+  vector<UniformInfo> uniforms = {};
+  vector<UniformBlockInfo> uniform_blocks = {};
+  // -1 for engine uniforms the program doesn't use, which GL ignores.
+  std::array<GLint, (size_t)Uniform::Count> engine_uniforms;
+  // compute programs leave frag_path empty and read vertex_path as the
+  // compute stage.
   std::string vertex_path, frag_path;
-  Shader() {}
-  void compile_shader(const std::string &vertex_path,
+  bool is_compute() const { return frag_path.empty(); }
+  // injected as #define lines right after the #version line of both stages.
+  vector<std::string> defines = {};
+  // the features the defines were made from, 0 for hand written defines.
+  ShaderFeatures features = 0;
+  Shader() { engine_uniforms.fill(-1); }
+  // compiles & links right away. if it fails, the error is reported and the
+  // previous program (if any) is kept, so a typo never leaves us drawing
+  // with a broken program.
+  bool compile_shader(const std::string &vertex_path,
                  const std::string &fragment_path);
+  ShaderBuild begin_compile() const;
+  // swaps the new program in if it built, otherwise deletes it and leaves
+  // error with the info log.
+  bool finish_compile(ShaderBuild &build, std::string &error);
                  
-  Shader(const std::string vertex_path, const std::string frag_path);
+  Shader(const std::string vertex_path, const std::string frag_path,
+         const vector<std::string> &defines = {});
   ~Shader();
   YAML::Node serialize();
   void deserialize(const YAML::Node &in);
-};
\ No newline at end of file
+  
+  GLint location(const Uniform uniform) const {
+    return engine_uniforms[(size_t)uniform];
+  }
+  // index into uniforms, or -1. meant to be resolved once & kept, not per draw.
+  int find_uniform(const std::string &name) const;
+
+private:
+  void reflect_uniforms();
+};
+
+// hands out one shared Shader per set of sources & defines, and persists linked
+// programs to disk with glGetProgramBinary so later launches skip compiling.
+class ShaderCache {
+public:
+  static std::string directory;
+  static shared_ptr<Shader> get(const std::string &vertex_path,
+                                const std::string &frag_path,
+                                const vector<std::string> &defines = {});
+  // the variant of a shader with exactly these features.
+  static shared_ptr<Shader> get(const std::string &vertex_path,
+                                const std::string &frag_path,
+                                const ShaderFeatures features);
+  // a compute program, needs 4.3 or ARB_compute_shader.
+  static shared_ptr<Shader> get_compute(const std::string &path,
+                                        const vector<std::string> &defines = {});
+  // returns 0 if there's no usable binary for these sources on this driver.
+  static GLuint load_program_binary(const std::string &key);
+  static void save_program_binary(const std::string &key, const GLuint program);
+  // hashes the preprocessed sources together with the driver, binaries
+  // from another driver (version) are useless.
+  static std::string binary_key(const std::string &vertex_source,
+                                const std::string &frag_source);
+  
+  // call once a frame, outside of any draws. picks up edited shader sources
+  // and starts rebuilding every shader that uses them, then swaps in the
+  // ones whose rebuilds have finished.
+  static void update();
+  static void reload(const std::string &path);
+  // drops every shader & build in flight, while the context is still alive.
+  static void clear();
+
+private:
+  // behind functions, the engine gets its shaders during static init, before
+  // members of this file would be constructed.
+  static unordered_map<std::string, shared_ptr<Shader>> &shaders();
+  static vector<std::pair<weak_ptr<Shader>, ShaderBuild>> &pending();
+  static std::unique_ptr<FileWatcher> watcher;
+  static bool binaries_supported();
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include "usings.hpp"
+#include <GL/glew.h>
+#include <array>
+
+class Shader;
+class MeshBuffer;
+struct RenderView;
+
+// which casters a depth pass draws, static ones go into the cached maps.
+enum class ShadowCasters {
+  All,
+  Static,
+  Dynamic,
+};
+
+// shadow maps for the scene's light, when it has cast_shadows set. point
+// lights get a cube map of distances, directional ones cascades of orthographic
+// maps around the camera, each covering four times the radius of the one
+// before.
+// static casters are drawn into maps of their own, which are only redrawn
+// when a view moves or the static geometry changes. every frame those get
+// copied over & just the dynamic casters drawn on top.
+class ShadowMaps {
+  ShadowMaps(const ShadowMaps &) = delete;
+  ShadowMaps &operator=(const ShadowMaps &) = delete;
+
+public:
+  static constexpr int CASCADE_COUNT = 3;
+  bool enabled = true;
+  bool cache_static = true;
+  int cascade_resolution = 2048, cube_resolution = 1024;
+  // how far from the camera directional shadows reach.
+  float shadow_distance = 60.0f;
+  // how far behind a cascade casters are still picked up, towards the light.
+  float caster_distance = 100.0f;
+  // how often the static maps were redrawn since the start, for the stats.
+  size_t static_redraws = 0;
+
+  // what the last frame rendered, read by the lighting uniforms.
+  bool active = false;
+  bool directional = false;
+  std::array<mat4, CASCADE_COUNT> cascade_matrices;
+  // point lights store the distance divided by this.
+  float far_plane = 1.0f;
+
+  ShadowMaps() = default;
+  ~ShadowMaps();
+  // renders the maps for the scene light, or leaves active unset if there
+  // is nothing to do. call before the opaque pass.
+  void render(MeshBuffer &buffer, const RenderView &view);
+  // the static maps get redrawn next frame.
+  void invalidate() { views.fill({}); }
+  // binds the maps & sets the shadow uniforms of a SHADOWED variant.
+  void apply_uniforms(const Shader &shader) const;
+
+private:
+  // the six faces of a cube, or the cascades.
+  struct CachedView {
+    mat4 view_projection = mat4(0.0f);
+    bool valid = false;
+  };
+  std::array<CachedView, 6> views;
+  // depth textures, the cascades are 2d arrays.
+  GLuint cascades = 0, static_cascades = 0, cube = 0, static_cube = 0;
+  GLuint fbo = 0, copy_fbo = 0;
+  int allocated_cascade_resolution = 0, allocated_cube_resolution = 0;
+  shared_ptr<Shader> depth_shader, distance_shader;
+  void allocate();
+  // attaches a layer of an array, or a face of a cube map, as fbo's depth.
+  void attach(const GLuint target_fbo, const GLuint texture, const int layer,
+              const bool is_cube) const;
+  // draws one view, from the static copy if it's still good.
+  void render_view(MeshBuffer &buffer, const int index, const mat4 &view_projection,
+                   const bool is_cube);
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include "mesh.hpp"
+#include "usings.hpp"
+#include <map>
+#include <tuple>
+
+class MeshBuffer;
+
+// merges the renderers of static nodes into pre-transformed meshes, one per
+// material, color & cell of a grid over the world. each of those is a single
+// draw with an identity model matrix. triangles are binned into cells one by
+// one, so even a single big mesh (a whole level) gets split up and culling
+// still has something to throw away.
+// the transforms are baked in when a renderer joins a batch, moving a static
+// node does nothing until it's unmarked.
+class StaticBatcher {
+  StaticBatcher(const StaticBatcher &) = delete;
+  StaticBatcher &operator=(const StaticBatcher &) = delete;
+
+public:
+  // off draws every renderer on its own again, the batches are kept around.
+  bool enabled = true;
+  // edge of the grid cells, in world units. only applies to batches built
+  // after it changes.
+  float cluster_size = 32.0f;
+  // set when a node's static flag changes, a static renderer wakes up or a
+  // batched one's node is gone. MeshBuffer calls update before the next
+  // frame.
+  bool dirty = false;
+  // one per cell of every batch, these have no node & get drawn where they
+  // are.
+  vector<shared_ptr<MeshRenderer>> renderers;
+  size_t batched_count() const;
+
+  StaticBatcher() = default;
+  // takes renderers whose nodes aren't static anymore out of their batches,
+  // puts new static ones into theirs & rebuilds the batches that changed.
+  void update(MeshBuffer &buffer);
+
+private:
+  // material & color.
+  using Key = std::tuple<Material *, float, float, float, float>;
+  using Cell = std::tuple<int, int, int>;
+  // the triangles of a batch that fall in one cell.
+  struct Cluster {
+    shared_ptr<MeshRenderer> renderer;
+    // what the cluster's ranges in the mesh buffer hold at most, it's
+    // rewritten in place as long as it still fits.
+    size_t vertex_capacity = 0, index_bytes_capacity = 0;
+    bool short_indices = false;
+  };
+  struct Batch {
+    vector<shared_ptr<MeshRenderer>> members;
+    std::map<Cell, Cluster> clusters;
+  };
+  std::map<Key, Batch> batches;
+  // full detail vertices & indices of a source mesh, read back from the mesh
+  // buffer since the cpu copy is usually gone by now.
+  struct Source {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+  };
+  static Key key(const MeshRenderer &renderer);
+  // the cell a triangle's centroid falls in.
+  Cell cell(const vec3 &a, const vec3 &b, const vec3 &c) const;
+  void rebuild(MeshBuffer &buffer, Batch &batch,
+               unordered_map<const Mesh *, Source> &sources);
+  // writes the cluster's mesh over its old range if it fits, or appends it.
+  void upload(MeshBuffer &buffer, Cluster &cluster) const;
+  static Source read_back(const MeshBuffer &buffer, const Mesh &mesh);
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "usings.hpp"
+#include "texture_compression.hpp"
+#include <GL/glew.h>
+
+struct AtlasPage;
+
+// where a texture ended up in the atlas. rect is the uv offset (xy) and
+// scale (zw) that maps the texture's own uvs onto its slot.
+struct AtlasSlot {
+  int layer = -1;
+  int x = 0, y = 0;
+  vec4 rect = vec4(0, 0, 1, 1);
+  bool valid() const { return layer != -1; }
+};
+
+// packs small textures into the layers of one GL_TEXTURE_2D_ARRAY with
+// stb_rectpack. materials whose textures live here only differ by a uv rect &
+// layer, which go per instance, so they can share one batch.
+class TextureAtlas {
+public:
+  static TextureAtlas &current() {
+    static TextureAtlas instance;
+    return instance;
+  }
+  TextureAtlas(const TextureAtlas &) = delete;
+  TextureAtlas &operator=(const TextureAtlas &) = delete;
+  ~TextureAtlas();
+
+  static constexpr int PAGE_SIZE = 1024;
+  // textures bigger than this on either side stay standalone.
+  static constexpr int MAX_TEXTURE_SIZE = 256;
+  // the mip levels the atlas keeps. slots are aligned to & padded by one
+  // cell, so even the smallest level never reaches into a neighbour.
+  static constexpr int LEVELS = 5;
+  static constexpr int CELL = 1 << (LEVELS - 1);
+
+  // only affects textures loaded after it changes.
+  bool enabled = true;
+  GLuint texture = 0;
+  int layer_count = 0;
+
+  static bool eligible(const int width, const int height,
+                       const texture_compression::BlockFormat compression);
+  // reserves a slot for a width x height texture, adding a layer if they're
+  // all full. the slot is invalid if there's no room & the array can't grow.
+  AtlasSlot allocate(const int width, const int height);
+  size_t gpu_bytes() const;
+
+private:
+  TextureAtlas();
+  vector<std::unique_ptr<AtlasPage>> pages;
+  bool grow();
+};
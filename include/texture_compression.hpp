@@ -0,0 +1,68 @@
+#pragma once
+#include "usings.hpp"
+#include <cstdint>
+
+class ThreadPool;
+
+// BCn block compression (the s3tc / rgtc formats gpus sample from directly)
+// and the .mtex container that baked textures are stored in. nothing in here
+// touches gl, so the bake tool can use it without a context.
+namespace texture_compression {
+
+enum class BlockFormat : uint32_t {
+  None = 0,
+  // rgb at 4 bits per pixel.
+  BC1 = 1,
+  // rgba at 8 bits per pixel, the alpha gets its own block.
+  BC3 = 3,
+  // two independent channels at 8 bits per pixel, made for normal maps.
+  BC5 = 5,
+};
+
+size_t block_bytes(const BlockFormat format);
+size_t level_bytes(const BlockFormat format, const int width, const int height);
+BlockFormat parse_block_format(const std::string &name);
+
+// a 4x4 block of rgba pixels, row by row.
+void encode_bc1_block(const uint8_t *rgba, uint8_t *out);
+void encode_bc3_block(const uint8_t *rgba, uint8_t *out);
+// reads the red & green channels.
+void encode_bc5_block(const uint8_t *rgba, uint8_t *out);
+// the plain c versions. the sse2 ones above have to match them bit for bit,
+// tools/check_texture_compression.cpp checks that.
+void encode_bc1_block_scalar(const uint8_t *rgba, uint8_t *out);
+void encode_bc3_block_scalar(const uint8_t *rgba, uint8_t *out);
+void encode_bc5_block_scalar(const uint8_t *rgba, uint8_t *out);
+
+// writes a 4x4 block of rgba pixels, bc5 gives (r, g, 0, 255).
+void decode_block(const BlockFormat format, const uint8_t *block, uint8_t *rgba);
+
+// compresses a tightly packed rgba image. with a pool, rows of blocks are
+// spread over its threads; don't pass one when running on one of its workers.
+vector<uint8_t> encode_image(const BlockFormat format, const uint8_t *rgba,
+                             const int width, const int height,
+                             ThreadPool *pool = nullptr);
+// back to tightly packed pixels with channel_count channels (2 for bc5 or 4),
+// for when the gpu can't sample the format itself.
+vector<uint8_t> decode_image(const BlockFormat format, const uint8_t *data,
+                             const int width, const int height,
+                             const int channel_count);
+
+// every mip level of an image, box filtered down from level 0.
+vector<vector<uint8_t>> build_mip_chain(const uint8_t *pixels, const int width,
+                                        const int height,
+                                        const int channel_count);
+
+struct CompressedImage {
+  BlockFormat format = BlockFormat::None;
+  int width = 0, height = 0;
+  vector<vector<uint8_t>> levels;
+};
+
+// .mtex layout : "MTEX", version, format, width, height, level count, then
+// each level's byte size followed by its blocks. all little endian uint32s.
+bool write_container(const std::string &path, const CompressedImage &image);
+// false for anything that isn't a well formed container of a known format.
+bool read_container(const std::string &path, CompressedImage &image);
+
+} // namespace texture_compression
@@ -0,0 +1,81 @@
+#pragma once
+#include "usings.hpp"
+#include "texture_compression.hpp"
+#include <GL/glew.h>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+class Texture;
+
+// a texture decoded on a worker, with its whole mip chain built on the cpu.
+struct DecodedTexture {
+  weak_ptr<Texture> texture;
+  int width = 0, height = 0, channel_count = 0;
+  // levels[0] is the full size image. for compressed textures these are
+  // blocks, and a "row" is a row of 4x4 blocks.
+  vector<vector<unsigned char>> levels;
+  texture_compression::BlockFormat compression =
+      texture_compression::BlockFormat::None;
+  // already expanded to rgba & cut down to the atlas' levels.
+  bool for_atlas = false;
+};
+
+// a texture part way through being uploaded, coarsest level first.
+struct TextureUpload {
+  shared_ptr<Texture> texture;
+  DecodedTexture image;
+  int level;
+  int next_row = 0;
+};
+
+// decodes textures on the thread pool and feeds them to the gpu through a
+// ring of pixel buffers, a few rows at a time under a per frame byte budget.
+// until a texture's coarsest mip arrives its handle is the placeholder, after
+// that every finished level lowers GL_TEXTURE_BASE_LEVEL so it sharpens up.
+class TextureStreamer {
+public:
+  static TextureStreamer &current() {
+    static TextureStreamer instance;
+    return instance;
+  }
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+  ~TextureStreamer();
+
+  size_t bytes_per_frame = 4 * 1024 * 1024;
+  // what update() pushed last frame.
+  size_t uploaded_bytes = 0;
+
+  void request(const shared_ptr<Texture> &texture);
+  // call once a frame, outside of any draws.
+  void update();
+  // textures still decoding or uploading.
+  size_t pending() const { return decoding + uploads.size(); }
+  GLuint placeholder();
+
+private:
+  TextureStreamer() = default;
+  static constexpr size_t RING_SIZE = 3;
+  struct PixelBuffer {
+    GLuint id = 0;
+    size_t capacity = 0;
+    // signalled once the gpu is done reading what we last wrote.
+    GLsync fence = nullptr;
+  };
+  std::array<PixelBuffer, RING_SIZE> ring;
+  size_t ring_index = 0;
+
+  std::mutex mutex;
+  vector<DecodedTexture> decoded;
+  std::atomic<size_t> decoding = 0;
+  std::deque<TextureUpload> uploads;
+  GLuint placeholder_texture = 0;
+
+  static void decode(DecodedTexture &image, const std::string &path);
+  // loads a baked .mtex, decoding the blocks on the cpu if the gpu can't.
+  static bool decode_baked(DecodedTexture &image, const std::string &path,
+                           const bool gpu_decodes);
+  static void prepare_for_atlas(DecodedTexture &image);
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include "usings.hpp"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+// a fixed set of worker threads pulling jobs off one queue. jobs can't be
+// cancelled or waited on individually, they report back however they like.
+class ThreadPool {
+public:
+  ThreadPool(const size_t thread_count = default_thread_count());
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> job);
+  // runs fn(begin, end) over chunks of [0, count) on the workers and waits
+  // for all of them. calling it from a worker can deadlock, so don't.
+  void parallel_for(const size_t count,
+                    const std::function<void(size_t, size_t)> &fn);
+  size_t thread_count() const { return threads.size(); }
+  // a thread per core but the main one's. hardware_concurrency can be 0 when
+  // it doesn't know, which mustn't wrap around.
+  static size_t default_thread_count() {
+    const auto cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+  }
+
+  // the pool the engine shares for background work.
+  static ThreadPool &shared() {
+    static ThreadPool instance;
+    return instance;
+  }
+
+private:
+  vector<std::thread> threads;
+  std::queue<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+  void worker_loop();
+};
@@ -0,0 +1,16 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPosition;
+// per instance, see DebugInstance.
+layout (location = 1) in mat4 aModel;
+layout (location = 5) in vec4 aColor;
+
+uniform mat4 viewProjectionMatrix;
+
+out vec4 vColor;
+
+void main()
+{
+    vColor = aColor;
+    gl_Position = viewProjectionMatrix * aModel * vec4(aPosition, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#version 330 core
+
+// the deferred lighting passes with fragment.glsl. a triangle covering the
+// screen, or with LIGHT_VOLUME a sphere around each clustered light, one
+// instance per light.
+#ifdef LIGHT_VOLUME
+layout (location = 0) in vec3 aPosition;
+
+// each light is (position, culling radius), (color * intensity, range).
+uniform samplerBuffer clusterLights;
+uniform mat4 viewProjectionMatrix;
+
+flat out int vLight;
+#endif
+
+void main()
+{
+#ifdef LIGHT_VOLUME
+    vec4 positionRadius = texelFetch(clusterLights, gl_InstanceID * 2);
+    vLight = gl_InstanceID;
+    gl_Position = viewProjectionMatrix * vec4(positionRadius.xyz + aPosition * positionRadius.w, 1.0);
+#else
+    // no buffers, the corners come from the vertex id.
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+#endif
+}
\ No newline at end of file
@@ -1,27 +1,154 @@
 #version 330 core
 
+// besides the ShaderFeatures, LIGHTING_PASS makes this the deferred lighting
+// pass over the g-buffer, & LIGHT_VOLUME that for one clustered light. see
+// DeferredShading.
+#ifndef LIGHTING_PASS
 in vec2 vTexCoord;
 in vec3 vNormal;
 in vec3 FragPos;
+in vec4 vColor;
+#endif
 
-out vec4 FragColor;
-uniform vec4 color;
+layout (location = 0) out vec4 FragColor;
+#ifdef GBUFFER
+// the albedo goes to FragColor.
+layout (location = 1) out vec2 gbufferNormalOut;
+#endif
 
+#ifdef LIT
 uniform vec3 lightPosition;
 uniform vec3 lightColor;
 uniform float lightRadius;
 uniform float lightIntensity;
-uniform int castShadows;
-uniform int hasTexture;
+// towards a directional light, which has no position.
+uniform vec3 lightDirection;
+uniform bool directionalLight;
 
+// every other point light, culled into froxels on the cpu. see LightClusters,
+// the grid size has to match.
+const ivec3 clusterGridSize = ivec3(16, 9, 24);
+// each light is (position, culling radius), (color * intensity, range).
+uniform samplerBuffer clusterLights;
+// (first, count) into clusterIndices per froxel.
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform bool clusteredLights;
+uniform mat4 viewMatrix;
+// positions are in world space, so the view direction comes from here.
+uniform vec3 cameraPosition;
+// xy turn pixels into tiles, zw the log of view depth into a slice.
+uniform vec4 clusterScale;
+
+// one of the clustered lights.
+vec3 pointLight(int light, vec3 position, vec3 norm, vec3 viewDir)
+{
+    vec4 positionRadius = texelFetch(clusterLights, light * 2);
+    vec4 colorRange = texelFetch(clusterLights, light * 2 + 1);
+    vec3 toLight = positionRadius.xyz - position;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / max(distance, 1e-4);
+    // the main light's falloff, faded out to 0 at the culling radius.
+    float attenuation = 1.0 / (1.0 + (0.09 / colorRange.w) * distance + (0.032 / (colorRange.w * colorRange.w)) * distance * distance);
+    float fade = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+    attenuation *= fade * fade;
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32);
+    return (diff + 0.5 * spec) * colorRange.rgb * attenuation;
+}
+
+vec3 clusteredLighting(vec3 position, vec3 norm, vec3 viewDir)
+{
+    float depth = -(viewMatrix * vec4(position, 1.0)).z;
+    ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterScale.xy),
+                       int(floor(log(max(depth, 1e-4)) * clusterScale.z + clusterScale.w)));
+    cell = clamp(cell, ivec3(0), clusterGridSize - 1);
+    int cluster = cell.x + clusterGridSize.x * (cell.y + clusterGridSize.y * cell.z);
+    uvec2 range = texelFetch(clusterGrid, cluster).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+        result += pointLight(light, position, norm, viewDir);
+    }
+    return result;
+}
+#endif
+
+#ifdef SHADOWED
+uniform bool castShadows;
+uniform sampler2DArrayShadow shadowCascades;
+uniform samplerCubeShadow shadowCube;
+// world space to [0, 1] in each cascade, ShadowMaps::CASCADE_COUNT of them.
+uniform mat4 shadowMatrices[3];
+uniform float shadowFar;
+
+// 1 where the light gets through, 0 in shadow.
+float shadowFactor(vec3 position)
+{
+    if (!castShadows) {
+        return 1.0;
+    }
+    if (directionalLight) {
+        vec2 texel = 1.0 / vec2(textureSize(shadowCascades, 0).xy);
+        // the first, finest cascade that covers us.
+        for (int i = 0; i < 3; i++) {
+            vec3 coords = (shadowMatrices[i] * vec4(position, 1.0)).xyz;
+            if (any(lessThan(coords, vec3(0.0))) || any(greaterThan(coords, vec3(1.0)))) {
+                continue;
+            }
+            // 3x3 taps, each one already 2x2 pcf in the hardware.
+            float lit = 0.0;
+            for (int x = -1; x <= 1; x++) {
+                for (int y = -1; y <= 1; y++) {
+                    lit += texture(shadowCascades, vec4(coords.xy + vec2(x, y) * texel, float(i), coords.z - 0.0005));
+                }
+            }
+            return lit / 9.0;
+        }
+        return 1.0;
+    }
+    vec3 fromLight = position - lightPosition;
+    return texture(shadowCube, vec4(fromLight, length(fromLight) / shadowFar - 0.002));
+}
+#endif
+
+#ifdef TEXTURED
 uniform sampler2D textureSampler;
+#endif
 
-void main()
+#ifdef ATLASED
+in vec4 vAtlasRect;
+flat in float vAtlasLayer;
+uniform sampler2DArray atlasSampler;
+
+// the sampler can't wrap within a slot, so wrap by hand and keep half a
+// texel away from the edges. gradients come from the unwrapped uvs so the
+// seams don't pick the smallest mip.
+vec4 sampleAtlas(vec2 uv)
+{
+    vec2 slotSize = vAtlasRect.zw * vec2(textureSize(atlasSampler, 0).xy);
+    vec2 halfTexel = 0.5 / slotSize;
+    vec2 wrapped = clamp(fract(uv), halfTexel, 1.0 - halfTexel);
+    vec2 atlasUv = vAtlasRect.xy + wrapped * vAtlasRect.zw;
+    return textureGrad(atlasSampler, vec3(atlasUv, vAtlasLayer),
+                       dFdx(uv) * vAtlasRect.zw, dFdy(uv) * vAtlasRect.zw);
+}
+#endif
+
+#ifdef LIT
+// everything the lights add up to at a point: ambient, the main light & the
+// clustered ones.
+vec3 shade(vec3 position, vec3 norm)
 {
-    vec3 norm = normalize(vNormal);
-    vec3 lightDir = normalize(lightPosition - FragPos);
-    float distance = length(lightPosition - FragPos);
+    vec3 lightDir = normalize(lightPosition - position);
+    float distance = length(lightPosition - position);
     float attenuation = 1.0 / (1.0 + (0.09 / lightRadius) * distance + (0.032 / (lightRadius * lightRadius)) * distance * distance);
+    if (directionalLight) {
+        lightDir = normalize(lightDirection);
+        attenuation = 1.0;
+    }
 
     // Ambient
     vec3 ambient = 0.1 * lightColor;
@@ -31,13 +158,102 @@ void main()
     vec3 diffuse = diff * lightColor;
 
     // Specular
-    vec3 viewDir = normalize(-FragPos);
+    vec3 viewDir = normalize(cameraPosition - position);
     vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
     vec3 specular = 0.5 * spec * lightColor;
     
     // Combine results
-    vec3 lighting = ambient + (diffuse + specular) * lightIntensity * attenuation;
-    vec4 textureColor = (hasTexture == 1) ? texture(textureSampler, vTexCoord) : color;
+#ifdef SHADOWED
+    float shadow = shadowFactor(position);
+#else
+    float shadow = 1.0;
+#endif
+    vec3 lighting = ambient + (diffuse + specular) * lightIntensity * attenuation * shadow;
+    if (clusteredLights) {
+        lighting += clusteredLighting(position, norm, viewDir);
+    }
+    return lighting;
+}
+#endif
+
+#if defined(GBUFFER) || defined(LIGHTING_PASS)
+// normals in two [0, 1] channels, the same octahedral mapping packed
+// vertices use.
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0) {
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return e * 0.5 + 0.5;
+}
+
+vec3 octDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+#endif
+
+#ifdef LIGHTING_PASS
+uniform sampler2D gbufferAlbedo;
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferDepth;
+uniform mat4 inverseViewProjection;
+#ifdef LIGHT_VOLUME
+flat in int vLight;
+#endif
+#endif
+
+void main()
+{
+#ifdef LIGHTING_PASS
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbufferDepth, pixel, 0).r;
+    // nothing was drawn here, the sky stays.
+    if (depth == 1.0) {
+        discard;
+    }
+    // a is 1 for lit materials, 0 for unlit ones.
+    vec4 albedo = texelFetch(gbufferAlbedo, pixel, 0);
+    vec3 norm = octDecode(texelFetch(gbufferNormal, pixel, 0).xy);
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0));
+    vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 position = world.xyz / world.w;
+#ifdef LIGHT_VOLUME
+    vec3 light = pointLight(vLight, position, norm, normalize(cameraPosition - position));
+    FragColor = vec4(light * albedo.rgb * albedo.a, 1.0);
+#else
+    vec3 lighting = albedo.a > 0.5 ? shade(position, norm) : vec3(1.0);
+    FragColor = vec4(lighting * albedo.rgb, 1.0);
+#endif
+#else
+#if defined(ATLASED)
+    vec4 textureColor = sampleAtlas(vTexCoord);
+#elif defined(TEXTURED)
+    vec4 textureColor = texture(textureSampler, vTexCoord);
+#else
+    vec4 textureColor = vColor;
+#endif
+#if defined(GBUFFER)
+#ifdef LIT
+    FragColor = vec4(textureColor.rgb, 1.0);
+#else
+    FragColor = vec4(textureColor.rgb, 0.0);
+#endif
+    gbufferNormalOut = octEncode(normalize(vNormal));
+#else
+#ifdef LIT
+    vec3 lighting = shade(FragPos, normalize(vNormal));
+#else
+    vec3 lighting = vec3(1.0);
+#endif
     FragColor = vec4(lighting, 1.0) * textureColor;
+#endif
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330 core
+
+in vec3 vWorldPosition;
+
+#ifdef DISTANCE
+// point lights store the distance to the light, scaled to [0, 1], which is
+// what the cube map lookup compares against.
+uniform vec3 lightPosition;
+uniform float shadowFar;
+#endif
+
+void main()
+{
+#ifdef DISTANCE
+    gl_FragDepth = length(vWorldPosition - lightPosition) / shadowFar;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330 core
+
+// the shadow pass, positions & a model matrix per instance only. see
+// MeshBuffer::render_depth.
+layout (location = 0) in vec3 aPosition;
+layout (location = 3) in mat4 aModelMatrix;
+
+uniform mat4 viewProjectionMatrix;
+
+out vec3 vWorldPosition;
+
+void main()
+{
+    vec4 worldPosition = aModelMatrix * vec4(aPosition, 1.0);
+    vWorldPosition = worldPosition.xyz;
+    gl_Position = viewProjectionMatrix * worldPosition;
+}
\ No newline at end of file
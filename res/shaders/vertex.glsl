@@ -1,20 +1,119 @@
 #version 330 core
 
+// compiled with any of TEXTURED, LIT, SHADOWED, INSTANCED, PACKED_VERTICES,
+// ATLASED & INDIRECT defined, see ShaderFeature. INDIRECT raises the
+// version to 430.
+#ifdef INDIRECT
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+
 layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec2 aTexCoord;
-layout (location = 2) in vec3 aNormal;
+// float meshes give (x, y, z, 1), packed ones an octahedral normal in xy.
+layout (location = 2) in vec4 aNormal;
+
+// the normal matrix is worked out once per object on the cpu, see
+// normal_matrix in renderer.cpp.
+#if defined(INDIRECT)
+// one per command of the multi draw, see IndirectDrawData in renderer.hpp.
+struct DrawData
+{
+    mat4 model;
+    mat3 normal;
+    vec4 color;
+    vec4 atlasRect;
+    vec4 positionScale;
+    vec4 positionOffset;
+    float atlasLayer;
+};
+layout (std430, binding = 0) readonly buffer DrawBuffer
+{
+    DrawData draws[];
+};
+// gl_DrawIDARB starts over for every multi draw, this is where ours start.
+uniform int drawOffset;
+#elif defined(INSTANCED)
+layout (location = 3) in mat4 aModelMatrix;
+layout (location = 7) in vec4 aColor;
+layout (location = 8) in mat3 aNormalMatrix;
+layout (location = 11) in vec4 aAtlasRect;
+layout (location = 12) in float aAtlasLayer;
+#else
+uniform mat4 modelMatrix;
+uniform mat3 normalMatrix;
+uniform vec4 color;
+uniform vec4 atlasRect;
+uniform float atlasLayer;
+#endif
 
 out vec2 vTexCoord;
 out vec3 vNormal;
 out vec3 FragPos;
+out vec4 vColor;
+#ifdef ATLASED
+out vec4 vAtlasRect;
+flat out float vAtlasLayer;
+#endif
 
 uniform mat4 viewProjectionMatrix;
-uniform mat4 modelMatrix;
+
+#ifdef PACKED_VERTICES
+// packed meshes quantize positions to [0, 1] within their bounds.
+#ifndef INDIRECT
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+#endif
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+#endif
 
 void main()
 {
-    gl_Position = viewProjectionMatrix * modelMatrix * vec4(aPosition, 1.0);
+#if defined(INDIRECT)
+    DrawData draw = draws[drawOffset + gl_DrawIDARB];
+    mat4 model = draw.model;
+    mat3 normalModel = draw.normal;
+    vColor = draw.color;
+    vec3 positionScale = draw.positionScale.xyz;
+    vec3 positionOffset = draw.positionOffset.xyz;
+#ifdef ATLASED
+    vAtlasRect = draw.atlasRect;
+    vAtlasLayer = draw.atlasLayer;
+#endif
+#elif defined(INSTANCED)
+    mat4 model = aModelMatrix;
+    mat3 normalModel = aNormalMatrix;
+    vColor = aColor;
+#ifdef ATLASED
+    vAtlasRect = aAtlasRect;
+    vAtlasLayer = aAtlasLayer;
+#endif
+#else
+    mat4 model = modelMatrix;
+    mat3 normalModel = normalMatrix;
+    vColor = color;
+#ifdef ATLASED
+    vAtlasRect = atlasRect;
+    vAtlasLayer = atlasLayer;
+#endif
+#endif
+
+#ifdef PACKED_VERTICES
+    vec3 position = positionOffset + aPosition * positionScale;
+    vec3 normal = octDecode(aNormal.xy);
+#else
+    vec3 position = aPosition;
+    vec3 normal = aNormal.xyz;
+#endif
+    vec4 worldPosition = model * vec4(position, 1.0);
+    gl_Position = viewProjectionMatrix * worldPosition;
     vTexCoord = aTexCoord;
-    vNormal = mat3(transpose(inverse(modelMatrix))) * aNormal;
-    FragPos = vec3(modelMatrix * vec4(aPosition, 1.0));
-}
\ No newline at end of file
+    vNormal = normalModel * normal;
+    FragPos = worldPosition.xyz;
+}
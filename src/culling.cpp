@@ -0,0 +1,199 @@
+#include "../include/culling.hpp"
+#include "../include/engine.hpp"
+#include "../include/renderer.hpp"
+
+Frustum frustum_planes(const mat4 &view_projection) {
+  // gribb & hartmann, each plane is the last row plus or minus another one.
+  const auto row = [&](const int i) {
+    return vec4(view_projection[0][i], view_projection[1][i],
+                view_projection[2][i], view_projection[3][i]);
+  };
+  Frustum frustum = {row(3) + row(0), row(3) - row(0), row(3) + row(1),
+                     row(3) - row(1), row(3) + row(2), row(3) - row(2)};
+  for (auto &plane : frustum) {
+    plane = plane * (1.0f / glm::length(vec3(plane)));
+  }
+  return frustum;
+}
+bool sphere_in_frustum(const Frustum &frustum, const vec3 &center,
+                       const float radius) {
+  for (const auto &plane : frustum) {
+    if (glm::dot(vec3(plane), center) + plane.w < -radius) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool GpuCulling::supported() {
+  return GLEW_VERSION_4_3;
+}
+bool GpuCulling::compaction_supported() {
+  return GLEW_VERSION_4_6 || GLEW_ARB_indirect_parameters;
+}
+GpuCulling::GpuCulling() {
+  glGenBuffers(1, &commands);
+  glGenBuffers(1, &draws);
+  glGenBuffers(1, &counts);
+  glGenBuffers(1, &in_commands_buffer);
+  glGenBuffers(1, &in_draws_buffer);
+  glGenBuffers(1, &cull_data_buffer);
+}
+GpuCulling::~GpuCulling() {
+  for (const auto buffer : {commands, draws, counts, in_commands_buffer,
+                            in_draws_buffer, cull_data_buffer}) {
+    glDeleteBuffers(1, &buffer);
+  }
+  glDeleteTextures(1, &depth_texture);
+  glDeleteTextures(1, &hiz_texture);
+}
+
+// engine uniforms don't cover the compute shaders, these are looked up once
+// a frame which is nothing next to the dispatch.
+static GLint uniform_location(const Shader &shader, const char *name) {
+  const auto index = shader.find_uniform(name);
+  return index == -1 ? -1 : shader.uniforms[index].location;
+}
+
+void GpuCulling::cull(const vector<DrawElementsIndirectCommand> &in_commands,
+                      const vector<IndirectDrawData> &in_draws,
+                      const vector<CullData> &cull_data,
+                      const size_t bucket_count, const mat4 &view_projection) {
+  if (!cull_shader) {
+    cull_shader = ShaderCache::get_compute(Engine::RESOURCE_DIR_PATH +
+                                           "/shaders/cull.comp");
+  }
+  const auto count = in_commands.size();
+  const auto upload = [](const GLuint buffer, const size_t size,
+                         const void *data) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STREAM_DRAW);
+  };
+  upload(in_commands_buffer, count * sizeof(DrawElementsIndirectCommand),
+         in_commands.data());
+  upload(in_draws_buffer, count * sizeof(IndirectDrawData), in_draws.data());
+  upload(cull_data_buffer, count * sizeof(CullData), cull_data.data());
+  // the outputs get orphaned too, so we never wait on last frame's draws.
+  upload(commands, count * sizeof(DrawElementsIndirectCommand), nullptr);
+  upload(draws, count * sizeof(IndirectDrawData), nullptr);
+  const vector<GLuint> zeros(bucket_count, 0);
+  upload(counts, bucket_count * sizeof(GLuint), zeros.data());
+
+  GLuint binding = 0;
+  for (const auto buffer : {in_commands_buffer, in_draws_buffer,
+                            cull_data_buffer, commands, draws, counts}) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding++, buffer);
+  }
+
+  const auto &shader = *cull_shader;
+  const auto frustum = frustum_planes(view_projection);
+  const auto use_hiz = hiz_enabled && hiz_valid;
+  glUseProgram(shader.program_id);
+  glUniform1ui(uniform_location(shader, "drawCount"), count);
+  glUniform4fv(uniform_location(shader, "frustumPlanes"), 6,
+               glm::value_ptr(frustum[0]));
+  glUniform1i(uniform_location(shader, "compact"), compaction_supported());
+  glUniform1i(uniform_location(shader, "useHiz"), use_hiz);
+  if (use_hiz) {
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, hiz_texture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(uniform_location(shader, "hizSampler"), 2);
+    glUniformMatrix4fv(uniform_location(shader, "hizViewProjection"), 1,
+                       GL_FALSE, glm::value_ptr(hiz_view_projection));
+    glUniform2f(uniform_location(shader, "hizSize"), hiz_width, hiz_height);
+    glUniform1i(uniform_location(shader, "hizLevels"), hiz_levels);
+  }
+  glDispatchCompute((count + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  if (!validate) {
+    return;
+  }
+  vector<GLuint> survivors(bucket_count);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counts);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     bucket_count * sizeof(GLuint), survivors.data());
+  visible_count = 0;
+  for (const auto survivor : survivors) {
+    visible_count += survivor;
+  }
+  size_t expected = 0;
+  for (size_t i = 0; i < count; i++) {
+    const auto &model = in_draws[i].model;
+    const auto center = vec3(model * vec4(vec3(cull_data[i].sphere), 1.0f));
+    const auto scale = std::max({glm::length(vec3(model[0])),
+                                 glm::length(vec3(model[1])),
+                                 glm::length(vec3(model[2]))});
+    expected +=
+        sphere_in_frustum(frustum, center, cull_data[i].sphere.w * scale);
+  }
+  // hi-z can only take more away, the frustum test has to agree exactly.
+  if (use_hiz ? visible_count > expected : visible_count != expected) {
+    validation_errors++;
+    cout << "gpu culling kept " << visible_count << " of " << count
+         << " draws, the cpu expected " << expected << std::endl;
+  }
+}
+
+void GpuCulling::build_hiz(const mat4 &view_projection) {
+  if (!hiz_shader) {
+    hiz_shader = ShaderCache::get_compute(Engine::RESOURCE_DIR_PATH +
+                                          "/shaders/hiz.comp");
+  }
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const auto width = viewport[2], height = viewport[3];
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+  if (width != hiz_width || height != hiz_height) {
+    glDeleteTextures(1, &depth_texture);
+    glDeleteTextures(1, &hiz_texture);
+    hiz_width = width;
+    hiz_height = height;
+    hiz_levels = 1;
+    while ((std::max(width, height) >> hiz_levels) > 0) {
+      hiz_levels++;
+    }
+    glGenTextures(1, &depth_texture);
+    glBindTexture(GL_TEXTURE_2D, depth_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+                 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenTextures(1, &hiz_texture);
+    glBindTexture(GL_TEXTURE_2D, hiz_texture);
+    glTexStorage2D(GL_TEXTURE_2D, hiz_levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  // the default framebuffer's depth can't be sampled, copy it out first.
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depth_texture);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], width,
+                      height);
+
+  const auto &shader = *hiz_shader;
+  glUseProgram(shader.program_id);
+  glUniform1i(uniform_location(shader, "depthSampler"), 0);
+  const auto from_depth = uniform_location(shader, "fromDepth");
+  for (int level = 0; level < hiz_levels; level++) {
+    glUniform1i(from_depth, level == 0);
+    if (level != 0) {
+      glBindImageTexture(0, hiz_texture, level - 1, GL_FALSE, 0, GL_READ_ONLY,
+                         GL_R32F);
+    }
+    glBindImageTexture(1, hiz_texture, level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R32F);
+    const auto level_width = std::max(1, width >> level);
+    const auto level_height = std::max(1, height >> level);
+    glDispatchCompute((level_width + 7) / 8, (level_height + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  hiz_view_projection = view_projection;
+  hiz_valid = true;
+}
@@ -0,0 +1,194 @@
+#include "../include/debug_draw.hpp"
+#include "../include/engine.hpp"
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace debug {
+void line(const vec3 &start, const vec3 &end, const vec4 &color) {
+  // stretches the unit line from the origin along x onto start -> end.
+  auto model = mat4(0.0f);
+  model[0] = vec4(end - start, 0.0f);
+  model[3] = vec4(start, 1.0f);
+  DebugDraw::current().add(DebugShape::Line, model, color);
+}
+void box(const vec3 &center, const vec3 &size, const vec4 &color) {
+  box(glm::scale(glm::translate(glm::identity<mat4>(), center), size), color);
+}
+void box(const mat4 &transform, const vec4 &color) {
+  DebugDraw::current().add(DebugShape::Box, transform, color);
+}
+void sphere(const vec3 &center, const float radius, const vec4 &color) {
+  const auto model = glm::scale(glm::translate(glm::identity<mat4>(), center),
+                                vec3(radius));
+  DebugDraw::current().add(DebugShape::Sphere, model, color);
+}
+} // namespace debug
+
+DebugDraw::~DebugDraw() { release(); }
+void DebugDraw::release() {
+  shader = nullptr;
+  if (vao == 0) {
+    return;
+  }
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &vertex_buffer);
+  glDeleteBuffers(1, &index_buffer);
+  glDeleteBuffers(1, &instance_buffer);
+  vao = vertex_buffer = index_buffer = instance_buffer = 0;
+  instance_capacity = 0;
+}
+
+void DebugDraw::add(const DebugShape shape, const mat4 &model,
+                    const vec4 &color) {
+  std::lock_guard lock(mutex);
+  pending[(size_t)shape].push_back({model, color});
+}
+
+void DebugDraw::init() {
+  vector<vec3> vertices;
+  vector<uint16_t> indices;
+  const auto begin_shape = [&](const DebugShape shape) {
+    auto &range = ranges[(size_t)shape];
+    range.base_vertex = vertices.size();
+    range.first_index = indices.size();
+  };
+  const auto end_shape = [&](const DebugShape shape) {
+    auto &range = ranges[(size_t)shape];
+    range.index_count = indices.size() - range.first_index;
+  };
+
+  begin_shape(DebugShape::Line);
+  vertices.insert(vertices.end(), {vec3(0), vec3(1, 0, 0)});
+  indices.insert(indices.end(), {0, 1});
+  end_shape(DebugShape::Line);
+
+  // the unit cube's 12 edges, corners indexed by their bits as xyz.
+  begin_shape(DebugShape::Box);
+  for (int i = 0; i < 8; i++) {
+    vertices.push_back(vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1) - vec3(0.5f));
+  }
+  for (uint16_t i = 0; i < 8; i++) {
+    for (uint16_t axis = 1; axis < 8; axis <<= 1) {
+      if ((i & axis) == 0) {
+        indices.insert(indices.end(), {i, (uint16_t)(i | axis)});
+      }
+    }
+  }
+  end_shape(DebugShape::Box);
+
+  // a circle around each axis.
+  begin_shape(DebugShape::Sphere);
+  constexpr uint16_t SEGMENTS = 32;
+  for (int axis = 0; axis < 3; axis++) {
+    const auto first = (uint16_t)(axis * SEGMENTS);
+    for (uint16_t i = 0; i < SEGMENTS; i++) {
+      const auto angle = (float)i / SEGMENTS * 2.0f * glm::pi<float>();
+      auto point = vec3(0);
+      point[(axis + 1) % 3] = cosf(angle);
+      point[(axis + 2) % 3] = sinf(angle);
+      vertices.push_back(point);
+      indices.insert(indices.end(),
+                     {(uint16_t)(first + i),
+                      (uint16_t)(first + (i + 1) % SEGMENTS)});
+    }
+  }
+  end_shape(DebugShape::Sphere);
+
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vertex_buffer);
+  glGenBuffers(1, &index_buffer);
+  glGenBuffers(1, &instance_buffer);
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3),
+               vertices.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t),
+               indices.data(), GL_STATIC_DRAW);
+  // 1-4 for the model matrix's columns, 5 for the color.
+  for (GLuint location = 1; location <= 5; location++) {
+    glEnableVertexAttribArray(location);
+    glVertexAttribDivisor(location, 1);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  shader = ShaderCache::get(
+      Engine::RESOURCE_DIR_PATH + "/shaders/debug_vert.glsl",
+      Engine::RESOURCE_DIR_PATH + "/shaders/debug_frag.glsl");
+}
+
+void DebugDraw::bind_instances(const size_t first_instance) const {
+  // 3.3 has no base instance, so the attributes get pointed at each shape's
+  // instances instead.
+  const auto offset = first_instance * sizeof(DebugInstance);
+  glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+  for (GLuint column = 0; column < 4; column++) {
+    glVertexAttribPointer(
+        1 + column, 4, GL_FLOAT, GL_FALSE, sizeof(DebugInstance),
+        (void *)(offset + offsetof(DebugInstance, model) + column * sizeof(vec4)));
+  }
+  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(DebugInstance),
+                        (void *)(offset + offsetof(DebugInstance, color)));
+}
+
+void DebugDraw::render(const mat4 &view_projection) {
+  {
+    std::lock_guard lock(mutex);
+    for (size_t i = 0; i < pending.size(); i++) {
+      drawing[i].clear();
+      std::swap(drawing[i], pending[i]);
+    }
+  }
+  instance_count = 0;
+  for (const auto &instances : drawing) {
+    instance_count += instances.size();
+  }
+  if (instance_count == 0) {
+    return;
+  }
+  if (vao == 0) {
+    init();
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+  if (instance_count > instance_capacity) {
+    instance_capacity = std::max(instance_count, instance_capacity * 2);
+  }
+  // orphaned every frame, so we never wait on last frame's draws.
+  glBufferData(GL_ARRAY_BUFFER, instance_capacity * sizeof(DebugInstance),
+               nullptr, GL_STREAM_DRAW);
+  size_t offset = 0;
+  for (const auto &instances : drawing) {
+    glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(DebugInstance),
+                    instances.size() * sizeof(DebugInstance), instances.data());
+    offset += instances.size();
+  }
+
+  glUseProgram(shader->program_id);
+  glUniformMatrix4fv(shader->location(Uniform::ViewProjectionMatrix), 1,
+                     GL_FALSE, glm::value_ptr(view_projection));
+  if (!depth_tested) {
+    glDisable(GL_DEPTH_TEST);
+  }
+  glBindVertexArray(vao);
+  size_t first_instance = 0;
+  for (size_t shape = 0; shape < drawing.size(); shape++) {
+    const auto count = drawing[shape].size();
+    if (count == 0) {
+      continue;
+    }
+    const auto &range = ranges[shape];
+    bind_instances(first_instance);
+    glDrawElementsInstancedBaseVertex(
+        GL_LINES, range.index_count, GL_UNSIGNED_SHORT,
+        (const void *)(range.first_index * sizeof(uint16_t)), count,
+        range.base_vertex);
+    first_instance += count;
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glEnable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,140 @@
+#include "../include/deferred.hpp"
+#include "../include/engine.hpp"
+#include "../include/renderer.hpp"
+#include <glm/gtc/constants.hpp>
+
+DeferredShading::~DeferredShading() {
+  if (empty_vao != 0) {
+    glDeleteVertexArrays(1, &empty_vao);
+    glDeleteVertexArrays(1, &sphere_vao);
+    glDeleteBuffers(1, &sphere_vertices);
+    glDeleteBuffers(1, &sphere_indices);
+  }
+}
+
+void DeferredShading::init() {
+  glGenVertexArrays(1, &empty_vao);
+
+  // a uv sphere for the light volumes. its faces cut inside the unit sphere,
+  // scaled out a bit so the volume still covers all of the light.
+  constexpr int RINGS = 8, SEGMENTS = 12;
+  constexpr float SCALE = 1.1f;
+  vector<vec3> vertices;
+  vector<uint16_t> indices;
+  for (int ring = 0; ring <= RINGS; ring++) {
+    const auto theta = glm::pi<float>() * ring / RINGS;
+    for (int segment = 0; segment <= SEGMENTS; segment++) {
+      const auto phi = 2.0f * glm::pi<float>() * segment / SEGMENTS;
+      vertices.push_back(SCALE * vec3(sinf(theta) * cosf(phi), cosf(theta),
+                                      sinf(theta) * sinf(phi)));
+    }
+  }
+  for (int ring = 0; ring < RINGS; ring++) {
+    for (int segment = 0; segment < SEGMENTS; segment++) {
+      const auto a = (uint16_t)(ring * (SEGMENTS + 1) + segment);
+      const auto b = (uint16_t)(a + SEGMENTS + 1);
+      indices.insert(indices.end(), {a, (uint16_t)(a + 1), b,
+                                     b, (uint16_t)(a + 1), (uint16_t)(b + 1)});
+    }
+  }
+  sphere_index_count = indices.size();
+  glGenVertexArrays(1, &sphere_vao);
+  glGenBuffers(1, &sphere_vertices);
+  glGenBuffers(1, &sphere_indices);
+  glBindVertexArray(sphere_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, sphere_vertices);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3),
+               vertices.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphere_indices);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t),
+               indices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  // fragment.glsl again, so both paths light exactly the same way.
+  const auto vertex_path = Engine::RESOURCE_DIR_PATH + "/shaders/deferred_vert.glsl";
+  const auto frag_path = Engine::RESOURCE_DIR_PATH + "/shaders/fragment.glsl";
+  lit_shader = ShaderCache::get(vertex_path, frag_path,
+                                vector<std::string>{"LIT", "LIGHTING_PASS"});
+  lit_shader->features = LIT;
+  shadowed_shader = ShaderCache::get(
+      vertex_path, frag_path,
+      vector<std::string>{"LIT", "SHADOWED", "LIGHTING_PASS"});
+  shadowed_shader->features = LIT | SHADOWED;
+  volume_shader = ShaderCache::get(
+      vertex_path, frag_path,
+      vector<std::string>{"LIT", "LIGHTING_PASS", "LIGHT_VOLUME"});
+  volume_shader->features = LIT;
+}
+
+void DeferredShading::bind_gbuffer(const Shader &shader, const RenderView &view,
+                                   const GBuffer &gbuffer) const {
+  const GLuint textures[] = {gbuffer.albedo, gbuffer.normal, gbuffer.depth};
+  const Uniform uniforms[] = {Uniform::GBufferAlbedo, Uniform::GBufferNormal,
+                              Uniform::GBufferDepth};
+  // after the shadow & cluster units.
+  for (int i = 0; i < 3; i++) {
+    glActiveTexture(GL_TEXTURE7 + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glUniform1i(shader.location(uniforms[i]), 7 + i);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  const auto inverse = glm::inverse(view.view_projection);
+  glUniformMatrix4fv(shader.location(Uniform::InverseViewProjection), 1,
+                     GL_FALSE, glm::value_ptr(inverse));
+  glUniformMatrix4fv(shader.location(Uniform::ViewProjectionMatrix), 1,
+                     GL_FALSE, glm::value_ptr(view.view_projection));
+}
+
+void DeferredShading::light(MeshBuffer &buffer, const RenderView &view,
+                            const GBuffer &gbuffer) {
+  if (empty_vao == 0) {
+    init();
+  }
+  // the scene's depth, for the volumes' depth test & whatever's drawn later.
+  // the window asks for a D24S8 depth buffer so the formats match.
+  const auto width = gbuffer.width, height = gbuffer.height;
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer.framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  const auto volumes = lighting == DeferredLighting::Volumes;
+  const auto &shader = buffer.shadows.active ? shadowed_shader : lit_shader;
+  glUseProgram(shader->program_id);
+  bind_gbuffer(*shader, view, gbuffer);
+  Renderer::apply_lighting_uniforms(shader, shader->program_id);
+  if (volumes) {
+    glUniform1i(shader->location(Uniform::ClusteredLights), 0);
+  }
+  // the sky is left as it was cleared, the pass discards where depth is 1.
+  glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_FALSE);
+  glBindVertexArray(empty_vao);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  const auto light_count = buffer.light_clusters.visible_count;
+  if (volumes && light_count != 0) {
+    glUseProgram(volume_shader->program_id);
+    bind_gbuffer(*volume_shader, view, gbuffer);
+    buffer.light_clusters.apply_uniforms(*volume_shader);
+    // back faces behind the surface, which still works from inside a volume.
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GEQUAL);
+    glCullFace(GL_FRONT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glBindVertexArray(sphere_vao);
+    glDrawElementsInstanced(GL_TRIANGLES, sphere_index_count,
+                            GL_UNSIGNED_SHORT, nullptr, light_count);
+    glDisable(GL_BLEND);
+    glCullFace(GL_BACK);
+    glDepthFunc(GL_LESS);
+  }
+  glBindVertexArray(0);
+  glDepthMask(GL_TRUE);
+  glEnable(GL_DEPTH_TEST);
+}
@@ -27,9 +27,10 @@ void BlockPlacer::update(const float &dt) {
                                               Engine::RESOURCE_DIR_PATH +
                                                   "/prim_mesh/cube.obj");
       } else {
-        new_node->add_component<MeshRenderer>(textured_material,
-                                              Engine::RESOURCE_DIR_PATH +
-                                                  "/prim_mesh/car.obj");
+        auto car = new_node->add_component<MeshRenderer>(
+            textured_material, Engine::RESOURCE_DIR_PATH + "/prim_mesh/car.obj");
+        // plenty of triangles, worth skipping when it's behind a wall.
+        car->occlusion_query = true;
       }
       placed_blocks.push_back(new_node);
     } else {
@@ -66,7 +67,85 @@ void BlockPlacer::update(const float &dt) {
 void BlockPlacer::awake() {
   auto &engine = Engine::current();
 
-  textured_material = make_shared<Material>(engine.m_shader, engine.m_texture);
+  textured_material = make_shared<Material>(engine.m_shader, engine.default_texture());
+}
+void DrawBenchmark::spawn() {
+  auto &engine = Engine::current();
+  const auto origin = node.lock()->get_position();
+  const auto side = (int)ceilf(sqrtf((float)object_count));
+  for (int i = 0; i < object_count; i++) {
+    const auto x = i % side, z = i / side;
+    auto object = Node::instantiate(
+        origin + vec3((x - side / 2) * 3.0f, 0.0f, -10.0f - z * 3.0f));
+    object->set_rotation(glm::angleAxis(i * 0.37f, vec3(0, 1, 0)));
+    // a material each, so nothing gets batched unless the draw path can
+    // merge different materials.
+    auto material =
+        make_shared<Material>(engine.m_shader, engine.default_texture());
+    const auto mesh_path = Engine::RESOURCE_DIR_PATH +
+                           (i % 2 ? "/prim_mesh/car.obj" : "/prim_mesh/cube.obj");
+    auto renderer = object->add_component<MeshRenderer>(material, mesh_path);
+    renderer->color = vec4((x % 8) / 8.0f, (z % 8) / 8.0f, 0.5f, 1.0f);
+    objects.push_back(object);
+  }
+  total_time = 0.0f;
+  frame_count = 0;
+}
+void DrawBenchmark::spawn_lights() {
+  const auto origin = node.lock()->get_position();
+  const auto side = (int)ceilf(sqrtf((float)std::max(object_count, 1)));
+  for (int i = 0; i < light_count; i++) {
+    // a cheap hash, so the same count always gives the same lights.
+    const auto hash = [i](const unsigned salt) {
+      auto h = (unsigned)i * 2654435761u ^ salt * 2246822519u;
+      h ^= h >> 15;
+      h *= 2654435761u;
+      return (h >> 8) / (float)(1u << 24);
+    };
+    auto light = Node::instantiate(
+        origin + vec3((hash(1) - 0.5f) * side * 3.0f, 1.0f + hash(2) * 2.0f,
+                      -10.0f - hash(3) * side * 3.0f));
+    const auto color = vec3(hash(4), hash(5), hash(6));
+    light->add_component<Light>(color, 2.0f, 0.5f, false);
+    lights.push_back(light);
+  }
+  total_time = 0.0f;
+  frame_count = 0;
+}
+void DrawBenchmark::update(const float &dt) {
+  total_time += dt;
+  frame_count++;
+}
+void DrawBenchmark::on_gui() {
+  auto &mesh_buffer = *Engine::current().m_renderer.mesh_buffer;
+  ImGui::Begin("Draw benchmark");
+  ImGui::InputInt("objects", &object_count);
+  if (objects.empty() && ImGui::Button("spawn")) {
+    spawn();
+  }
+  ImGui::InputInt("lights", &light_count);
+  if (lights.empty() && ImGui::Button("spawn lights")) {
+    spawn_lights();
+  }
+  ImGui::Text("%zu objects, %zu draw calls", objects.size(),
+              mesh_buffer.stats.draw_calls);
+  ImGui::Text("%zu lights, %zu in view", lights.size(),
+              mesh_buffer.light_clusters.visible_count);
+  if (frame_count != 0) {
+    ImGui::Text("avg frame : %.3f ms over %zu frames",
+                1000.0f * total_time / frame_count, frame_count);
+  }
+  // switching paths starts the average over.
+  const auto indirect = mesh_buffer.indirect_enabled;
+  const auto instancing = mesh_buffer.instancing_enabled;
+  ImGui::Checkbox("multi draw indirect", &mesh_buffer.indirect_enabled);
+  ImGui::Checkbox("instancing", &mesh_buffer.instancing_enabled);
+  if (ImGui::Button("reset") || indirect != mesh_buffer.indirect_enabled ||
+      instancing != mesh_buffer.instancing_enabled) {
+    total_time = 0.0f;
+    frame_count = 0;
+  }
+  ImGui::End();
 }
 void Player::on_gui() {
   ImGui::Begin("Player");
@@ -161,6 +240,7 @@ void Car::awake() {
     
   self->add_component<Player>();
   self->add_component<BlockPlacer>();
+  self->add_component<DrawBenchmark>();
   
   auto mesh = self->add_component<MeshRenderer>(
       engine.m_material, Engine::RESOURCE_DIR_PATH + "/prim_mesh/car.obj");
@@ -31,14 +31,15 @@ void Engine::update_loop(const float &dt) {
   }
 }
 Engine::Engine() : m_renderer("Mine Engine", SCREEN_H, SCREEN_W, update_loop), m_input(Input::current()) {
-  m_shader = make_shared<Shader>(RESOURCE_DIR_PATH + "/shaders/vertex.glsl",
-                                 RESOURCE_DIR_PATH + "/shaders/fragment.glsl");
-  m_texture = optional<shared_ptr<Texture>>(
-      make_shared<Texture>(RESOURCE_DIR_PATH + "/textures/conflag.jpg"));
+  m_shader = ShaderCache::get(RESOURCE_DIR_PATH + "/shaders/vertex.glsl",
+                              RESOURCE_DIR_PATH + "/shaders/fragment.glsl");
   m_material = make_shared<Material>(m_shader, std::nullopt);
   m_input.window = m_renderer.window;
   
 };
+optional<shared_ptr<Texture>> Engine::default_texture() {
+  return Texture::get(RESOURCE_DIR_PATH + "/textures/conflag.jpg");
+}
 Engine &Engine::current() {
   static Engine instance = Engine();
   return instance;
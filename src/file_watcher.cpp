@@ -0,0 +1,83 @@
+#include "../include/file_watcher.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::FileWatcher() {
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd == -1) {
+    cout << "file watcher : inotify_init1 failed, hot reloading is disabled"
+         << std::endl;
+    return;
+  }
+  thread = std::thread(&FileWatcher::watch_loop, this);
+}
+FileWatcher::~FileWatcher() {
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  if (inotify_fd != -1) {
+    close(inotify_fd);
+  }
+}
+void FileWatcher::watch_directory(const string &directory) {
+  if (inotify_fd == -1) {
+    return;
+  }
+  const auto normalized =
+      std::filesystem::path(directory).lexically_normal().string();
+  std::lock_guard lock(mutex);
+  for (const auto &[_, watched] : directories) {
+    if (watched == normalized) {
+      return;
+    }
+  }
+  // editors usually write a temp file and rename it over the original, so
+  // we need the moves as well as plain writes.
+  const auto wd = inotify_add_watch(inotify_fd, normalized.c_str(),
+                                    IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd == -1) {
+    cout << "file watcher : unable to watch " << normalized << std::endl;
+    return;
+  }
+  directories[wd] = normalized;
+}
+vector<string> FileWatcher::poll_changes() {
+  std::lock_guard lock(mutex);
+  vector<string> out;
+  out.swap(changes);
+  return out;
+}
+void FileWatcher::watch_loop() {
+  alignas(inotify_event) char buffer[4096];
+  pollfd fd = {inotify_fd, POLLIN, 0};
+  while (running) {
+    // wake up every so often to notice we've been asked to stop.
+    if (poll(&fd, 1, 100) <= 0) {
+      continue;
+    }
+    const auto length = read(inotify_fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      continue;
+    }
+    std::lock_guard lock(mutex);
+    for (ssize_t i = 0; i < length;) {
+      const auto *event = (const inotify_event *)(buffer + i);
+      i += sizeof(inotify_event) + event->len;
+      
+      auto it = directories.find(event->wd);
+      if (it == directories.end() || event->len == 0) {
+        continue;
+      }
+      const auto path = (std::filesystem::path(it->second) / event->name)
+                            .lexically_normal()
+                            .string();
+      if (std::find(changes.begin(), changes.end(), path) == changes.end()) {
+        changes.push_back(path);
+      }
+    }
+  }
+}
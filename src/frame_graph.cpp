@@ -0,0 +1,388 @@
+#include "../include/frame_graph.hpp"
+#include <algorithm>
+#include <chrono>
+#include <glm/gtc/type_ptr.hpp>
+
+bool TextureDesc::is_depth() const {
+  switch (format) {
+  case GL_DEPTH_COMPONENT16:
+  case GL_DEPTH_COMPONENT24:
+  case GL_DEPTH_COMPONENT32F:
+  case GL_DEPTH24_STENCIL8:
+  case GL_DEPTH32F_STENCIL8:
+    return true;
+  default:
+    return false;
+  }
+}
+size_t TextureDesc::bytes() const {
+  size_t pixel;
+  switch (format) {
+  case GL_R8:
+    pixel = 1;
+    break;
+  case GL_RG8:
+  case GL_R16F:
+  case GL_DEPTH_COMPONENT16:
+    pixel = 2;
+    break;
+  case GL_RGBA16F:
+  case GL_RG32F:
+  case GL_DEPTH32F_STENCIL8:
+    pixel = 8;
+    break;
+  case GL_RGBA32F:
+    pixel = 16;
+    break;
+  default:
+    // rgba8, rg16, r32f, & the 24 bit depths which get padded to 32.
+    pixel = 4;
+    break;
+  }
+  return pixel * width * height;
+}
+
+FrameResource PassBuilder::create(const std::string &name,
+                                  const TextureDesc &desc) {
+  const auto resource = graph.resources.size();
+  graph.resources.push_back({.name = name, .desc = desc});
+  graph.passes[pass].creates.push_back(resource);
+  graph.passes[pass].writes.push_back(resource);
+  return resource;
+}
+FrameResource PassBuilder::read(const FrameResource resource) {
+  graph.passes[pass].reads.push_back(resource);
+  return resource;
+}
+FrameResource PassBuilder::write(const FrameResource resource) {
+  graph.passes[pass].writes.push_back(resource);
+  return resource;
+}
+void PassBuilder::side_effect() { graph.passes[pass].side_effect = true; }
+
+FrameGraph::~FrameGraph() {
+  for (const auto &pooled : pool) {
+    glDeleteTextures(1, &pooled.texture);
+  }
+  for (const auto &[_, fbo] : framebuffers) {
+    glDeleteFramebuffers(1, &fbo);
+  }
+}
+
+void FrameGraph::reset() {
+  // anything that sat unused for too long goes.
+  for (auto &pooled : pool) {
+    pooled.idle_frames++;
+    pooled.in_use = false;
+  }
+  evict([this](const PooledTexture &pooled) {
+    return pooled.idle_frames > max_idle_frames;
+  });
+  resources.clear();
+  passes.clear();
+  compiled = false;
+}
+
+FrameResource FrameGraph::import(const std::string &name, const GLuint texture,
+                                 const optional<vec4> &clear_color) {
+  resources.push_back({.name = name,
+                       .imported = true,
+                       .clear_color = clear_color,
+                       .texture = texture});
+  return resources.size() - 1;
+}
+void FrameGraph::present(const FrameResource resource) {
+  resources[resource].presented = true;
+}
+void FrameGraph::add_pass(const std::string &name,
+                          const std::function<void(PassBuilder &)> &setup,
+                          std::function<void(FrameGraph &)> execute) {
+  passes.push_back({.name = name, .execute = std::move(execute)});
+  PassBuilder builder(*this, passes.size() - 1);
+  setup(builder);
+}
+
+void FrameGraph::compile() {
+  // culled back to front. a pass is kept when it has side effects, writes
+  // something presented, or writes something a kept pass after it reads.
+  vector<bool> needed(resources.size(), false);
+  for (auto pass = passes.rbegin(); pass != passes.rend(); pass++) {
+    auto keep = pass->side_effect;
+    for (const auto resource : pass->writes) {
+      keep = keep || needed[resource] || resources[resource].presented;
+    }
+    pass->culled = !keep;
+    if (keep) {
+      for (const auto resource : pass->reads) {
+        needed[resource] = true;
+      }
+    }
+  }
+
+  // lifetimes, from the creating pass to the last one that touches it.
+  vector<bool> created(resources.size(), false);
+  for (size_t i = 0; i < passes.size(); i++) {
+    const auto &pass = passes[i];
+    if (pass.culled) {
+      continue;
+    }
+    for (const auto resource : pass.creates) {
+      resources[resource].first = i;
+      created[resource] = true;
+    }
+    for (const auto &list : {pass.reads, pass.writes}) {
+      for (const auto resource : list) {
+        auto &used = resources[resource];
+        if (!used.imported && !created[resource]) {
+          cout << "frame graph: pass '" << pass.name << "' uses '" << used.name
+               << "' before it's created." << std::endl;
+        }
+        used.last = std::max(used.last, i);
+      }
+    }
+  }
+
+  // textures whose lifetimes are over go back to the pool right away, for
+  // the next pass that creates one like it.
+  requested_bytes = 0;
+  for (size_t i = 0; i < passes.size(); i++) {
+    if (passes[i].culled) {
+      continue;
+    }
+    for (const auto resource : passes[i].creates) {
+      auto &created_resource = resources[resource];
+      created_resource.texture = acquire(created_resource.desc);
+      requested_bytes += created_resource.desc.bytes();
+    }
+    if (!aliasing) {
+      continue;
+    }
+    for (size_t resource = 0; resource < resources.size(); resource++) {
+      const auto &ending = resources[resource];
+      if (!ending.imported && created[resource] && ending.last == i) {
+        release(ending.texture);
+      }
+    }
+  }
+  // after a resize the old size isn't asked for again, so textures this frame
+  // wanted at another size go now instead of piling up every frame of a drag.
+  evict([this](const PooledTexture &pooled) {
+    return pooled.idle_frames != 0 &&
+           std::ranges::any_of(resources, [&](const Resource &resource) {
+             return !resource.imported && resource.texture != 0 &&
+                    resource.desc.format == pooled.desc.format &&
+                    (resource.desc.width != pooled.desc.width ||
+                     resource.desc.height != pooled.desc.height);
+           });
+  });
+  allocated_bytes = 0;
+  for (const auto &pooled : pool) {
+    allocated_bytes += pooled.desc.bytes();
+  }
+  pooled_textures = pool.size();
+  compiled = true;
+}
+
+void FrameGraph::execute() {
+  using clock = std::chrono::high_resolution_clock;
+  if (!compiled) {
+    compile();
+  }
+  // stats is drawn by the imgui pass, so it stays last frame's until the end.
+  vector<PassStats> frame_stats;
+  // imported resources get cleared before their first write only.
+  vector<bool> cleared(resources.size(), false);
+  for (auto &pass : passes) {
+    PassStats pass_stats = {.name = pass.name, .culled = pass.culled};
+    if (pass.culled) {
+      frame_stats.push_back(pass_stats);
+      continue;
+    }
+    const auto start = clock::now();
+    auto &timer = timers[pass.name];
+    timer.begin();
+    for (const auto resource : pass.writes) {
+      const auto &written = resources[resource];
+      const auto first_write =
+          written.imported ? written.clear_color.has_value() && !cleared[resource]
+                           : std::ranges::find(pass.creates, resource) !=
+                                 pass.creates.end();
+      if (first_write) {
+        clear(resource);
+        cleared[resource] = true;
+        pass_stats.clears++;
+      }
+    }
+    pass_stats.created = pass.creates.size();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    pass.execute(*this);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    timer.end();
+    pass_stats.cpu_ms =
+        std::chrono::duration<float, std::milli>(clock::now() - start).count();
+    // a few frames behind, like every GpuTimer.
+    pass_stats.gpu_ms = timer.ms;
+    frame_stats.push_back(pass_stats);
+  }
+  stats = std::move(frame_stats);
+}
+
+GLuint FrameGraph::texture(const FrameResource resource) const {
+  return resources[resource].texture;
+}
+const TextureDesc &FrameGraph::desc(const FrameResource resource) const {
+  return resources[resource].desc;
+}
+
+GLuint FrameGraph::framebuffer(const vector<FrameResource> &attachments) {
+  vector<GLuint> key;
+  for (const auto attachment : attachments) {
+    key.push_back(texture(attachment));
+  }
+  if (std::ranges::find(key, 0u) != key.end()) {
+    return 0;
+  }
+  const auto it = framebuffers.find(key);
+  if (it != framebuffers.end()) {
+    return it->second;
+  }
+
+  GLint bound;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  vector<GLenum> draw_buffers;
+  for (const auto attachment : attachments) {
+    const auto &attached = desc(attachment);
+    GLenum point;
+    if (attached.is_depth()) {
+      const auto stencil = attached.format == GL_DEPTH24_STENCIL8 ||
+                           attached.format == GL_DEPTH32F_STENCIL8;
+      point = stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+    } else {
+      point = GL_COLOR_ATTACHMENT0 + draw_buffers.size();
+      draw_buffers.push_back(point);
+    }
+    glFramebufferTexture2D(GL_FRAMEBUFFER, point, GL_TEXTURE_2D,
+                           texture(attachment), 0);
+  }
+  if (draw_buffers.empty()) {
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  } else {
+    glDrawBuffers(draw_buffers.size(), draw_buffers.data());
+  }
+  const auto complete =
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, bound);
+  if (!complete) {
+    cout << "frame graph: framebuffer for '" << resources[attachments[0]].name
+         << "' is incomplete." << std::endl;
+    glDeleteFramebuffers(1, &fbo);
+    // remembered as 0, so it's said once rather than every frame. it goes
+    // with the textures like any other.
+    framebuffers[key] = 0;
+    return 0;
+  }
+  framebuffers[key] = fbo;
+  return fbo;
+}
+
+// a format & type glTexImage2D accepts along with the internal format, there's
+// no data so they don't matter otherwise.
+static std::pair<GLenum, GLenum> upload_format(const GLenum internal_format) {
+  switch (internal_format) {
+  case GL_DEPTH24_STENCIL8:
+    return {GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8};
+  case GL_DEPTH32F_STENCIL8:
+    return {GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV};
+  case GL_DEPTH_COMPONENT16:
+  case GL_DEPTH_COMPONENT24:
+  case GL_DEPTH_COMPONENT32F:
+    return {GL_DEPTH_COMPONENT, GL_FLOAT};
+  case GL_R8:
+  case GL_R16F:
+  case GL_R32F:
+    return {GL_RED, GL_FLOAT};
+  case GL_RG8:
+  case GL_RG16:
+  case GL_RG16F:
+  case GL_RG32F:
+    return {GL_RG, GL_FLOAT};
+  default:
+    return {GL_RGBA, GL_FLOAT};
+  }
+}
+
+GLuint FrameGraph::acquire(const TextureDesc &desc) {
+  for (auto &pooled : pool) {
+    if (!pooled.in_use && pooled.desc == desc) {
+      pooled.in_use = true;
+      pooled.idle_frames = 0;
+      return pooled.texture;
+    }
+  }
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  const auto [format, type] = upload_format(desc.format);
+  glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0,
+               format, type, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  pool.push_back({.desc = desc, .texture = texture, .in_use = true});
+  return texture;
+}
+void FrameGraph::evict(
+    const std::function<bool(const PooledTexture &)> &stale) {
+  // along with the framebuffers they're attached to.
+  std::erase_if(pool, [&](const PooledTexture &pooled) {
+    if (!stale(pooled)) {
+      return false;
+    }
+    std::erase_if(framebuffers, [&](const auto &entry) {
+      if (std::ranges::find(entry.first, pooled.texture) == entry.first.end()) {
+        return false;
+      }
+      glDeleteFramebuffers(1, &entry.second);
+      return true;
+    });
+    glDeleteTextures(1, &pooled.texture);
+    return true;
+  });
+}
+void FrameGraph::release(const GLuint texture) {
+  for (auto &pooled : pool) {
+    if (pooled.texture == texture) {
+      pooled.in_use = false;
+      return;
+    }
+  }
+}
+
+void FrameGraph::clear(const FrameResource resource) {
+  const auto &cleared = resources[resource];
+  if (cleared.imported && cleared.texture == 0) {
+    const auto color = cleared.clear_color.value_or(vec4(0.0f));
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glClearColor(color.x, color.y, color.z, color.w);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return;
+  }
+  const auto fbo = framebuffer({resource});
+  if (fbo == 0) {
+    return;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  if (cleared.desc.is_depth()) {
+    const GLfloat depth = 1.0f;
+    glClearBufferfv(GL_DEPTH, 0, &depth);
+  } else {
+    const auto color = cleared.clear_color.value_or(vec4(0.0f));
+    glClearBufferfv(GL_COLOR, 0, glm::value_ptr(color));
+  }
+}
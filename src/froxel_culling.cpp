@@ -0,0 +1,101 @@
+#include "../include/froxel_culling.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+FroxelBounds build_froxel_bounds(const mat4 &projection, const float near,
+                                 const float far, const int grid_x,
+                                 const int grid_y, const int grid_z) {
+  FroxelBounds bounds;
+  const auto count = (size_t)grid_x * grid_y * grid_z;
+  for (auto *axis : {&bounds.min_x, &bounds.min_y, &bounds.min_z,
+                     &bounds.max_x, &bounds.max_y, &bounds.max_z}) {
+    axis->resize(count);
+  }
+  const auto inverse = glm::inverse(projection);
+  // the rays through each tile corner, scaled to z = -1.
+  const auto ray = [&](const float x, const float y) {
+    const auto point = inverse * vec4(x, y, -1.0f, 1.0f);
+    const auto position = vec3(point) / point.w;
+    return position / -position.z;
+  };
+  for (int z = 0; z < grid_z; z++) {
+    const auto near_depth = near * std::pow(far / near, (float)z / grid_z);
+    const auto far_depth = near * std::pow(far / near, (float)(z + 1) / grid_z);
+    for (int y = 0; y < grid_y; y++) {
+      for (int x = 0; x < grid_x; x++) {
+        const auto x0 = -1.0f + 2.0f * x / grid_x, x1 = -1.0f + 2.0f * (x + 1) / grid_x;
+        const auto y0 = -1.0f + 2.0f * y / grid_y, y1 = -1.0f + 2.0f * (y + 1) / grid_y;
+        auto low = vec3(std::numeric_limits<float>::max()), high = -low;
+        for (const auto &corner : {ray(x0, y0), ray(x1, y0), ray(x0, y1), ray(x1, y1)}) {
+          for (const auto depth : {near_depth, far_depth}) {
+            low = glm::min(low, corner * depth);
+            high = glm::max(high, corner * depth);
+          }
+        }
+        const auto i = x + grid_x * (y + grid_y * z);
+        bounds.min_x[i] = low.x, bounds.min_y[i] = low.y, bounds.min_z[i] = low.z;
+        bounds.max_x[i] = high.x, bounds.max_y[i] = high.y, bounds.max_z[i] = high.z;
+      }
+    }
+  }
+  return bounds;
+}
+
+void cull_froxels_scalar(const FroxelBounds &bounds, const size_t first,
+                         const size_t count, const vec4 &sphere,
+                         const uint64_t bit, uint64_t *masks,
+                         const size_t words) {
+  const auto radius_squared = sphere.w * sphere.w;
+  for (size_t cluster = 0; cluster < count; cluster++) {
+    const auto j = first + cluster;
+    const auto dx = std::max({bounds.min_x[j] - sphere.x, sphere.x - bounds.max_x[j], 0.0f});
+    const auto dy = std::max({bounds.min_y[j] - sphere.y, sphere.y - bounds.max_y[j], 0.0f});
+    const auto dz = std::max({bounds.min_z[j] - sphere.z, sphere.z - bounds.max_z[j], 0.0f});
+    if (dx * dx + dy * dy + dz * dz <= radius_squared) {
+      masks[cluster * words] |= bit;
+    }
+  }
+}
+
+#if defined(__SSE2__)
+void cull_froxels(const FroxelBounds &bounds, const size_t first,
+                  const size_t count, const vec4 &sphere, const uint64_t bit,
+                  uint64_t *masks, const size_t words) {
+  const auto zero = _mm_setzero_ps();
+  const auto radius = _mm_set1_ps(sphere.w * sphere.w);
+  const auto cx = _mm_set1_ps(sphere.x), cy = _mm_set1_ps(sphere.y),
+             cz = _mm_set1_ps(sphere.z);
+  // 4 froxels at a time, the squared distance from the center to each box.
+  for (size_t cluster = 0; cluster < count; cluster += 4) {
+    const auto i = first + cluster;
+    const auto axis = [&](const vector<float> &low, const vector<float> &high,
+                          const __m128 center) {
+      const auto d = _mm_max_ps(
+          _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(low.data() + i), center),
+                     _mm_sub_ps(center, _mm_loadu_ps(high.data() + i))),
+          zero);
+      return _mm_mul_ps(d, d);
+    };
+    const auto distance = _mm_add_ps(
+        _mm_add_ps(axis(bounds.min_x, bounds.max_x, cx),
+                   axis(bounds.min_y, bounds.max_y, cy)),
+        axis(bounds.min_z, bounds.max_z, cz));
+    auto hits = (unsigned)_mm_movemask_ps(_mm_cmple_ps(distance, radius));
+    for (; hits != 0; hits &= hits - 1) {
+      masks[(cluster + std::countr_zero(hits)) * words] |= bit;
+    }
+  }
+}
+#else
+void cull_froxels(const FroxelBounds &bounds, const size_t first,
+                  const size_t count, const vec4 &sphere, const uint64_t bit,
+                  uint64_t *masks, const size_t words) {
+  cull_froxels_scalar(bounds, first, count, sphere, bit, masks, words);
+}
+#endif
@@ -0,0 +1,30 @@
+#include "../include/gpu_timer.hpp"
+
+GpuTimer::~GpuTimer() {
+  if (queries[0] != 0) {
+    glDeleteQueries(LATENCY, queries.data());
+  }
+}
+void GpuTimer::begin() {
+  if (queries[0] == 0) {
+    glGenQueries(LATENCY, queries.data());
+  }
+  const auto query = queries[frame % LATENCY];
+  // the last result out of this query, LATENCY frames ago. if it's somehow
+  // still not there it's skipped rather than waited on.
+  if (pending[frame % LATENCY]) {
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+      ms = nanoseconds / 1e6f;
+    }
+  }
+  glBeginQuery(GL_TIME_ELAPSED, query);
+}
+void GpuTimer::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+  pending[frame % LATENCY] = true;
+  frame++;
+}
\ No newline at end of file
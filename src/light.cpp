@@ -0,0 +1,11 @@
+#include "../include/light.hpp"
+#include "../include/engine.hpp"
+
+Light::~Light() {
+  if (is_awake) {
+    Engine::current().m_renderer.mesh_buffer->light_clusters.remove(this);
+  }
+}
+void Light::awake() {
+  Engine::current().m_renderer.mesh_buffer->light_clusters.add(this);
+}
\ No newline at end of file
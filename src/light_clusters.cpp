@@ -0,0 +1,208 @@
+#include "../include/light_clusters.hpp"
+#include "../include/culling.hpp"
+#include "../include/engine.hpp"
+#include "../include/light.hpp"
+#include "../include/renderer.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+
+static constexpr int SLICE_CLUSTERS =
+    LightClusters::GRID_X * LightClusters::GRID_Y;
+
+LightClusters::LightClusters()
+    : pool(std::min(ThreadPool::default_thread_count(), (size_t)4)) {
+  GLuint *buffers[] = {&light_buffer, &grid_buffer, &index_buffer};
+  GLuint *textures[] = {&light_texture, &grid_texture, &index_texture};
+  const GLenum formats[] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+  for (int i = 0; i < 3; i++) {
+    glGenBuffers(1, buffers[i]);
+    glBindBuffer(GL_TEXTURE_BUFFER, *buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glGenTextures(1, textures[i]);
+    glBindTexture(GL_TEXTURE_BUFFER, *textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], *buffers[i]);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+LightClusters::~LightClusters() {
+  const GLuint buffers[] = {light_buffer, grid_buffer, index_buffer};
+  const GLuint textures[] = {light_texture, grid_texture, index_texture};
+  glDeleteBuffers(3, buffers);
+  glDeleteTextures(3, textures);
+}
+
+void LightClusters::add(Light *light) {
+  if (std::ranges::find(lights, light) == lights.end()) {
+    lights.push_back(light);
+  }
+}
+void LightClusters::remove(const Light *light) {
+  std::erase(lights, light);
+}
+
+void LightClusters::update(const RenderView &view) {
+  using clock = std::chrono::high_resolution_clock;
+  const auto start = clock::now();
+  visible_count = 0;
+  index_count = 0;
+  // shade uses it without any clustered lights as well.
+  camera_position = view.position;
+  if (!enabled) {
+    return;
+  }
+
+  // near & far out of the perspective matrix.
+  const auto &projection = view.projection;
+  const auto camera_near = projection[3][2] / (projection[2][2] - 1.0f);
+  const auto camera_far = projection[3][2] / (projection[2][2] + 1.0f);
+  const auto slice_far = std::max(std::min(camera_far, max_distance), camera_near * 2.0f);
+  if (projection != bounds_projection || slice_far != far) {
+    near = camera_near;
+    far = slice_far;
+    bounds_projection = projection;
+    bounds = build_froxel_bounds(projection, near, far, GRID_X, GRID_Y, GRID_Z);
+  }
+  view_matrix = view.view;
+  const auto log_range = std::log(far / near);
+  const auto slice = [&](const float depth) {
+    if (depth <= near) {
+      return 0;
+    }
+    return std::clamp((int)(std::log(depth / near) / log_range * GRID_Z), 0,
+                      GRID_Z - 1);
+  };
+
+  const auto main_light = Engine::current().m_scene.light;
+  const auto frustum = frustum_planes(view.view_projection);
+  light_data.clear();
+  view_spheres.clear();
+  light_slices.clear();
+  for (const auto light : lights) {
+    if (view_spheres.size() == MAX_LIGHTS) {
+      break;
+    }
+    const auto node = light->node.lock();
+    if (!node || node == main_light || light->directional ||
+        light->intensity <= 0.0f) {
+      continue;
+    }
+    const auto position = node->get_position();
+    const auto radius = light->range * RANGE_SCALE;
+    if (!sphere_in_frustum(frustum, position, radius)) {
+      continue;
+    }
+    const auto center = vec3(view.view * vec4(position, 1.0f));
+    const auto depth = -center.z;
+    if (depth + radius < near || depth - radius > far) {
+      continue;
+    }
+    light_data.push_back(vec4(position, radius));
+    light_data.push_back(vec4(light->color * light->intensity, light->range));
+    view_spheres.push_back(vec4(center, radius));
+    light_slices.push_back({slice(depth - radius), slice(depth + radius)});
+  }
+  visible_count = view_spheres.size();
+
+  grid.assign(CLUSTER_COUNT * 2, 0);
+  indices.clear();
+  if (visible_count != 0) {
+    const auto words = (visible_count + 63) / 64;
+    const auto cull = [this, words](size_t begin, size_t end) {
+      for (auto z = begin; z < end; z++) {
+        cull_slice((int)z, words);
+      }
+    };
+    // a handful of lights isn't worth waking the workers for.
+    if (visible_count < 32) {
+      cull(0, GRID_Z);
+    } else {
+      pool.parallel_for(GRID_Z, cull);
+    }
+    for (int z = 0; z < GRID_Z; z++) {
+      const auto base = (uint32_t)indices.size();
+      const auto &slice_grid = slice_grids[z];
+      auto *out = grid.data() + z * SLICE_CLUSTERS * 2;
+      for (int i = 0; i < SLICE_CLUSTERS; i++) {
+        out[i * 2] = base + slice_grid[i * 2];
+        out[i * 2 + 1] = slice_grid[i * 2 + 1];
+      }
+      indices.insert(indices.end(), slice_indices[z].begin(),
+                     slice_indices[z].end());
+    }
+  }
+  index_count = indices.size();
+
+  const auto upload = [](const GLuint buffer, const void *data,
+                         const size_t bytes) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    // orphaned every frame. never empty, the buffer textures need storage.
+    glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, (size_t)16), nullptr,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+  };
+  upload(light_buffer, light_data.data(), light_data.size() * sizeof(vec4));
+  upload(grid_buffer, grid.data(), grid.size() * sizeof(uint32_t));
+  upload(index_buffer, indices.data(), indices.size() * sizeof(uint16_t));
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  // pixels to tiles, and the log of view depth to a slice.
+  cluster_scale = vec4((float)GRID_X / viewport[2], (float)GRID_Y / viewport[3],
+                       GRID_Z / log_range,
+                       -GRID_Z * std::log(near) / log_range);
+  cull_ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+}
+
+void LightClusters::cull_slice(const int slice, const size_t words) {
+  auto &masks = slice_masks[slice];
+  masks.assign(SLICE_CLUSTERS * words, 0);
+  const auto first = slice * SLICE_CLUSTERS;
+  for (size_t light = 0; light < view_spheres.size(); light++) {
+    const auto [first_slice, last_slice] = light_slices[light];
+    if (slice < first_slice || slice > last_slice) {
+      continue;
+    }
+    cull_froxels(bounds, first, SLICE_CLUSTERS, view_spheres[light],
+                 (uint64_t)1 << (light % 64), masks.data() + light / 64, words);
+  }
+
+  // the masks to lists of light indices, (first, count) per froxel.
+  auto &slice_grid = slice_grids[slice];
+  auto &out = slice_indices[slice];
+  slice_grid.resize(SLICE_CLUSTERS * 2);
+  out.clear();
+  for (int cluster = 0; cluster < SLICE_CLUSTERS; cluster++) {
+    slice_grid[cluster * 2] = out.size();
+    for (size_t word = 0; word < words; word++) {
+      for (auto bits = masks[cluster * words + word]; bits != 0; bits &= bits - 1) {
+        out.push_back((uint16_t)(word * 64 + std::countr_zero(bits)));
+      }
+    }
+    slice_grid[cluster * 2 + 1] = out.size() - slice_grid[cluster * 2];
+  }
+}
+
+void LightClusters::apply_uniforms(const Shader &shader) const {
+  // the samplers always get their own units, even unused they mustn't share
+  // one with a sampler of another type.
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_BUFFER, light_texture);
+  glUniform1i(shader.location(Uniform::ClusterLights), 4);
+  glActiveTexture(GL_TEXTURE5);
+  glBindTexture(GL_TEXTURE_BUFFER, grid_texture);
+  glUniform1i(shader.location(Uniform::ClusterGrid), 5);
+  glActiveTexture(GL_TEXTURE6);
+  glBindTexture(GL_TEXTURE_BUFFER, index_texture);
+  glUniform1i(shader.location(Uniform::ClusterIndices), 6);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(shader.location(Uniform::ClusteredLights), visible_count != 0);
+  glUniformMatrix4fv(shader.location(Uniform::ViewMatrix), 1, GL_FALSE,
+                     glm::value_ptr(view_matrix));
+  glUniform4fv(shader.location(Uniform::ClusterScale), 1,
+               glm::value_ptr(cluster_scale));
+  glUniform3fv(shader.location(Uniform::CameraPosition), 1,
+               glm::value_ptr(camera_position));
+}
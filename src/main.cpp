@@ -29,8 +29,13 @@ void setup_default_scene() {
   // SETUP FLOOR
   {
     auto floor = Node::instantiate(vec3(0, -10, 0),vec3(1, 1, 1));
-    auto floor_mesh = floor->add_component<MeshRenderer>(m_material, Engine::RESOURCE_DIR_PATH + "/prim_mesh/rooms.obj");
+    // the walls hide most of the level from any one room.
+    auto floor_mesh = floor->add_component<MeshRenderer>(
+        m_material, Engine::RESOURCE_DIR_PATH + "/prim_mesh/rooms.obj",
+        VertexFormat::Float, false, true);
     floor_mesh->color = vec4(0.5, 0.5, 0.5, 1.0f);
+    // and never move, so they get merged into static batches.
+    floor->set_static(true);
   }
 }
 
@@ -1,7 +1,10 @@
 #include "../include/mesh.hpp"
 #include "../include/engine.hpp"
 #include "../include/renderer.hpp"
+#include "../include/mesh_optimizer.hpp"
 #include <assimp/matrix4x4.h>
+#include <glm/gtc/packing.hpp>
+#include <limits>
 #include <stdexcept>
 #include <yaml-cpp/yaml.h>
 
@@ -9,14 +12,13 @@
 // TODO: implement instanced rendering and use unqiue mesh/material buffers
 // this will allow us to avoid redundant data and reduce the number of draw calls.
 MeshRenderer::MeshRenderer(const shared_ptr<Material> &material,
-                           const std::string &mesh_path)
-    : material(material) {
-  if (Mesh::cache.find(mesh_path) == Mesh::cache.end()) {
-    mesh = make_shared<Mesh>(mesh_path);
-    Mesh::load_into(mesh, mesh_path);
-  } else {
-    mesh = Mesh::cache[mesh_path];
-  }
+                           const std::string &mesh_path,
+                           const VertexFormat format,
+                           const bool submesh_nodes, const bool occluder)
+    : material(material), occluder(occluder), submesh_nodes(submesh_nodes) {
+  mesh = Mesh::get(mesh_path, {.format = format,
+                               .merge_submeshes = !submesh_nodes,
+                               .occluder = occluder});
 }
 MeshRenderer::~MeshRenderer() {
   auto &mesh_buf = Engine::current().m_renderer.mesh_buffer;
@@ -25,7 +27,182 @@ MeshRenderer::~MeshRenderer() {
 
 unordered_map<std::string, shared_ptr<Mesh>> Mesh::cache = {};
 
-void Mesh::load_into(shared_ptr<Mesh> &mesh, const std::string &path) {
+std::string Mesh::cache_key(const std::string &path, const MeshImportOptions &options) {
+  auto key = options.format == VertexFormat::Packed ? path + ":packed" : path;
+  if (options.occluder) {
+    key += ":occluder";
+  }
+  return options.merge_submeshes ? key : key + ":split";
+}
+shared_ptr<Mesh> Mesh::get(const std::string &path, const MeshImportOptions &options) {
+  auto it = cache.find(cache_key(path, options));
+  if (it != cache.end()) {
+    return it->second;
+  }
+  auto mesh = make_shared<Mesh>(path);
+  Mesh::load_into(mesh, path, options);
+  return mesh;
+}
+void Mesh::release_cpu_data() {
+  vertices = {};
+  packed_vertices = {};
+  indices = {};
+  short_indices = {};
+}
+const void *Mesh::index_data() const {
+  return has_short_indices ? (const void *)short_indices.data()
+                           : (const void *)indices.data();
+}
+
+// octahedral normal encoding, maps the unit sphere onto the [-1, 1] square.
+static vec2 oct_encode(const vec3 &n) {
+  const vec3 p = n / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+  if (p.z >= 0.0f) {
+    return vec2(p.x, p.y);
+  }
+  return vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+              (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+}
+static vec3 oct_decode(const vec2 &e) {
+  vec3 n = vec3(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  const float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+static uint32_t pack_snorm10(const float value) {
+  const auto q = (int32_t)std::round(std::clamp(value, -1.0f, 1.0f) * 511.0f);
+  return (uint32_t)q & 0x3ff;
+}
+static float unpack_snorm10(const uint32_t bits) {
+  // sign extend the 10 bit value.
+  const auto q = (int32_t)(bits << 22) >> 22;
+  return std::max((float)q / 511.0f, -1.0f);
+}
+
+vec3 Mesh::position_scale() const {
+  if (format != VertexFormat::Packed) {
+    return vec3(1);
+  }
+  // flat meshes would otherwise divide by zero when quantizing.
+  return glm::max(bounds_max - bounds_min, vec3(1e-6f));
+}
+vec3 Mesh::position_offset() const {
+  return format == VertexFormat::Packed ? bounds_min : vec3(0);
+}
+Vertex Mesh::unpack(const PackedVertex &packed) const {
+  Vertex vertex;
+  const auto scale = position_scale();
+  const auto offset = position_offset();
+  for (int i = 0; i < 3; i++) {
+    vertex.position[i] =
+        offset[i] + scale[i] * ((float)packed.position[i] / 65535.0f);
+  }
+  vertex.texcoord = vec2(glm::unpackHalf1x16(packed.texcoord[0]),
+                         glm::unpackHalf1x16(packed.texcoord[1]));
+  vertex.normal = oct_decode(vec2(unpack_snorm10(packed.normal),
+                                  unpack_snorm10(packed.normal >> 10)));
+  return vertex;
+}
+void Mesh::set_data(vector<Vertex> &&new_vertices, vector<unsigned int> &&new_indices) {
+  vertices = std::move(new_vertices);
+  indices = std::move(new_indices);
+  packed_vertices = {};
+  short_indices = {};
+  has_short_indices = false;
+  format = VertexFormat::Float;
+  vertex_count = vertices.size();
+  index_count = indices.size();
+  compute_bounds();
+  lods.clear();
+  if (!indices.empty()) {
+    lods = {{0, indices.size(), 0.0f}};
+  }
+  if (vertices.size() <= std::numeric_limits<uint16_t>::max() + 1) {
+    short_indices.assign(indices.begin(), indices.end());
+    has_short_indices = true;
+    indices = {};
+  }
+}
+void Mesh::compute_bounds() {
+  if (vertices.empty()) {
+    return;
+  }
+  bounds_min = bounds_max = vertices[0].position;
+  for (const auto &vertex : vertices) {
+    bounds_min = glm::min(bounds_min, vertex.position);
+    bounds_max = glm::max(bounds_max, vertex.position);
+  }
+}
+void Mesh::generate_lods(const size_t lod_count) {
+  // each lod is simplified from the previous one & appended to the indices.
+  vector<unsigned int> previous(indices.begin(), indices.end());
+  float error = 0.0f;
+  // past this the mesh wouldn't resemble itself anymore.
+  const float max_error = bounds_radius() * 0.25f;
+  
+  while (lods.size() < lod_count && error < max_error) {
+    const size_t target = previous.size() / 6 * 3;
+    float lod_error = 0.0f;
+    auto lod_indices = mesh_optimizer::simplify(previous, vertices, target,
+                                                max_error - error, &lod_error);
+    if (lod_indices.empty() || lod_indices.size() > previous.size() * 9 / 10) {
+      break;
+    }
+    mesh_optimizer::optimize_vertex_cache(lod_indices, vertices.size());
+    error += lod_error;
+    lods.push_back({indices.size(), lod_indices.size(), error});
+    indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+    previous = std::move(lod_indices);
+  }
+}
+void Mesh::build_occluder() {
+  // full detail. simplification isn't conservative, it can close a door or
+  // a window, and an occluder covering more than the mesh hides things that
+  // are in plain sight.
+  const auto &lod = lods.front();
+  // only the vertices the lod uses, renumbered.
+  unordered_map<unsigned int, uint32_t> remap;
+  occluder_indices.reserve(lod.index_count);
+  for (size_t i = lod.first_index; i < lod.first_index + lod.index_count; i++) {
+    const auto [it, inserted] = remap.insert({indices[i], occluder_vertices.size()});
+    if (inserted) {
+      occluder_vertices.push_back(vertices[indices[i]].position);
+    }
+    occluder_indices.push_back(it->second);
+  }
+}
+void Mesh::pack_vertices() {
+  const auto scale = position_scale();
+  const auto offset = position_offset();
+  packed_vertices.resize(vertices.size());
+  max_position_error = 0.0f;
+  max_normal_error_degrees = 0.0f;
+  
+  for (size_t i = 0; i < vertices.size(); i++) {
+    const auto &vertex = vertices[i];
+    auto &packed = packed_vertices[i];
+    for (int j = 0; j < 3; j++) {
+      const float t = (vertex.position[j] - offset[j]) / scale[j];
+      packed.position[j] = (uint16_t)std::round(std::clamp(t, 0.0f, 1.0f) * 65535.0f);
+    }
+    packed.texcoord[0] = glm::packHalf1x16(vertex.texcoord.x);
+    packed.texcoord[1] = glm::packHalf1x16(vertex.texcoord.y);
+    const auto has_normal = glm::length(vertex.normal) > 0.0f;
+    const auto encoded = has_normal ? oct_encode(glm::normalize(vertex.normal)) : vec2(0);
+    packed.normal = pack_snorm10(encoded.x) | (pack_snorm10(encoded.y) << 10);
+    
+    // measure what we lost against the float path.
+    const auto decoded = unpack(packed);
+    max_position_error = std::max(max_position_error, glm::length(decoded.position - vertex.position));
+    if (has_normal) {
+      const auto cos_theta = std::clamp(glm::dot(decoded.normal, glm::normalize(vertex.normal)), -1.0f, 1.0f);
+      max_normal_error_degrees = std::max(max_normal_error_degrees, glm::degrees(std::acos(cos_theta)));
+    }
+  }
+  vertices = {};
+}
+void Mesh::load_into(shared_ptr<Mesh> &mesh, const std::string &path, const MeshImportOptions &options) {
   Assimp::Importer importer;
   const aiScene *scene =
       importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
@@ -34,50 +211,113 @@ void Mesh::load_into(shared_ptr<Mesh> &mesh, const std::string &path) {
     throw std::runtime_error("ERROR::ASSIMP::" +
                              std::string(importer.GetErrorString()));
   }
-  Mesh::process_node(mesh, scene->mRootNode, scene);
-  cache[path] = mesh;
+  mesh->keep_cpu_copy = options.keep_cpu_copy;
+  mesh->format = options.format;
+  Mesh::process_node(mesh, scene->mRootNode, scene, options, glm::identity<mat4>());
+  if (options.merge_submeshes) {
+    mesh->finish_import(options);
+  }
+  cache[cache_key(path, options)] = mesh;
 }
-void Mesh::process_mesh(shared_ptr<Mesh> &out_mesh, aiMesh *in_mesh) {
+void Mesh::process_mesh(shared_ptr<Mesh> &out_mesh, aiMesh *in_mesh,
+                        const mat4 &transform) {
   auto &vertices = out_mesh->vertices;
-  auto &texcoords = out_mesh->texcoords;
-  auto &normals = out_mesh->normals;
   auto &indices = out_mesh->indices;
+  const auto has_texcoords = in_mesh->HasTextureCoords(0);
+  const auto has_normals = in_mesh->HasNormals();
+  const auto normal_transform = glm::transpose(glm::inverse(mat3(transform)));
+  // mirroring flips the winding, flip it back so the right faces get culled.
+  const auto mirrored = glm::determinant(mat3(transform)) < 0.0f;
   
+  // size everything once up front & write the final layout in a single pass.
+  const auto base = vertices.size();
+  vertices.resize(base + in_mesh->mNumVertices);
   for (size_t i = 0; i < in_mesh->mNumVertices; i++) {
-    aiVector3D &vertex = in_mesh->mVertices[i];
+    auto &vertex = vertices[base + i];
+    const aiVector3D &position = in_mesh->mVertices[i];
     // 2 meters in blender == 1 meter in our (collison, position)system(s).
-    vertices.push_back(vertex.x / 2.0);
-    vertices.push_back(vertex.y / 2.0); 
-    vertices.push_back(vertex.z / 2.0); 
-    if (in_mesh->HasTextureCoords(0)) {
-      aiVector3D texcoord = in_mesh->mTextureCoords[0][i];
-      texcoords.push_back(texcoord.x);
-      texcoords.push_back(texcoord.y);
+    vertex.position = vec3(transform * vec4(vec3(position.x, position.y, position.z) / 2.0f, 1.0f));
+    if (has_texcoords) {
+      const aiVector3D &texcoord = in_mesh->mTextureCoords[0][i];
+      vertex.texcoord = vec2(texcoord.x, texcoord.y);
     }
-    if (in_mesh->HasNormals()) {
-      aiVector3D normal = in_mesh->mNormals[i];
-      normals.push_back(normal.x);
-      normals.push_back(normal.y);
-      normals.push_back(normal.z);
+    if (has_normals) {
+      const aiVector3D &normal = in_mesh->mNormals[i];
+      const auto transformed = normal_transform * vec3(normal.x, normal.y, normal.z);
+      vertex.normal = glm::length(transformed) > 0.0f ? glm::normalize(transformed) : transformed;
     }
   }
+  // we always triangulate on import, stray point & line faces just get skipped.
+  indices.reserve(indices.size() + in_mesh->mNumFaces * 3);
   for (size_t i = 0; i < in_mesh->mNumFaces; i++) {
-    aiFace &face = in_mesh->mFaces[i];
-    for (size_t j = 0; j < face.mNumIndices; j++) {
-      indices.push_back(face.mIndices[j]);
+    const aiFace &face = in_mesh->mFaces[i];
+    if (face.mNumIndices != 3) {
+      continue;
     }
+    indices.push_back(base + face.mIndices[0]);
+    indices.push_back(base + face.mIndices[mirrored ? 2 : 1]);
+    indices.push_back(base + face.mIndices[mirrored ? 1 : 2]);
   }
 }
-void Mesh::process_node(shared_ptr<Mesh> &parent, const aiNode *node, const aiScene *scene) {
+void Mesh::finish_import(const MeshImportOptions &options) {
+  compute_bounds();
+  
+  if (options.optimize && !indices.empty()) {
+    const auto before = mesh_optimizer::analyze_vertex_cache(indices, vertices.size());
+    mesh_optimizer::optimize_vertex_cache(indices, vertices.size());
+    mesh_optimizer::optimize_overdraw(indices, vertices);
+    const auto after = mesh_optimizer::analyze_vertex_cache(indices, vertices.size());
+    acmr = vec2(before.acmr, after.acmr);
+    atvr = vec2(before.atvr, after.atvr);
+  }
+  if (!indices.empty()) {
+    lods = {{0, indices.size(), 0.0f}};
+    generate_lods(options.lod_count);
+    if (options.occluder) {
+      build_occluder();
+    }
+  }
+  if (options.optimize) {
+    // after the lods, so the vertices are ordered by first use in full detail.
+    mesh_optimizer::optimize_vertex_fetch(vertices, indices);
+  }
+  vertex_count = vertices.size();
+  index_count = indices.size();
+  
+  // most of our meshes are small enough for 16 bit indices, which halves them.
+  if (vertices.size() <= std::numeric_limits<uint16_t>::max() + 1) {
+    short_indices.assign(indices.begin(), indices.end());
+    has_short_indices = true;
+    indices = {};
+  }
+  
+  if (format == VertexFormat::Packed) {
+    pack_vertices();
+  }
+}
+void Mesh::process_node(shared_ptr<Mesh> &parent, const aiNode *node, const aiScene *scene,
+                        const MeshImportOptions &options, const mat4 &parent_transform) {
+  // assimp's matrices are row major, and in blender units like the positions.
+  auto local = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+  local[3] = vec4(vec3(local[3]) / 2.0f, 1.0f);
+  const auto transform = parent_transform * local;
   for (unsigned int i = 0; i < node->mNumMeshes; i++) {
     aiMesh *ai_mesh = scene->mMeshes[node->mMeshes[i]];
+    if (options.merge_submeshes) {
+      // baked into the one range, the renderer draws them all at once.
+      Mesh::process_mesh(parent, ai_mesh, transform);
+      continue;
+    }
     auto output_mesh = make_shared<Mesh>(parent->path);
+    output_mesh->keep_cpu_copy = parent->keep_cpu_copy;
+    output_mesh->format = parent->format;
     parent->submeshes.push_back(output_mesh);
-    output_mesh->transform = glm::make_mat4(&node->mTransformation.a1);
-    Mesh::process_mesh(output_mesh, ai_mesh);
+    output_mesh->transform = transform;
+    Mesh::process_mesh(output_mesh, ai_mesh, glm::identity<mat4>());
+    output_mesh->finish_import(options);
   }
   for (unsigned int i = 0; i < node->mNumChildren; i++) {
-    Mesh::process_node(parent, node->mChildren[i], scene);
+    Mesh::process_node(parent, node->mChildren[i], scene, options, transform);
   }
 }
 void MeshRenderer::deserialize(const YAML::Node &in) {
@@ -85,14 +325,40 @@ void MeshRenderer::deserialize(const YAML::Node &in) {
   auto material_node = in["material"];
   material->deserialize(material_node);
   auto mesh_path = in["mesh"].as<std::string>();
-  mesh = make_shared<Mesh>(mesh_path);
-  Mesh::load_into(mesh, mesh_path);
+  MeshImportOptions options;
+  if (in["vertex_format"] && in["vertex_format"].as<std::string>() == "packed") {
+    options.format = VertexFormat::Packed;
+  }
+  if (in["occluder"]) {
+    occluder = in["occluder"].as<bool>();
+  }
+  if (in["occlusion_query"]) {
+    occlusion_query = in["occlusion_query"].as<bool>();
+  }
+  if (in["submesh_nodes"]) {
+    submesh_nodes = in["submesh_nodes"].as<bool>();
+  }
+  options.merge_submeshes = !submesh_nodes;
+  options.occluder = occluder;
+  mesh = Mesh::get(mesh_path, options);
 }
 void MeshRenderer::serialize(YAML::Emitter &out) {
   out << YAML::BeginMap;
   out << YAML::Key << "type" << YAML::Value << "MeshRenderer";
   out << YAML::Key << "material" << YAML::Value << material->serialize();
   out << YAML::Key << "mesh" << YAML::Value << mesh->path;
+  if (mesh->format == VertexFormat::Packed) {
+    out << YAML::Key << "vertex_format" << YAML::Value << "packed";
+  }
+  if (occluder) {
+    out << YAML::Key << "occluder" << YAML::Value << true;
+  }
+  if (occlusion_query) {
+    out << YAML::Key << "occlusion_query" << YAML::Value << true;
+  }
+  if (submesh_nodes) {
+    out << YAML::Key << "submesh_nodes" << YAML::Value << true;
+  }
   out << YAML::EndMap;
 }
 void MeshRenderer::awake() {
@@ -104,8 +370,26 @@ void MeshRenderer::awake() {
   auto exists = it != meshes.end();
   if (!exists) {
     meshes.push_back(self);
-    mesh_buffer->interleave_mesh(self->mesh);
-    mesh_buffer->update_data();
+    mesh_buffer->upload_mesh(self->mesh);
+    // compile the variants we'll be drawn with now, rather than mid frame.
+    const ShaderFeatures format_features =
+        (mesh->format == VertexFormat::Packed ? PACKED_VERTICES : 0) |
+        (mesh_buffer->shadows.enabled ? SHADOWED : 0);
+    const auto can_atlas =
+        material->texture.has_value() && TextureAtlas::current().enabled;
+    for (const auto features : {format_features, format_features | ATLASED}) {
+      if ((features & ATLASED) && !can_atlas) {
+        continue;
+      }
+      material->variant(features);
+      material->variant(features | INSTANCED);
+      if (MeshBuffer::indirect_supported()) {
+        material->variant(features | INDIRECT);
+      }
+    }
+  }
+  if (node.lock()->is_static()) {
+    mesh_buffer->static_batches.dirty = true;
   }
   instantiate_nodes_for_submeshes();
 }
@@ -116,8 +400,11 @@ void MeshRenderer::instantiate_nodes_for_submeshes() {
     auto submesh_renderer = mesh_node->add_component<MeshRenderer>();
     submesh_renderer->material = material;
     submesh_renderer->color = color;
+    submesh_renderer->occluder = occluder;
+    submesh_renderer->occlusion_query = occlusion_query;
     submesh_renderer->mesh = submesh;
     mesh_node->set_transform(submesh->transform);
+    mesh_node->set_static(self_node->is_static());
     self_node->add_child(mesh_node);
   }
 }
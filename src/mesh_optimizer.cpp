@@ -0,0 +1,567 @@
+#include "../include/mesh_optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <queue>
+
+namespace mesh_optimizer {
+
+CacheStats analyze_vertex_cache(const vector<unsigned int> &indices,
+                                const size_t vertex_count,
+                                const size_t cache_size) {
+  CacheStats stats;
+  if (indices.empty() || vertex_count == 0) {
+    return stats;
+  }
+  // each vertex remembers the timestamp it entered the cache at, a vertex is
+  // still cached if fewer than cache_size misses happened since.
+  vector<size_t> cache_timestamps(vertex_count, 0);
+  size_t timestamp = cache_size + 1;
+  size_t misses = 0;
+
+  for (const auto index : indices) {
+    if (timestamp - cache_timestamps[index] > cache_size) {
+      cache_timestamps[index] = timestamp++;
+      misses++;
+    }
+  }
+  stats.acmr = (float)misses / (float)(indices.size() / 3);
+  stats.atvr = (float)misses / (float)vertex_count;
+  return stats;
+}
+
+namespace {
+
+constexpr int CACHE_SIZE = 32;
+constexpr float CACHE_DECAY_POWER = 1.5f;
+constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float VALENCE_BOOST_SCALE = 2.0f;
+constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+float vertex_score(const int cache_position, const unsigned int remaining) {
+  if (remaining == 0) {
+    // no triangles left that use this vertex.
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // it was used in the last triangle, we don't want to favour that one
+      // too much or we'd just strip along a single line.
+      score = LAST_TRIANGLE_SCORE;
+    } else {
+      const float scaler = 1.0f / (CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+    }
+  }
+  // boost vertices with few triangles left so we don't leave lone triangles behind.
+  score += VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+  return score;
+}
+
+} // namespace
+
+void optimize_vertex_cache(vector<unsigned int> &indices,
+                           const size_t vertex_count) {
+  const size_t triangle_count = indices.size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  // vertex -> triangle adjacency, flattened.
+  vector<unsigned int> remaining(vertex_count, 0);
+  for (const auto index : indices) {
+    remaining[index]++;
+  }
+  vector<unsigned int> adjacency_offsets(vertex_count + 1, 0);
+  for (size_t i = 0; i < vertex_count; i++) {
+    adjacency_offsets[i + 1] = adjacency_offsets[i] + remaining[i];
+  }
+  vector<unsigned int> adjacency(indices.size());
+  {
+    vector<unsigned int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      adjacency[fill[indices[i]]++] = i / 3;
+    }
+  }
+
+  vector<int> cache_positions(vertex_count, -1);
+  vector<float> vertex_scores(vertex_count);
+  for (size_t i = 0; i < vertex_count; i++) {
+    vertex_scores[i] = vertex_score(-1, remaining[i]);
+  }
+  vector<float> triangle_scores(triangle_count);
+  vector<bool> emitted(triangle_count, false);
+  for (size_t i = 0; i < triangle_count; i++) {
+    triangle_scores[i] = vertex_scores[indices[i * 3]] +
+                         vertex_scores[indices[i * 3 + 1]] +
+                         vertex_scores[indices[i * 3 + 2]];
+  }
+
+  vector<unsigned int> output;
+  output.reserve(indices.size());
+  // 3 extra slots so the triangle we just emitted can push entries out.
+  vector<unsigned int> cache, new_cache;
+  cache.reserve(CACHE_SIZE + 3);
+  new_cache.reserve(CACHE_SIZE + 3);
+
+  size_t best_triangle = 0;
+  size_t scan_cursor = 0;
+
+  while (output.size() < indices.size()) {
+    const unsigned int *triangle = &indices[best_triangle * 3];
+    output.insert(output.end(), triangle, triangle + 3);
+    emitted[best_triangle] = true;
+
+    // the emitted triangle's vertices go to the front of the lru cache.
+    new_cache.assign(triangle, triangle + 3);
+    for (const auto vertex : cache) {
+      if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+        new_cache.push_back(vertex);
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      const auto vertex = triangle[i];
+      remaining[vertex]--;
+      // drop the triangle from the vertex's adjacency so we don't rescore it.
+      auto begin = adjacency.begin() + adjacency_offsets[vertex];
+      auto end = begin + remaining[vertex] + 1;
+      auto it = std::find(begin, end, (unsigned int)best_triangle);
+      std::iter_swap(it, end - 1);
+    }
+
+    // rescore every vertex that's in (or just fell out of) the cache, and
+    // every triangle touching them, picking the best one as we go.
+    float best_score = -1.0f;
+    for (size_t i = 0; i < new_cache.size(); i++) {
+      const auto vertex = new_cache[i];
+      cache_positions[vertex] = i < CACHE_SIZE ? (int)i : -1;
+      vertex_scores[vertex] = vertex_score(cache_positions[vertex], remaining[vertex]);
+    }
+    for (const auto vertex : new_cache) {
+      const auto begin = adjacency_offsets[vertex];
+      for (unsigned int j = begin; j < begin + remaining[vertex]; j++) {
+        const auto t = adjacency[j];
+        const float score = vertex_scores[indices[t * 3]] +
+                            vertex_scores[indices[t * 3 + 1]] +
+                            vertex_scores[indices[t * 3 + 2]];
+        triangle_scores[t] = score;
+        if (score > best_score) {
+          best_score = score;
+          best_triangle = t;
+        }
+      }
+    }
+    if (new_cache.size() > CACHE_SIZE) {
+      new_cache.resize(CACHE_SIZE);
+    }
+    std::swap(cache, new_cache);
+
+    if (best_score < 0.0f) {
+      // nothing in the cache touches a remaining triangle, take the next one in order.
+      while (scan_cursor < triangle_count && emitted[scan_cursor]) {
+        scan_cursor++;
+      }
+      if (scan_cursor == triangle_count) {
+        break;
+      }
+      best_triangle = scan_cursor;
+    }
+  }
+  indices = std::move(output);
+}
+
+void optimize_overdraw(vector<unsigned int> &indices,
+                       const vector<Vertex> &vertices, const float threshold) {
+  const size_t triangle_count = indices.size() / 3;
+  if (triangle_count < 2 || vertices.empty()) {
+    return;
+  }
+  constexpr size_t cache_size = 16;
+  constexpr size_t min_cluster_size = 8;
+  const auto overall = analyze_vertex_cache(indices, vertices.size(), cache_size);
+  const float target_acmr = overall.acmr * threshold;
+
+  // cut wherever the cluster so far has an acmr we can live with.
+  // reordering the clusters can only cost us the misses at each cut.
+  vector<size_t> cluster_starts = {0};
+  {
+    vector<size_t> cache_timestamps(vertices.size(), 0);
+    size_t timestamp = cache_size + 1;
+    size_t cluster_misses = 0, cluster_triangles = 0;
+    for (size_t t = 0; t < triangle_count; t++) {
+      for (int i = 0; i < 3; i++) {
+        const auto index = indices[t * 3 + i];
+        if (timestamp - cache_timestamps[index] > cache_size) {
+          cache_timestamps[index] = timestamp++;
+          cluster_misses++;
+        }
+      }
+      cluster_triangles++;
+      const float acmr = (float)cluster_misses / (float)cluster_triangles;
+      if (cluster_triangles >= min_cluster_size && acmr <= target_acmr &&
+          t + 1 < triangle_count) {
+        cluster_starts.push_back(t + 1);
+        cluster_misses = cluster_triangles = 0;
+        // the next cluster could be drawn after any other, so assume it starts cold.
+        timestamp += cache_size + 1;
+      }
+    }
+  }
+  const size_t cluster_count = cluster_starts.size();
+  if (cluster_count < 2) {
+    return;
+  }
+  cluster_starts.push_back(triangle_count);
+
+  vec3 mesh_centroid = vec3(0);
+  for (const auto &vertex : vertices) {
+    mesh_centroid += vertex.position;
+  }
+  mesh_centroid /= (float)vertices.size();
+
+  // clusters whose area weighted normal points away from the mesh centre are
+  // the most likely to occlude the rest, so they go first.
+  vector<float> sort_keys(cluster_count);
+  for (size_t c = 0; c < cluster_count; c++) {
+    vec3 centroid = vec3(0), normal = vec3(0);
+    float area = 0.0f;
+    for (size_t t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+      const auto &a = vertices[indices[t * 3]].position;
+      const auto &b = vertices[indices[t * 3 + 1]].position;
+      const auto &p = vertices[indices[t * 3 + 2]].position;
+      const vec3 n = glm::cross(b - a, p - a);
+      const float triangle_area = glm::length(n);
+      centroid += (a + b + p) * (triangle_area / 3.0f);
+      normal += n;
+      area += triangle_area;
+    }
+    if (area > 0.0f) {
+      centroid /= area;
+    }
+    const float normal_length = glm::length(normal);
+    sort_keys[c] = normal_length > 0.0f
+                       ? glm::dot(centroid - mesh_centroid, normal / normal_length)
+                       : 0.0f;
+  }
+  vector<size_t> order(cluster_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  vector<unsigned int> output;
+  output.reserve(indices.size());
+  for (const auto c : order) {
+    output.insert(output.end(), indices.begin() + cluster_starts[c] * 3,
+                  indices.begin() + cluster_starts[c + 1] * 3);
+  }
+  indices = std::move(output);
+}
+
+void optimize_vertex_fetch(vector<Vertex> &vertices,
+                           vector<unsigned int> &indices) {
+  constexpr auto unused = ~0u;
+  vector<unsigned int> remap(vertices.size(), unused);
+  vector<Vertex> output;
+  output.reserve(vertices.size());
+  for (auto &index : indices) {
+    if (remap[index] == unused) {
+      remap[index] = output.size();
+      output.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices = std::move(output);
+}
+
+namespace {
+
+// symmetric 4x4 matrix, the weighted sum of squared distances to a set of
+// planes. error() divides by the total weight so it's a squared distance.
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0;
+  double b2 = 0, bc = 0, bd = 0;
+  double c2 = 0, cd = 0;
+  double d2 = 0;
+  double weight = 0;
+
+  static Quadric from_plane(const dvec3 &n, const double d, const double weight) {
+    Quadric q;
+    q.a2 = n.x * n.x * weight; q.ab = n.x * n.y * weight; q.ac = n.x * n.z * weight; q.ad = n.x * d * weight;
+    q.b2 = n.y * n.y * weight; q.bc = n.y * n.z * weight; q.bd = n.y * d * weight;
+    q.c2 = n.z * n.z * weight; q.cd = n.z * d * weight;
+    q.d2 = d * d * weight;
+    q.weight = weight;
+    return q;
+  }
+  Quadric &operator+=(const Quadric &o) {
+    a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad;
+    b2 += o.b2; bc += o.bc; bd += o.bd;
+    c2 += o.c2; cd += o.cd;
+    d2 += o.d2;
+    weight += o.weight;
+    return *this;
+  }
+  double error(const vec3 &p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+                     b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+                     c2 * z * z + 2 * cd * z + d2;
+    return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  double cost;
+  unsigned int from, to;
+  unsigned int from_version, to_version;
+  bool operator>(const Collapse &o) const { return cost > o.cost; }
+};
+
+} // namespace
+
+vector<unsigned int> simplify(const vector<unsigned int> &indices,
+                              const vector<Vertex> &vertices,
+                              const size_t target_index_count,
+                              const float target_error, float *out_error) {
+  if (out_error) {
+    *out_error = 0.0f;
+  }
+  if (indices.size() <= target_index_count || vertices.empty()) {
+    return indices;
+  }
+
+  // weld vertices that only differ in their attributes (uv & normal seams) so
+  // we simplify the actual surface, and map back to real vertices at the end.
+  vector<unsigned int> canonical(vertices.size());
+  vector<vector<unsigned int>> wedges(vertices.size());
+  {
+    struct PositionHash {
+      size_t operator()(const vec3 &p) const {
+        const auto h = [](float f) { return std::hash<float>()(f); };
+        return h(p.x) ^ (h(p.y) * 31) ^ (h(p.z) * 131);
+      }
+    };
+    struct PositionEqual {
+      bool operator()(const vec3 &a, const vec3 &b) const {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+      }
+    };
+    std::unordered_map<vec3, unsigned int, PositionHash, PositionEqual> welded;
+    welded.reserve(vertices.size());
+    for (unsigned int i = 0; i < vertices.size(); i++) {
+      auto [it, inserted] = welded.try_emplace(vertices[i].position, i);
+      canonical[i] = it->second;
+      wedges[it->second].push_back(i);
+    }
+  }
+
+  const size_t triangle_count = indices.size() / 3;
+  vector<unsigned int> triangles(indices.size());
+  for (size_t i = 0; i < indices.size(); i++) {
+    triangles[i] = canonical[indices[i]];
+  }
+  vector<bool> triangle_alive(triangle_count, true);
+  vector<vector<unsigned int>> vertex_triangles(vertices.size());
+  for (size_t t = 0; t < triangle_count; t++) {
+    const auto a = triangles[t * 3], b = triangles[t * 3 + 1], c = triangles[t * 3 + 2];
+    if (a == b || b == c || a == c) {
+      triangle_alive[t] = false;
+      continue;
+    }
+    vertex_triangles[a].push_back(t);
+    vertex_triangles[b].push_back(t);
+    vertex_triangles[c].push_back(t);
+  }
+  const auto position = [&](unsigned int v) -> const vec3 & {
+    return vertices[v].position;
+  };
+
+  // area weighted plane quadrics for every triangle.
+  vector<Quadric> quadrics(vertices.size());
+  std::unordered_map<uint64_t, unsigned int> edge_use;
+  const auto edge_key = [](unsigned int a, unsigned int b) {
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+  };
+  for (size_t t = 0; t < triangle_count; t++) {
+    if (!triangle_alive[t]) {
+      continue;
+    }
+    const unsigned int *tri = &triangles[t * 3];
+    const dvec3 p0 = dvec3(position(tri[0])), p1 = dvec3(position(tri[1])), p2 = dvec3(position(tri[2]));
+    dvec3 n = glm::cross(p1 - p0, p2 - p0);
+    const double area = glm::length(n);
+    if (area == 0.0) {
+      continue;
+    }
+    n /= area;
+    const auto quadric = Quadric::from_plane(n, -glm::dot(n, p0), area * 0.5);
+    for (int i = 0; i < 3; i++) {
+      quadrics[tri[i]] += quadric;
+      edge_use[edge_key(tri[i], tri[(i + 1) % 3])]++;
+    }
+  }
+  // open borders get a heavily weighted plane perpendicular to the surface,
+  // otherwise they'd shrink away freely.
+  for (size_t t = 0; t < triangle_count; t++) {
+    if (!triangle_alive[t]) {
+      continue;
+    }
+    const unsigned int *tri = &triangles[t * 3];
+    const dvec3 p0 = dvec3(position(tri[0])), p1 = dvec3(position(tri[1])), p2 = dvec3(position(tri[2]));
+    const dvec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+    for (int i = 0; i < 3; i++) {
+      const auto a = tri[i], b = tri[(i + 1) % 3];
+      if (edge_use[edge_key(a, b)] != 1) {
+        continue;
+      }
+      const dvec3 pa = dvec3(position(a)), pb = dvec3(position(b));
+      const dvec3 edge = pb - pa;
+      dvec3 n = glm::cross(edge, face_normal);
+      const double length = glm::length(n);
+      if (length == 0.0) {
+        continue;
+      }
+      n /= length;
+      const auto quadric = Quadric::from_plane(n, -glm::dot(n, pa), glm::dot(edge, edge) * 10.0);
+      quadrics[a] += quadric;
+      quadrics[b] += quadric;
+    }
+  }
+
+  vector<unsigned int> versions(vertices.size(), 0);
+  vector<unsigned int> collapsed_to(vertices.size());
+  std::iota(collapsed_to.begin(), collapsed_to.end(), 0);
+  std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse>> queue;
+
+  const auto push_edge = [&](unsigned int a, unsigned int b) {
+    Quadric q = quadrics[a];
+    q += quadrics[b];
+    const double cost_ab = q.error(position(b)), cost_ba = q.error(position(a));
+    if (cost_ab <= cost_ba) {
+      queue.push({cost_ab, a, b, versions[a], versions[b]});
+    } else {
+      queue.push({cost_ba, b, a, versions[b], versions[a]});
+    }
+  };
+  for (const auto &[key, count] : edge_use) {
+    push_edge((unsigned int)(key >> 32), (unsigned int)(key & 0xffffffff));
+  }
+
+  // moving `from` onto `to` mustn't flip any of the triangles that survive it.
+  const auto flips = [&](unsigned int from, unsigned int to) {
+    for (const auto t : vertex_triangles[from]) {
+      if (!triangle_alive[t]) {
+        continue;
+      }
+      const unsigned int *tri = &triangles[t * 3];
+      if (tri[0] == to || tri[1] == to || tri[2] == to) {
+        continue;
+      }
+      vec3 before[3], after[3];
+      for (int i = 0; i < 3; i++) {
+        before[i] = position(tri[i]);
+        after[i] = tri[i] == from ? position(to) : before[i];
+      }
+      const vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+      const vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+      if (glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  size_t live_indices = 0;
+  for (size_t t = 0; t < triangle_count; t++) {
+    live_indices += triangle_alive[t] ? 3 : 0;
+  }
+  const double max_cost = (double)target_error * (double)target_error;
+  double result_cost = 0.0;
+
+  while (live_indices > target_index_count && !queue.empty()) {
+    const auto collapse = queue.top();
+    queue.pop();
+    const auto from = collapse.from, to = collapse.to;
+    if (collapsed_to[from] != from || collapsed_to[to] != to ||
+        versions[from] != collapse.from_version || versions[to] != collapse.to_version) {
+      continue; // stale entry.
+    }
+    if (collapse.cost > max_cost) {
+      break;
+    }
+    if (flips(from, to)) {
+      continue;
+    }
+
+    collapsed_to[from] = to;
+    quadrics[to] += quadrics[from];
+    versions[to]++;
+    result_cost = std::max(result_cost, collapse.cost);
+
+    for (const auto t : vertex_triangles[from]) {
+      if (!triangle_alive[t]) {
+        continue;
+      }
+      unsigned int *tri = &triangles[t * 3];
+      for (int i = 0; i < 3; i++) {
+        if (tri[i] == from) {
+          tri[i] = to;
+        }
+      }
+      if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+        triangle_alive[t] = false;
+        live_indices -= 3;
+      } else {
+        vertex_triangles[to].push_back(t);
+      }
+    }
+    vertex_triangles[from] = {};
+
+    // drop dead triangles from the survivor & requeue its edges with new costs.
+    auto &around = vertex_triangles[to];
+    std::erase_if(around, [&](unsigned int t) { return !triangle_alive[t]; });
+    std::sort(around.begin(), around.end());
+    around.erase(std::unique(around.begin(), around.end()), around.end());
+    for (const auto t : around) {
+      for (int i = 0; i < 3; i++) {
+        const auto other = triangles[t * 3 + i];
+        if (other != to) {
+          push_edge(to, other);
+        }
+      }
+    }
+  }
+
+  // back to real vertices : each corner picks the vertex at its collapsed
+  // position whose attributes are closest to the corner's original ones.
+  vector<unsigned int> output;
+  output.reserve(live_indices);
+  for (size_t t = 0; t < triangle_count; t++) {
+    if (!triangle_alive[t]) {
+      continue;
+    }
+    for (int i = 0; i < 3; i++) {
+      const auto original = vertices[indices[t * 3 + i]];
+      unsigned int best = triangles[t * 3 + i];
+      float best_distance = std::numeric_limits<float>::max();
+      for (const auto candidate : wedges[triangles[t * 3 + i]]) {
+        const auto &v = vertices[candidate];
+        const float distance = glm::length(v.normal - original.normal) +
+                               glm::length(v.texcoord - original.texcoord);
+        if (distance < best_distance) {
+          best_distance = distance;
+          best = candidate;
+        }
+      }
+      output.push_back(best);
+    }
+  }
+  if (out_error) {
+    *out_error = (float)std::sqrt(result_cost);
+  }
+  return output;
+}
+
+} // namespace mesh_optimizer
@@ -144,6 +144,9 @@ void Node::deserialize(const YAML::Node &in) {
     this->name = in["name"].as<std::string>();
     auto transform = in["transform"];
     this->local_transform = string_to_mat4(transform.as<std::string>());
+    if (in["static"]) {
+      this->static_geometry = in["static"].as<bool>();
+    }
     auto components = in["components"];
     for (auto component : components) {
       auto type = component["type"].as<std::string>();
@@ -172,6 +175,10 @@ void Node::deserialize(const YAML::Node &in) {
         auto block_placer = this->add_component<BlockPlacer>();
         block_placer->deserialize(component);
       }
+      if (type == "DrawBenchmark") {
+        auto benchmark = this->add_component<DrawBenchmark>();
+        benchmark->deserialize(component);
+      }
       if (type == "Player") {
         auto player = this->add_component<Player>();
         player->deserialize(component);
@@ -188,6 +195,9 @@ void Node::serialize(YAML::Emitter &out) {
     out << YAML::BeginMap;
     out << YAML::Key << "name" << YAML::Value << name;
     out << YAML::Key << "transform" << YAML::Value << mat4_to_string(local_transform);
+    if (static_geometry) {
+      out << YAML::Key << "static" << YAML::Value << true;
+    }
     out << YAML::Key << "children" << YAML::Value << YAML::BeginSeq;
     for (auto &child : children) {
       child->serialize(out);
@@ -211,6 +221,20 @@ shared_ptr<Node> Node::instantiate(const vec3 &pos, const vec3 &scale,
     scene.new_node_queue.push_back(node);
     return node;
 }
+void Node::set_static(const bool value) {
+  // children that haven't been moved over from the queue yet count too.
+  for (auto &child : children) {
+    child->set_static(value);
+  }
+  for (auto &child : new_child_queue) {
+    child->set_static(value);
+  }
+  if (static_geometry == value) {
+    return;
+  }
+  static_geometry = value;
+  Engine::current().m_renderer.mesh_buffer->static_batches.dirty = true;
+}
 void Node::add_child(shared_ptr<Node> child) {
   auto &engine = Engine::current();
   Scene &scene = engine.m_scene;
@@ -0,0 +1,218 @@
+#include "../include/occlusion.hpp"
+#include "../include/mesh.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+OcclusionCuller::OcclusionCuller()
+    : depth(WIDTH * HEIGHT, 1.0f),
+      pool(std::min(ThreadPool::default_thread_count(), (size_t)4)) {}
+
+void OcclusionCuller::begin(const mat4 &view_projection) {
+  this->view_projection = view_projection;
+  std::fill(depth.begin(), depth.end(), 1.0f);
+  triangles.clear();
+  occluder_count = 0;
+}
+
+// clip space to depth buffer pixels, z to [0, 1].
+static vec3 to_screen(const vec4 &clip) {
+  const auto ndc = vec3(clip) * (1.0f / clip.w);
+  return vec3((ndc.x * 0.5f + 0.5f) * OcclusionCuller::WIDTH,
+              (ndc.y * 0.5f + 0.5f) * OcclusionCuller::HEIGHT,
+              ndc.z * 0.5f + 0.5f);
+}
+
+void OcclusionCuller::add_occluder(const Mesh &mesh, const mat4 &model) {
+  const auto &indices = mesh.occluder_indices;
+  if (indices.empty()) {
+    return;
+  }
+  const auto mvp = view_projection * model;
+  vector<vec4> clip(mesh.occluder_vertices.size());
+  for (size_t i = 0; i < clip.size(); i++) {
+    clip[i] = mvp * vec4(mesh.occluder_vertices[i], 1.0f);
+  }
+  occluder_count++;
+
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    // clip against the near plane (z >= -w), which leaves 3 or 4 corners.
+    vec4 polygon[4];
+    int corners = 0;
+    for (int j = 0; j < 3; j++) {
+      const auto &a = clip[indices[i + j]];
+      const auto &b = clip[indices[i + (j + 1) % 3]];
+      const auto da = a.z + a.w, db = b.z + b.w;
+      if (da >= 0.0f) {
+        polygon[corners++] = a;
+      }
+      if ((da >= 0.0f) != (db >= 0.0f)) {
+        polygon[corners++] = a + (b - a) * (da / (da - db));
+      }
+    }
+    if (corners < 3) {
+      continue;
+    }
+    vec3 screen[4];
+    for (int j = 0; j < corners; j++) {
+      screen[j] = to_screen(polygon[j]);
+    }
+    for (int j = 1; j + 1 < corners; j++) {
+      const vec3 v[3] = {screen[0], screen[j], screen[j + 1]};
+      // only front faces occlude, back faces aren't drawn either.
+      const auto area = (v[1].x - v[0].x) * (v[2].y - v[0].y) -
+                        (v[2].x - v[0].x) * (v[1].y - v[0].y);
+      if (area <= 0.0f) {
+        continue;
+      }
+      const auto min_y = std::min({v[0].y, v[1].y, v[2].y});
+      const auto max_y = std::max({v[0].y, v[1].y, v[2].y});
+      const auto min_x = std::min({v[0].x, v[1].x, v[2].x});
+      const auto max_x = std::max({v[0].x, v[1].x, v[2].x});
+      if (max_y < 0.0f || min_y > HEIGHT || max_x < 0.0f || min_x > WIDTH) {
+        continue;
+      }
+      triangles.push_back({{v[0], v[1], v[2]}, min_y, max_y});
+    }
+  }
+}
+
+void OcclusionCuller::rasterize() {
+  triangle_count = triangles.size();
+  if (triangles.empty()) {
+    return;
+  }
+  pool.parallel_for(HEIGHT / BAND_HEIGHT, [this](size_t begin, size_t end) {
+    for (auto band = begin; band < end; band++) {
+      rasterize_band(band * BAND_HEIGHT, (band + 1) * BAND_HEIGHT);
+    }
+  });
+}
+
+void OcclusionCuller::rasterize_band(const int row_begin, const int row_end) {
+  for (const auto &triangle : triangles) {
+    if (triangle.max_y < row_begin || triangle.min_y > row_end) {
+      continue;
+    }
+    const auto &v = triangle.v;
+    // edge functions e(x, y) = a * x + b * y + c, positive inside. the
+    // opposite vertex's barycentric is e / area, which gives the depth plane.
+    float a[3], b[3], c[3];
+    for (int i = 0; i < 3; i++) {
+      const auto &from = v[(i + 1) % 3], &to = v[(i + 2) % 3];
+      a[i] = from.y - to.y;
+      b[i] = to.x - from.x;
+      c[i] = -(a[i] * from.x + b[i] * from.y);
+    }
+    const auto area = c[0] + c[1] + c[2];
+    const auto inverse_area = 1.0f / area;
+    const auto za = (a[0] * v[0].z + a[1] * v[1].z + a[2] * v[2].z) * inverse_area;
+    const auto zb = (b[0] * v[0].z + b[1] * v[1].z + b[2] * v[2].z) * inverse_area;
+    const auto zc = (c[0] * v[0].z + c[1] * v[1].z + c[2] * v[2].z) * inverse_area;
+
+    const auto min_x = std::max(
+        0, (int)std::floor(std::min({v[0].x, v[1].x, v[2].x}))) & ~3;
+    const auto max_x = std::min(
+        WIDTH - 1, (int)std::ceil(std::max({v[0].x, v[1].x, v[2].x})));
+    const auto min_y = std::max(row_begin, (int)std::floor(triangle.min_y));
+    const auto max_y = std::min(row_end - 1, (int)std::ceil(triangle.max_y));
+
+    for (int y = min_y; y <= max_y; y++) {
+      const auto py = y + 0.5f;
+      auto *row = depth.data() + y * WIDTH;
+#if defined(__SSE2__)
+      // 4 pixels at a time, min_x is a multiple of 4 so we never run off the row.
+      const auto lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+      const auto zero = _mm_setzero_ps();
+      for (int x = min_x; x <= max_x; x += 4) {
+        const auto px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+        auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < 3; i++) {
+          const auto e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), px),
+                                    _mm_set1_ps(b[i] * py + c[i]));
+          // strictly inside, edges are left to the neighbour or nobody, so
+          // an occluder never covers a pixel its triangles don't. that's
+          // only as good as the triangles, see Mesh::build_occluder.
+          inside = _mm_and_ps(inside, _mm_cmpgt_ps(e, zero));
+        }
+        if (_mm_movemask_ps(inside) == 0) {
+          continue;
+        }
+        const auto z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px),
+                                  _mm_set1_ps(zb * py + zc));
+        const auto old = _mm_loadu_ps(row + x);
+        const auto nearer = _mm_min_ps(old, z);
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                        _mm_andnot_ps(inside, old)));
+      }
+#else
+      for (int x = min_x; x <= max_x; x++) {
+        const auto px = x + 0.5f;
+        if (a[0] * px + b[0] * py + c[0] <= 0.0f ||
+            a[1] * px + b[1] * py + c[1] <= 0.0f ||
+            a[2] * px + b[2] * py + c[2] <= 0.0f) {
+          continue;
+        }
+        row[x] = std::min(row[x], za * px + zb * py + zc);
+      }
+#endif
+    }
+  }
+}
+
+bool OcclusionCuller::visible(const Mesh &mesh, const mat4 &model) const {
+  const auto mvp = view_projection * model;
+  vec2 lo = vec2(WIDTH, HEIGHT), hi = vec2(0.0f);
+  float nearest = 1.0f;
+  for (int i = 0; i < 8; i++) {
+    const auto corner = vec3(i & 1 ? mesh.bounds_max.x : mesh.bounds_min.x,
+                             i & 2 ? mesh.bounds_max.y : mesh.bounds_min.y,
+                             i & 4 ? mesh.bounds_max.z : mesh.bounds_min.z);
+    const auto clip = mvp * vec4(corner, 1.0f);
+    // crosses the near plane, there's nothing to compare against.
+    if (clip.z < -clip.w || clip.w <= 0.0f) {
+      return true;
+    }
+    const auto screen = to_screen(clip);
+    lo = glm::min(lo, vec2(screen));
+    hi = glm::max(hi, vec2(screen));
+    nearest = std::min(nearest, screen.z);
+  }
+  const auto min_x = std::max(0, (int)std::floor(lo.x));
+  const auto max_x = std::min(WIDTH - 1, (int)std::ceil(hi.x));
+  const auto min_y = std::max(0, (int)std::floor(lo.y));
+  const auto max_y = std::min(HEIGHT - 1, (int)std::ceil(hi.y));
+  // off screen, that's for frustum culling to decide.
+  if (min_x > max_x || min_y > max_y) {
+    return true;
+  }
+  for (int y = min_y; y <= max_y; y++) {
+    const auto *row = depth.data() + y * WIDTH;
+#if defined(__SSE2__)
+    const auto lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const auto limit_lo = _mm_set1_ps((float)min_x);
+    const auto limit_hi = _mm_set1_ps((float)max_x);
+    const auto box_depth = _mm_set1_ps(nearest);
+    for (int x = min_x & ~3; x <= max_x; x += 4) {
+      const auto px = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+      const auto in_rect = _mm_and_ps(_mm_cmpge_ps(px, limit_lo),
+                                      _mm_cmple_ps(px, limit_hi));
+      // anything behind the box or at the same depth means it can be seen.
+      const auto uncovered =
+          _mm_and_ps(in_rect, _mm_cmpge_ps(_mm_loadu_ps(row + x), box_depth));
+      if (_mm_movemask_ps(uncovered) != 0) {
+        return true;
+      }
+    }
+#else
+    for (int x = min_x; x <= max_x; x++) {
+      if (row[x] >= nearest) {
+        return true;
+      }
+    }
+#endif
+  }
+  return false;
+}
@@ -0,0 +1,136 @@
+#include "../include/occlusion_queries.hpp"
+#include "../include/engine.hpp"
+#include "../include/mesh.hpp"
+#include "../include/renderer.hpp"
+
+GLenum OcclusionQueries::target() {
+  return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility
+             ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+             : GL_ANY_SAMPLES_PASSED;
+}
+
+OcclusionQueries::OcclusionQueries() {
+  // a unit cube, stretched over the bounds of whatever gets tested.
+  const float vertices[] = {0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0,
+                            0, 0, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1};
+  const uint8_t indices[] = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+                             0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+                             0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+  glGenVertexArrays(1, &box_vao);
+  glGenBuffers(1, &box_vertices);
+  glGenBuffers(1, &box_indices);
+  glBindVertexArray(box_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, box_vertices);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, box_indices);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), nullptr);
+  glEnableVertexAttribArray(0);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+OcclusionQueries::~OcclusionQueries() {
+  for (const auto &[id, _] : issued) {
+    glDeleteQueries(1, &id);
+  }
+  for (const auto &query : retiring) {
+    glDeleteQueries(1, &query.id);
+  }
+  glDeleteQueries(free_queries.size(), free_queries.data());
+  glDeleteVertexArrays(1, &box_vao);
+  glDeleteBuffers(1, &box_vertices);
+  glDeleteBuffers(1, &box_indices);
+}
+
+void OcclusionQueries::update(const size_t frame) {
+  finished = hidden = 0;
+  // true once the result is available, which doesn't wait on it.
+  const auto poll = [&](Query &query) {
+    if (query.measured) {
+      return true;
+    }
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      return false;
+    }
+    // we only look once a frame, so this is in whole frames. 0 means it was
+    // in before the frame it was issued in was over.
+    const auto latency = (float)(frame - query.issued_frame);
+    average_latency = average_latency * 0.95f + latency * 0.05f;
+    query.measured = true;
+    return true;
+  };
+  for (auto &[_, query] : issued) {
+    poll(query);
+  }
+  std::erase_if(retiring, [&](Query &query) {
+    if (!poll(query)) {
+      return false;
+    }
+    GLuint passed = 0;
+    glGetQueryObjectuiv(query.id, GL_QUERY_RESULT, &passed);
+    finished++;
+    hidden += passed == 0;
+    free_queries.push_back(query.id);
+    return true;
+  });
+}
+
+void OcclusionQueries::begin_tests(const mat4 &view_projection) {
+  if (!box_shader) {
+    box_shader = ShaderCache::get(
+        Engine::RESOURCE_DIR_PATH + "/shaders/gizmo_vert.glsl",
+        Engine::RESOURCE_DIR_PATH + "/shaders/gizmo_frag.glsl");
+  }
+  glUseProgram(box_shader->program_id);
+  glUniformMatrix4fv(box_shader->location(Uniform::ViewProjectionMatrix), 1,
+                     GL_FALSE, glm::value_ptr(view_projection));
+  glBindVertexArray(box_vao);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  // the back faces still count when the near plane cuts off the front ones.
+  glDisable(GL_CULL_FACE);
+  // box faces lying on the mesh's own surface shouldn't fail.
+  glDepthFunc(GL_LEQUAL);
+}
+void OcclusionQueries::end_tests() {
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMask(GL_TRUE);
+  glEnable(GL_CULL_FACE);
+  glDepthFunc(GL_LESS);
+}
+
+GLuint OcclusionQueries::test(const Mesh &mesh, const mat4 &transform,
+                              const size_t frame) {
+  GLuint query;
+  if (free_queries.empty()) {
+    glGenQueries(1, &query);
+    allocated_count++;
+  } else {
+    query = free_queries.back();
+    free_queries.pop_back();
+  }
+  issued[query] = {query, frame};
+
+  const auto extent = glm::max(mesh.bounds_max - mesh.bounds_min, vec3(1e-4f));
+  const auto box = transform *
+                   glm::scale(glm::translate(glm::identity<mat4>(),
+                                             mesh.bounds_min),
+                              extent);
+  glUniformMatrix4fv(box_shader->location(Uniform::ModelMatrix), 1, GL_FALSE,
+                     glm::value_ptr(box));
+  glBeginQuery(target(), query);
+  glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr);
+  glEndQuery(target());
+  return query;
+}
+void OcclusionQueries::release(const GLuint query) {
+  const auto it = issued.find(query);
+  if (it == issued.end()) {
+    return;
+  }
+  retiring.push_back(it->second);
+  issued.erase(it);
+}
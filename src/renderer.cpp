@@ -3,10 +3,10 @@
 #include "../include/engine.hpp"
 #include "../include/light.hpp"
 #include "../include/mesh.hpp"
+#include "../include/texture_streamer.hpp"
 #include "../thirdparty/imgui/imgui.h"
 #include "../thirdparty/imgui/imgui_impl_glfw.h"
 #include "../thirdparty/imgui/imgui_impl_opengl3.h"
-#include "../thirdparty/stb/stb_image.h"
 #include <GLFW/glfw3.h>
 #include <chrono>
 #include <iostream>
@@ -14,65 +14,135 @@
 #include <unistd.h>
 #include <vector>
 
-auto Gizmo::shader = make_shared<Shader>(
-    std::string(Engine::RESOURCE_DIR_PATH + "/shaders/gizmo_vert.glsl"),
-    std::string(Engine::RESOURCE_DIR_PATH + "/shaders/gizmo_frag.glsl"));
+bool GpuBuffer::reserve(const size_t required, const size_t element_size) {
+  if (required <= capacity) {
+    return false;
+  }
+  size_t new_capacity = std::max<size_t>(capacity, 1024);
+  while (new_capacity < required) {
+    new_capacity *= 2;
+  }
+  GLuint new_id;
+  glGenBuffers(1, &new_id);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, new_id);
+  glBufferData(GL_COPY_WRITE_BUFFER, new_capacity * element_size, nullptr,
+               GL_STATIC_DRAW);
+  if (count != 0) {
+    glBindBuffer(GL_COPY_READ_BUFFER, id);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        count * element_size);
+  }
+  glDeleteBuffers(1, &id);
+  id = new_id;
+  capacity = new_capacity;
+  return true;
+}
 
-void MeshBuffer::interleave_mesh(const shared_ptr<Mesh> &mesh) {
-  const size_t vertexCount = interleaved_data.size() / 8;
-  for (auto &index : mesh->indices) {
-    indices.push_back(index + vertexCount);
+void MeshBuffer::upload_mesh(const shared_ptr<Mesh> &mesh) {
+  if (mesh->uploaded) {
+    return;
   }
+  const auto packed = mesh->format == VertexFormat::Packed;
+  auto &pool = packed ? packed_vertices : vertices;
+  const auto stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+  const void *data = packed ? (const void *)mesh->packed_vertices.data()
+                            : (const void *)mesh->vertices.data();
+
+  // offsets into the index buffer have to be aligned to the index size.
+  const auto index_size = mesh->index_size();
+  const auto index_offset = (indices.count + index_size - 1) / index_size * index_size;
+  const auto index_bytes = mesh->index_count * index_size;
 
-  const auto mesh_vert_count = mesh->vertices.size() / 3;
-  for (size_t i = 0; i < mesh_vert_count; ++i) {
-    interleaved_data.push_back(mesh->vertices[i * 3]);
-    interleaved_data.push_back(mesh->vertices[i * 3 + 1]);
-    interleaved_data.push_back(mesh->vertices[i * 3 + 2]);
-    interleaved_data.push_back(mesh->texcoords[i * 2]);
-    interleaved_data.push_back(mesh->texcoords[i * 2 + 1]);
-    interleaved_data.push_back(mesh->normals[i * 3]);
-    interleaved_data.push_back(mesh->normals[i * 3 + 1]);
-    interleaved_data.push_back(mesh->normals[i * 3 + 2]);
+  auto grew = pool.reserve(pool.count + mesh->vertex_count, stride);
+  grew |= indices.reserve(index_offset + index_bytes, 1);
+  grew |= positions.reserve(positions.count + mesh->vertex_count, sizeof(vec3));
+  if (grew) {
+    // the vaos still point at the old buffers.
+    init();
   }
-}
 
-// VertexBuffer
-void MeshBuffer::update_data() {
-  // indices.clear();
-  // interleaved_data.clear();
+  glBindBuffer(GL_ARRAY_BUFFER, pool.id);
+  glBufferSubData(GL_ARRAY_BUFFER, pool.count * stride,
+                  mesh->vertex_count * stride, data);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  // for (const auto &mr : this->meshes) {
-  //   interleave_mesh(mr->mesh);
-  // }
+  // indices stay local to the mesh, we draw with a base vertex instead.
+  glBindBuffer(GL_COPY_WRITE_BUFFER, indices.id);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, index_offset, index_bytes,
+                  mesh->index_data());
 
-  glBindVertexArray(vao);
+  mesh->base_vertex = pool.count;
+  mesh->index_offset = index_offset;
+  mesh->position_base = positions.count;
+  mesh->uploaded = true;
+  pool.count += mesh->vertex_count;
+  indices.count = index_offset + index_bytes;
+  upload_positions(*mesh);
+  positions.count += mesh->vertex_count;
 
-  // Buffer the interleaved data
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, interleaved_data.size() * sizeof(float),
-               interleaved_data.data(), GL_STATIC_DRAW);
+  if (!mesh->keep_cpu_copy) {
+    mesh->release_cpu_data();
+  }
+}
 
-  // Buffer the indices
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-               indices.data(), GL_STATIC_DRAW);
+void MeshBuffer::overwrite_mesh(const shared_ptr<Mesh> &mesh) {
+  const auto packed = mesh->format == VertexFormat::Packed;
+  const auto stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+  const void *data = packed ? (const void *)mesh->packed_vertices.data()
+                            : (const void *)mesh->vertices.data();
+  glBindBuffer(GL_ARRAY_BUFFER, packed ? packed_vertices.id : vertices.id);
+  glBufferSubData(GL_ARRAY_BUFFER, mesh->base_vertex * stride,
+                  mesh->vertex_count * stride, data);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, indices.id);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, mesh->index_offset,
+                  mesh->index_count * mesh->index_size(), mesh->index_data());
+  upload_positions(*mesh);
+  if (!mesh->keep_cpu_copy) {
+    mesh->release_cpu_data();
+  }
+}
 
-  glBindVertexArray(0);
+void MeshBuffer::upload_positions(const Mesh &mesh) {
+  vector<vec3> mesh_positions(mesh.vertex_count);
+  for (size_t i = 0; i < mesh.vertex_count; i++) {
+    // decoded the same way vertex.glsl does, so shadows line up exactly.
+    mesh_positions[i] = mesh.format == VertexFormat::Packed
+                            ? mesh.unpack(mesh.packed_vertices[i]).position
+                            : mesh.vertices[i].position;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, positions.id);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, mesh.position_base * sizeof(vec3),
+                  mesh_positions.size() * sizeof(vec3), mesh_positions.data());
 }
 
 MeshBuffer::MeshBuffer() {
   glGenVertexArrays(1, &vao);
-  glGenBuffers(1, &vbo);
-  glGenBuffers(1, &ebo);
+  glGenVertexArrays(1, &packed_vao);
+  glGenVertexArrays(1, &shadow_vao);
+  glGenBuffers(1, &instance_vbo);
+  glGenBuffers(1, &shadow_instance_vbo);
+  glGenBuffers(1, &indirect_buffer);
+  glGenBuffers(1, &draw_data_buffer);
+  vertices.reserve(1, sizeof(Vertex));
+  packed_vertices.reserve(1, sizeof(PackedVertex));
+  indices.reserve(1, 1);
+  positions.reserve(1, sizeof(vec3));
   init();
 }
 
 MeshBuffer::~MeshBuffer() {
   glDeleteVertexArrays(1, &vao);
-  glDeleteBuffers(1, &vbo);
-  glDeleteBuffers(1, &vbo);
-  glDeleteBuffers(1, &ebo);
+  glDeleteVertexArrays(1, &packed_vao);
+  glDeleteVertexArrays(1, &shadow_vao);
+  glDeleteBuffers(1, &vertices.id);
+  glDeleteBuffers(1, &positions.id);
+  glDeleteBuffers(1, &shadow_instance_vbo);
+  glDeleteBuffers(1, &packed_vertices.id);
+  glDeleteBuffers(1, &indices.id);
+  glDeleteBuffers(1, &instance_vbo);
+  glDeleteBuffers(1, &indirect_buffer);
+  glDeleteBuffers(1, &draw_data_buffer);
   this->meshes.clear();
 }
 // Renderer
@@ -84,10 +154,14 @@ Renderer::Renderer(const char *title, const int h, const int w,
 
   // the vertex buffer can only be instantiated after GL context is initialized.
   mesh_buffer = new MeshBuffer();
-  gizmo_buffer = new GizmoBuffer();
+  frame_graph = new FrameGraph();
 }
 void Renderer::init_opengl() {
   glfwInit();
+  // the deferred path blits its D24S8 depth into the window's, which only
+  // works when the formats match.
+  glfwWindowHint(GLFW_DEPTH_BITS, 24);
+  glfwWindowHint(GLFW_STENCIL_BITS, 8);
   window = glfwCreateWindow(screenWidth, screenHeight, title, nullptr, nullptr);
   glfwMakeContextCurrent(window);
   glewExperimental = GL_TRUE;
@@ -97,15 +171,26 @@ void Renderer::init_opengl() {
   glEnable(GL_STATIC_DRAW);
   glfwSetFramebufferSizeCallback(window, resizeCallback);
   glfwSwapInterval(0); // unlimit framerate.
+  if (GLEW_KHR_parallel_shader_compile) {
+    // let the driver pick how many threads it compiles shaders on.
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  }
 }
 
 void Renderer::resizeCallback(GLFWwindow *window, int w, int h) {
   glViewport(0, 0, w, h);
+  auto &renderer = Engine::current().m_renderer;
+  renderer.screenWidth = w;
+  renderer.screenHeight = h;
 }
 
 Renderer::~Renderer() {
+  delete frame_graph;
   delete mesh_buffer;
-  delete gizmo_buffer;
+  DebugDraw::current().release();
+  // the cache lives on past the renderer, it's built by the engine's
+  // constructor.
+  ShaderCache::clear();
 
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
@@ -124,6 +209,9 @@ Renderer::~Renderer() {
 int Renderer::run() {
   while (!glfwWindowShouldClose(window)) {
     glfwPollEvents();
+    // swap in any shaders that were edited on disk, between frames.
+    ShaderCache::update();
+    TextureStreamer::current().update();
     const auto start = std::chrono::high_resolution_clock::now();
 
     const auto &scene = Engine::current().m_scene;
@@ -142,15 +230,16 @@ int Renderer::run() {
       continue;
     }
 
-    gizmo_buffer->update_data();
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glClearColor(cam->sky_color.x, cam->sky_color.y, cam->sky_color.z, 1.0f);
-
     const auto viewProjectionMatrix = cam->get_view_projection();
-    draw_meshes(viewProjectionMatrix);
-    draw_gizmos(viewProjectionMatrix);
-    draw_imgui();
+    const RenderView view = {
+        .view_projection = viewProjectionMatrix,
+        .view = cam->get_view(),
+        .projection = cam->get_projection(),
+        .position = scene.camera->get_position(),
+        .pixels_per_unit = screenHeight * 0.5f /
+                           tanf(glm::radians(cam->fovy) * 0.5f),
+    };
+    render_frame(view, cam->sky_color);
 
     glfwSwapBuffers(window);
     poll_metrics(start);
@@ -181,99 +270,196 @@ void Renderer::apply_lighting_uniforms(const shared_ptr<Shader> &shader,
   const auto light_intensity = light->intensity;
   const auto cast_shadows = light->cast_shadows;
 
-  const auto lightPositionLocation =
-      shader->uniform_locations.find("lightPosition");
-  const auto lightColorLocation = shader->uniform_locations.find("lightColor");
-  const auto lightRadiusLocation =
-      shader->uniform_locations.find("lightRadius");
-  const auto lightIntensityLocation =
-      shader->uniform_locations.find("lightIntensity");
-  const auto castShadowsLocation =
-      shader->uniform_locations.find("castShadows");
-
-  if (lightPositionLocation != shader->uniform_locations.end()) {
-    glUniform3fv(lightPositionLocation->second, 1,
-                 glm::value_ptr(light_position));
-  }
-
-  if (lightColorLocation != shader->uniform_locations.end()) {
-    glUniform3fv(lightColorLocation->second, 1, glm::value_ptr(light_color));
-  }
-
-  if (lightRadiusLocation != shader->uniform_locations.end()) {
-    glUniform1f(lightRadiusLocation->second, light_radius);
-  }
-
-  if (lightIntensityLocation != shader->uniform_locations.end()) {
-    glUniform1f(lightIntensityLocation->second, light_intensity);
-  }
-
-  if (castShadowsLocation != shader->uniform_locations.end()) {
-    glUniform1i(castShadowsLocation->second, cast_shadows);
+  // locations are -1 for uniforms the shader doesn't use, GL ignores those.
+  glUniform3fv(shader->location(Uniform::LightPosition), 1,
+               glm::value_ptr(light_position));
+  glUniform3fv(shader->location(Uniform::LightColor), 1,
+               glm::value_ptr(light_color));
+  glUniform1f(shader->location(Uniform::LightRadius), light_radius);
+  glUniform1f(shader->location(Uniform::LightIntensity), light_intensity);
+  glUniform1i(shader->location(Uniform::CastShadows), cast_shadows);
+  glUniform3fv(shader->location(Uniform::LightDirection), 1,
+               glm::value_ptr(glm::normalize(vec3(light_node->get_transform()[2]))));
+  glUniform1i(shader->location(Uniform::DirectionalLight), light->directional);
+  auto &mesh_buffer = *Engine::current().m_renderer.mesh_buffer;
+  mesh_buffer.light_clusters.apply_uniforms(*shader);
+  if (shader->features & SHADOWED) {
+    mesh_buffer.shadows.apply_uniforms(*shader);
   }
 }
-void Renderer::apply_uniforms(
-    const mat4 &viewProjectionMatrix,
-    const std::shared_ptr<MeshRenderer> &mesh_renderer) {
-
-  const auto material = mesh_renderer->material;
-  const auto shader_struct = material->shader;
-  const auto shader = shader_struct->program_id;
-  const auto uniforms = shader_struct->uniform_locations;
-  const auto texture = material->texture;
-  const auto node = mesh_renderer->node.lock();
-  const auto transform_matrix = node->get_transform();
+void Renderer::apply_material_uniforms(const mat4 &viewProjectionMatrix,
+                                       Material &material,
+                                       MaterialVariant &variant,
+                                       const Mesh &mesh) {
+  const auto &shader = variant.shader;
+  const auto &texture = material.texture;
 
-  glUseProgram(shader);
+  glUseProgram(shader->program_id);
 
   // SET TEXTURE UNIFORMS
   {
-    auto samplerLoc = uniforms.find("textureSampler");
-    const auto hasTextureLoc = uniforms.find("hasTexture");
-
-    if (samplerLoc != uniforms.end() && hasTextureLoc != uniforms.end() &&
-        texture.has_value()) {
-      glActiveTexture(GL_TEXTURE0);
-      glUniform1i(samplerLoc->second, 0);
-      glUniform1i(hasTextureLoc->second, 1);
-      glBindTexture(GL_TEXTURE_2D, texture.value()->texture);
+    glActiveTexture(GL_TEXTURE0);
+    if (texture.has_value() && (shader->features & TEXTURED)) {
+      glUniform1i(shader->location(Uniform::TextureSampler), 0);
+      glBindTexture(GL_TEXTURE_2D, texture.value()->handle());
     } else {
-      glActiveTexture(GL_TEXTURE0);
       glBindTexture(GL_TEXTURE_2D, 0);
-      glUniform1i(hasTextureLoc->second, 0);
+    }
+    if (shader->features & ATLASED) {
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, TextureAtlas::current().texture);
+      glUniform1i(shader->location(Uniform::AtlasSampler), 1);
+      glActiveTexture(GL_TEXTURE0);
     }
   }
-  // MESH & MATRIX UNIFORMS
+  // VIEW & VERTEX FORMAT UNIFORMS
   {
-    const auto colorLocation = uniforms.find("color");
-    const auto viewProjectionMatrixLocation =
-        uniforms.find("viewProjectionMatrix");
-    const auto modelMatrixLocation = uniforms.find("modelMatrix");
-
-    if (colorLocation != uniforms.end())
-      glUniform4fv(colorLocation->second, 1,
-                   glm::value_ptr(mesh_renderer->color));
-
-    if (viewProjectionMatrixLocation != uniforms.end())
-      glUniformMatrix4fv(viewProjectionMatrixLocation->second, 1, GL_FALSE,
-                         glm::value_ptr(viewProjectionMatrix));
-
-    if (modelMatrixLocation != uniforms.end())
-      glUniformMatrix4fv(modelMatrixLocation->second, 1, GL_FALSE,
-                         glm::value_ptr(transform_matrix));
+    glUniformMatrix4fv(shader->location(Uniform::ViewProjectionMatrix), 1,
+                       GL_FALSE, glm::value_ptr(viewProjectionMatrix));
+    glUniform3fv(shader->location(Uniform::PositionScale), 1,
+                 glm::value_ptr(mesh.position_scale()));
+    glUniform3fv(shader->location(Uniform::PositionOffset), 1,
+                 glm::value_ptr(mesh.position_offset()));
   }
 
-  apply_lighting_uniforms(mesh_renderer->material->shader, shader);
+  material.apply_parameters(variant);
+  // g-buffer variants are lit afterwards, by DeferredShading.
+  if ((shader->features & LIT) && !(shader->features & GBUFFER)) {
+    apply_lighting_uniforms(shader, shader->program_id);
+  }
+}
+mat3 normal_matrix(const mat4 &model) {
+  const auto basis = mat3(model);
+  const auto x = glm::length2(basis[0]), y = glm::length2(basis[1]),
+             z = glm::length2(basis[2]);
+  // with a rotation & uniform scale s the inverse transpose is just
+  // basis / s^2, so most objects never pay for the inverse. equal lengths
+  // alone aren't enough, a shear can keep them, so the columns have to be
+  // orthogonal too.
+  const auto epsilon = 1e-4f * x;
+  const auto orthogonal = std::abs(glm::dot(basis[0], basis[1])) <= epsilon &&
+                          std::abs(glm::dot(basis[0], basis[2])) <= epsilon &&
+                          std::abs(glm::dot(basis[1], basis[2])) <= epsilon;
+  if (std::abs(x - y) <= epsilon && std::abs(x - z) <= epsilon && x > 0.0f &&
+      orthogonal) {
+    return basis * (1.0f / x);
+  }
+  return glm::transpose(glm::inverse(basis));
 }
-void Renderer::draw_meshes(const mat4 &viewProjectionMatrix) const {
-  mesh_buffer->render(viewProjectionMatrix);
+void Renderer::apply_uniforms(const mat4 &viewProjectionMatrix,
+                              const MeshRenderer &mesh_renderer,
+                              MaterialVariant &variant,
+                              const DrawItem &draw) {
+  apply_material_uniforms(viewProjectionMatrix, *mesh_renderer.material,
+                          variant, *mesh_renderer.mesh);
+  const auto &shader = variant.shader;
+  glUniform4fv(shader->location(Uniform::Color), 1,
+               glm::value_ptr(mesh_renderer.color));
+  glUniformMatrix4fv(shader->location(Uniform::ModelMatrix), 1, GL_FALSE,
+                     glm::value_ptr(draw.transform));
+  glUniformMatrix3fv(shader->location(Uniform::NormalMatrix), 1, GL_FALSE,
+                     glm::value_ptr(draw.normal_matrix));
+  if (shader->features & ATLASED) {
+    const auto &slot = mesh_renderer.material->atlas_slot();
+    glUniform4fv(shader->location(Uniform::AtlasRect), 1,
+                 glm::value_ptr(slot.rect));
+    glUniform1f(shader->location(Uniform::AtlasLayer), slot.layer);
+  }
 }
+void Renderer::render_frame(const RenderView &view, const vec3 &sky_color) {
+  auto &graph = *frame_graph;
+  auto &buffer = *mesh_buffer;
+  graph.reset();
+  buffer.prepare(view);
+
+  const auto backbuffer =
+      graph.import("backbuffer", 0, vec4(sky_color, 1.0f));
+  graph.present(backbuffer);
+  // owned by ShadowMaps, only here so the pass gets culled when nothing
+  // samples them.
+  const auto shadow_maps = graph.import("shadow maps", 0);
+  const auto shadowed = buffer.shadows.enabled;
+  graph.add_pass(
+      "shadows", [&](PassBuilder &pass) { pass.write(shadow_maps); },
+      [&](FrameGraph &) { buffer.shadows.render(buffer, view); });
 
-void Renderer::draw_gizmos(const mat4 &viewProjectionMatrix) const {
-  gizmo_buffer->render(viewProjectionMatrix);
+  // a minimized window is 0x0, which no g-buffer can be. the setting stays,
+  // those frames are just drawn forward.
+  const auto deferred =
+      buffer.deferred.enabled && screenWidth > 0 && screenHeight > 0;
+  if (!deferred) {
+    graph.add_pass(
+        "forward",
+        [&](PassBuilder &pass) {
+          if (shadowed) {
+            pass.read(shadow_maps);
+          }
+          pass.write(backbuffer);
+        },
+        [&](FrameGraph &) { buffer.render_opaque(view, false); });
+  } else {
+    // the g-buffer only lives until the lighting pass is done with it.
+    FrameResource albedo, normal, depth;
+    // when the driver won't take it the lighting pass draws forward instead,
+    // for this frame only.
+    bool gbuffer_failed = false;
+    graph.add_pass(
+        "gbuffer",
+        [&](PassBuilder &pass) {
+          const auto desc = [&](const GLenum format) {
+            return TextureDesc{screenWidth, screenHeight, format};
+          };
+          albedo = pass.create("albedo", desc(DeferredShading::ALBEDO_FORMAT));
+          normal = pass.create("normal", desc(DeferredShading::NORMAL_FORMAT));
+          depth = pass.create("depth", desc(DeferredShading::DEPTH_FORMAT));
+        },
+        [&](FrameGraph &) {
+          const auto framebuffer = graph.framebuffer({albedo, normal, depth});
+          if (framebuffer == 0) {
+            gbuffer_failed = true;
+            return;
+          }
+          glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+          buffer.render_opaque(view, true);
+        });
+    graph.add_pass(
+        "lighting",
+        [&](PassBuilder &pass) {
+          pass.read(albedo);
+          pass.read(normal);
+          pass.read(depth);
+          if (shadowed) {
+            pass.read(shadow_maps);
+          }
+          pass.write(backbuffer);
+        },
+        [&](FrameGraph &) {
+          if (gbuffer_failed) {
+            buffer.render_opaque(view, false);
+            return;
+          }
+          const GBuffer gbuffer = {
+              .albedo = graph.texture(albedo),
+              .normal = graph.texture(normal),
+              .depth = graph.texture(depth),
+              .framebuffer = graph.framebuffer({albedo, normal, depth}),
+              .width = screenWidth,
+              .height = screenHeight,
+          };
+          buffer.deferred.light(buffer, view, gbuffer);
+        });
+  }
+  graph.add_pass(
+      "debug", [&](PassBuilder &pass) { pass.write(backbuffer); },
+      [&](FrameGraph &) { draw_debug(view.view_projection); });
+  graph.add_pass(
+      "imgui", [&](PassBuilder &pass) { pass.write(backbuffer); },
+      [&](FrameGraph &) { draw_imgui(); });
+  graph.execute();
 }
-void Renderer::add_gizmo(const Gizmo &gizmo) {
-  gizmo_buffer->gizmos.push_back(gizmo);
+
+void Renderer::draw_debug(const mat4 &viewProjectionMatrix) const {
+  DebugDraw::current().render(viewProjectionMatrix);
 }
 void Renderer::init_imgui() {
   // Setup Dear ImGui context
@@ -297,10 +483,156 @@ void Renderer::draw_imgui() {
   ImGui::NewFrame();
   auto &engine = Engine::current();
   engine.on_gui();
+  draw_stats();
   ImGui::Render();
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+void Renderer::draw_stats() {
+  const auto &stats = mesh_buffer->stats;
+  ImGui::Begin("Renderer");
+  ImGui::Text("draw calls : %zu", stats.draw_calls);
+  ImGui::Text("triangles : %zu / %zu", stats.triangles,
+              stats.full_detail_triangles);
+  if (stats.full_detail_triangles != 0) {
+    ImGui::Text("saved by lods : %.1f%%",
+                100.0f * (1.0f - (float)stats.triangles /
+                                     (float)stats.full_detail_triangles));
+  }
+  ImGui::Text("instanced objects : %zu", stats.instanced_objects);
+  ImGui::Checkbox("instancing", &mesh_buffer->instancing_enabled);
+  if (MeshBuffer::indirect_supported()) {
+    ImGui::Text("indirect objects : %zu", stats.indirect_objects);
+    ImGui::Checkbox("multi draw indirect", &mesh_buffer->indirect_enabled);
+  } else {
+    ImGui::Text("multi draw indirect : unsupported");
+  }
+  ImGui::Text("culled objects : %zu", stats.culled_objects);
+  ImGui::Checkbox("frustum culling", &mesh_buffer->culling_enabled);
+  const auto &occlusion = mesh_buffer->occlusion;
+  ImGui::Text("occluded objects : %zu", stats.occluded_objects);
+  ImGui::Text("occluders : %zu, %zu triangles", occlusion.occluder_count,
+              occlusion.triangle_count);
+  ImGui::Text("occlusion : %.3f ms raster, %.3f ms test", occlusion.raster_ms,
+              occlusion.test_ms);
+  ImGui::Checkbox("occlusion culling", &mesh_buffer->occlusion.enabled);
+  auto &queries = mesh_buffer->occlusion_queries;
+  ImGui::Text("occlusion queries : %zu objects, %zu in the pool",
+              stats.queried_objects, queries.allocated());
+  ImGui::Text("query results : %zu in, %zu hidden, %.2f frames latency",
+              queries.finished, queries.hidden, queries.average_latency);
+  ImGui::Checkbox("occlusion queries", &queries.enabled);
+  if (GpuCulling::supported() && mesh_buffer->indirect_enabled) {
+    auto &gpu_culling = mesh_buffer->gpu_culling;
+    ImGui::Checkbox("cull on the gpu", &gpu_culling.enabled);
+    ImGui::Checkbox("hi-z occlusion", &gpu_culling.hiz_enabled);
+    ImGui::Checkbox("validate gpu culling", &gpu_culling.validate);
+    if (gpu_culling.validate) {
+      ImGui::Text("validation errors : %zu", gpu_culling.validation_errors);
+    }
+  }
+  const auto &streamer = TextureStreamer::current();
+  ImGui::Text("streaming : %zu pending, %.2f mb last frame", streamer.pending(),
+              streamer.uploaded_bytes / (1024.0 * 1024.0));
+  auto &atlas = TextureAtlas::current();
+  ImGui::Text("atlas : %d layers, %.2f mb", atlas.layer_count,
+              atlas.gpu_bytes() / (1024.0 * 1024.0));
+  ImGui::Checkbox("atlas new textures", &atlas.enabled);
+  if (ImGui::TreeNode("textures", "textures : %.2f mb",
+                      Texture::total_gpu_bytes() / (1024.0 * 1024.0))) {
+    for (const auto &[path, texture] : Texture::cache) {
+      ImGui::Text("%s : %dx%d, %.2f mb", path.c_str(), texture->width,
+                  texture->height, texture->gpu_bytes / (1024.0 * 1024.0));
+    }
+    ImGui::TreePop();
+  }
+  // what the import did to each mesh.
+  if (ImGui::TreeNode("meshes", "meshes : %zu", Mesh::cache.size())) {
+    for (const auto &[key, mesh] : Mesh::cache) {
+      if (!ImGui::TreeNode(key.c_str(), "%s : %zu vertices", mesh->path.c_str(),
+                           mesh->vertex_count)) {
+        continue;
+      }
+      if (!mesh->lods.empty()) {
+        std::string triangles;
+        for (const auto &lod : mesh->lods) {
+          triangles += " " + std::to_string(lod.index_count / 3);
+        }
+        ImGui::Text("lods :%s triangles", triangles.c_str());
+      }
+      if (mesh->acmr.x != 0.0f) {
+        ImGui::Text("acmr : %.3f -> %.3f, atvr : %.3f -> %.3f", mesh->acmr.x,
+                    mesh->acmr.y, mesh->atvr.x, mesh->atvr.y);
+      }
+      if (mesh->format == VertexFormat::Packed) {
+        ImGui::Text("packing error : %.5f position, %.2f degrees normal",
+                    mesh->max_position_error, mesh->max_normal_error_degrees);
+      }
+      ImGui::TreePop();
+    }
+    ImGui::TreePop();
+  }
+  auto &static_batches = mesh_buffer->static_batches;
+  ImGui::Text("static batches : %zu, holding %zu objects",
+              static_batches.renderers.size(), static_batches.batched_count());
+  ImGui::Checkbox("static batching", &static_batches.enabled);
+  ImGui::Checkbox("lods", &mesh_buffer->lods_enabled);
+  ImGui::Checkbox("draw bounds", &mesh_buffer->draw_bounds);
+  auto &shadows = mesh_buffer->shadows;
+  ImGui::Text("shadows : %zu draw calls, %zu casters, %zu static redraws",
+              stats.shadow_draw_calls, stats.shadow_casters,
+              shadows.static_redraws);
+  ImGui::Checkbox("shadows", &shadows.enabled);
+  ImGui::Checkbox("cache static shadows", &shadows.cache_static);
+  auto &light_clusters = mesh_buffer->light_clusters;
+  ImGui::Text("lights : %zu in view, %zu cluster indices, %.3f ms",
+              light_clusters.visible_count, light_clusters.index_count,
+              light_clusters.cull_ms);
+  ImGui::Checkbox("clustered lights", &light_clusters.enabled);
+  auto &deferred = mesh_buffer->deferred;
+  ImGui::Checkbox("deferred shading", &deferred.enabled);
+  if (deferred.enabled) {
+    auto lighting = (int)deferred.lighting;
+    ImGui::RadioButton("clustered", &lighting, (int)DeferredLighting::Clustered);
+    ImGui::SameLine();
+    ImGui::RadioButton("light volumes", &lighting, (int)DeferredLighting::Volumes);
+    deferred.lighting = (DeferredLighting)lighting;
+  }
+  ImGui::Text("debug shapes : %zu", DebugDraw::current().instance_count);
+  ImGui::SliderFloat("lod threshold (px)", &mesh_buffer->lod_threshold, 0.1f,
+                     16.0f);
+  auto &graph = *frame_graph;
+  // gpu times are a few frames behind.
+  if (ImGui::BeginTable("passes", 5)) {
+    ImGui::TableSetupColumn("pass");
+    ImGui::TableSetupColumn("cpu ms");
+    ImGui::TableSetupColumn("gpu ms");
+    ImGui::TableSetupColumn("created");
+    ImGui::TableSetupColumn("clears");
+    ImGui::TableHeadersRow();
+    for (const auto &pass : graph.stats) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s%s", pass.name.c_str(), pass.culled ? " (culled)" : "");
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", pass.cpu_ms);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", pass.gpu_ms);
+      ImGui::TableNextColumn();
+      ImGui::Text("%zu", pass.created);
+      ImGui::TableNextColumn();
+      ImGui::Text("%zu", pass.clears);
+    }
+    ImGui::EndTable();
+  }
+  constexpr auto MB = 1024.0f * 1024.0f;
+  ImGui::Text("transients : %.2f MB requested, %.2f MB in %zu textures",
+              graph.requested_bytes / MB, graph.allocated_bytes / MB,
+              graph.pooled_textures);
+  ImGui::Checkbox("alias transients", &graph.aliasing);
+  ImGui::End();
+}
+
 Material::Material() {}
 
 YAML::Node Material::serialize() {
@@ -309,123 +641,775 @@ YAML::Node Material::serialize() {
   if (this->texture.has_value()) {
     out["texture"] = this->texture.value()->serialize();
   }
+  for (const auto &parameter : parameters) {
+    out["parameters"][parameter.name] = vec4_to_string(parameter.value);
+  }
+  if (!lit) {
+    out["lit"] = false;
+  }
   return out;
 }
+void Material::set_parameter(const std::string &name, const vec4 &value) {
+  for (auto &parameter : parameters) {
+    if (parameter.name == name) {
+      parameter.value = value;
+      return;
+    }
+  }
+  parameters.push_back({name, value});
+  // the new parameter needs a slot in every variant.
+  for (auto &[_, variant] : variants) {
+    variant.slots.push_back(variant.shader->find_uniform(name));
+  }
+}
+ShaderFeatures Material::features() const {
+  ShaderFeatures features = 0;
+  if (texture.has_value()) {
+    features |= TEXTURED;
+  }
+  if (lit) {
+    features |= LIT;
+  }
+  return features;
+}
+const AtlasSlot &Material::atlas_slot() const {
+  static const AtlasSlot none;
+  return atlased() ? texture.value()->atlas : none;
+}
+MaterialVariant &Material::variant(const ShaderFeatures draw_features) {
+  auto features = this->features() | draw_features;
+  if (features & ATLASED) {
+    features &= ~TEXTURED;
+  }
+  // nothing to shadow without lighting, or before it.
+  if (!(features & LIT) || (features & GBUFFER)) {
+    features &= ~SHADOWED;
+  }
+  auto it = variants.find(features);
+  if (it == variants.end()) {
+    it = variants.insert({features, {}}).first;
+    it->second.shader =
+        ShaderCache::get(shader->vertex_path, shader->frag_path, features);
+    // resolved on first use below.
+    it->second.generation = it->second.shader->generation - 1;
+  }
+  auto &variant = it->second;
+  // a hot reload can move uniforms around, look them up again.
+  if (variant.generation != variant.shader->generation) {
+    variant.slots.clear();
+    for (const auto &parameter : parameters) {
+      variant.slots.push_back(variant.shader->find_uniform(parameter.name));
+    }
+    variant.generation = variant.shader->generation;
+  }
+  return variant;
+}
+void Material::apply_parameters(MaterialVariant &variant) const {
+  for (size_t i = 0; i < parameters.size(); i++) {
+    const auto slot = variant.slots[i];
+    if (slot == -1) {
+      continue;
+    }
+    const auto &uniform = variant.shader->uniforms[slot];
+    const auto &value = parameters[i].value;
+    switch (uniform.type) {
+    case GL_FLOAT:
+      glUniform1f(uniform.location, value.x);
+      break;
+    case GL_FLOAT_VEC2:
+      glUniform2fv(uniform.location, 1, glm::value_ptr(value));
+      break;
+    case GL_FLOAT_VEC3:
+      glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+      break;
+    case GL_FLOAT_VEC4:
+      glUniform4fv(uniform.location, 1, glm::value_ptr(value));
+      break;
+    case GL_INT:
+    case GL_BOOL:
+    case GL_SAMPLER_2D:
+      glUniform1i(uniform.location, (int)value.x);
+      break;
+    default:
+      break;
+    }
+  }
+}
 void Material::deserialize(const YAML::Node &in) {
   auto &shader_node = in["shader"];
-  this->shader = make_shared<Shader>();
-  this->shader->deserialize(shader_node);
+  // every material in a scene usually shares the one shader, compile it once.
+  this->shader = ShaderCache::get(shader_node["vertex_path"].as<std::string>(),
+                                  shader_node["frag_path"].as<std::string>());
   if (in["texture"]) {
-    this->texture = make_shared<Texture>();
-    this->texture.value()->deserialize(in["texture"]);
+    this->texture = Texture::get(in["texture"]["path"].as<std::string>());
+  }
+  if (in["parameters"]) {
+    for (const auto &parameter : in["parameters"]) {
+      parameters.push_back(
+          {parameter.first.as<std::string>(),
+           string_to_vec4(parameter.second.as<std::string>())});
+    }
+  }
+  if (in["lit"]) {
+    lit = in["lit"].as<bool>();
   }
 }
 
-YAML::Node Texture::serialize() {
-  YAML::Node out;
-  out["path"] = this->path;
-  return out;
-}
-
-void Texture::deserialize(const YAML::Node &in) {
-  path = in["path"].as<std::string>();
-  load_texture(path);
-}
-void Texture::load_texture(const std::string &path) {
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
-
-  stbi_set_flip_vertically_on_load(true);
-  data = stbi_load(path.c_str(), &width, &height, &channel_count, 0);
+void MeshBuffer::init() {
+  // Set the vertex attributes pointers
+  {
+    const size_t stride = sizeof(Vertex);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertices.id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.id);
 
-  if (data) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-  } else {
-    std::cerr << "Failed to load texture: " << path << std::endl;
+    // vertex position
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(Vertex, position));
+    glEnableVertexAttribArray(0);
+    // texture coordinates
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(Vertex, texcoord));
+    glEnableVertexAttribArray(1);
+    // normals
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
   }
+  // packed vertices, vertex.glsl undoes the quantization.
+  {
+    const size_t stride = sizeof(PackedVertex);
+    glBindVertexArray(packed_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, packed_vertices.id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.id);
 
-  stbi_image_free(data);
+    // vertex position, normalized to [0, 1] within the mesh bounds.
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                          (void *)offsetof(PackedVertex, position));
+    glEnableVertexAttribArray(0);
+    // texture coordinates
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(PackedVertex, texcoord));
+    glEnableVertexAttribArray(1);
+    // octahedral normals in xy
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+                          (void *)offsetof(PackedVertex, normal));
+    glEnableVertexAttribArray(2);
+  }
+  // positions only for the shadow pass, with the model matrix per instance
+  // in 3-6 like the other two. see shadow_vert.glsl.
+  {
+    glBindVertexArray(shadow_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, positions.id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.id);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+    glEnableVertexAttribArray(0);
+    for (GLuint location = 3; location <= 6; location++) {
+      glEnableVertexAttribArray(location);
+      glVertexAttribDivisor(location, 1);
+    }
+    bind_shadow_instances(0);
+  }
+  // instance attributes, 3-6 for the model matrix's columns, 7 for the
+  // color, 8-10 for the normal matrix & 11-12 for the atlas slot. only
+  // INSTANCED variants read them, so they're left disabled & only enabled
+  // around instanced draws. enabled, every other draw would fetch them from
+  // whatever instance_vbo holds, which can be less than it reads.
+  for (const auto array : {vao, packed_vao}) {
+    glBindVertexArray(array);
+    for (GLuint location = 3; location <= 12; location++) {
+      glVertexAttribDivisor(location, 1);
+    }
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
-Texture::Texture(const std::string path) : path(path) { load_texture(path); }
-Texture::~Texture() { glDeleteTextures(1, &texture); }
-
-void MeshBuffer::init() {
-  // Set the vertex attributes pointers
-  const size_t stride = (3 + 2 + 3) * sizeof(float);
-
-  glBindVertexArray(vao);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-
-  // vertex position
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)0);
-  glEnableVertexAttribArray(0);
-  // texture coordinates
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-  // normals
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
-                        (void *)(5 * sizeof(float)));
-  glEnableVertexAttribArray(2);
-}
-void MeshBuffer::render(const mat4 &viewProjectionMatrix) const {
+void MeshBuffer::bind_instances(const size_t first_instance) const {
+  const auto offset = first_instance * sizeof(InstanceData);
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+  for (GLuint column = 0; column < 4; column++) {
+    glVertexAttribPointer(
+        3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+        (void *)(offset + offsetof(InstanceData, model) + column * sizeof(vec4)));
+  }
+  glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                        (void *)(offset + offsetof(InstanceData, color)));
+  for (GLuint column = 0; column < 3; column++) {
+    glVertexAttribPointer(
+        8 + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+        (void *)(offset + offsetof(InstanceData, normal) + column * sizeof(vec3)));
+  }
+  glVertexAttribPointer(11, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                        (void *)(offset + offsetof(InstanceData, atlas_rect)));
+  glVertexAttribPointer(12, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                        (void *)(offset + offsetof(InstanceData, atlas_layer)));
+}
+void MeshBuffer::enable_instances(const bool enabled) const {
+  for (GLuint location = 3; location <= 12; location++) {
+    if (enabled) {
+      glEnableVertexAttribArray(location);
+    } else {
+      glDisableVertexAttribArray(location);
+    }
+  }
+}
+void MeshBuffer::bind_shadow_instances(const size_t first_instance) const {
+  const auto offset = first_instance * sizeof(mat4);
+  glBindBuffer(GL_ARRAY_BUFFER, shadow_instance_vbo);
+  for (GLuint column = 0; column < 4; column++) {
+    glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(mat4),
+                          (void *)(offset + column * sizeof(vec4)));
+  }
+}
+// the mesh's bounding sphere in world space, radius scaled by the largest axis.
+static vec4 world_sphere(const Mesh &mesh, const mat4 &transform) {
+  const auto scale = std::max({glm::length(vec3(transform[0])),
+                               glm::length(vec3(transform[1])),
+                               glm::length(vec3(transform[2]))});
+  const auto center = vec3(transform * vec4(mesh.bounds_center(), 1.0f));
+  return vec4(center, mesh.bounds_radius() * scale);
+}
+size_t MeshBuffer::select_lod(const MeshRenderer &mesh_renderer,
+                              const mat4 &transform,
+                              const RenderView &view) const {
+  const auto &mesh = mesh_renderer.mesh;
+  const auto &lods = mesh->lods;
+  if (!lods_enabled || lods.size() < 2) {
+    return 0;
+  }
+  // bounding sphere in world space, scaled by the largest axis.
+  const auto scale = std::max({glm::length(vec3(transform[0])),
+                               glm::length(vec3(transform[1])),
+                               glm::length(vec3(transform[2]))});
+  const auto center = vec3(transform * vec4(mesh->bounds_center(), 1.0f));
+  const auto radius = mesh->bounds_radius() * scale;
+  const auto distance = glm::length(center - view.position) - radius;
+  if (distance <= 0.0f) {
+    return 0;
+  }
+  const auto projected_error = [&](size_t lod) {
+    return lods[lod].error * scale * view.pixels_per_unit / distance;
+  };
+  auto lod = std::min(mesh_renderer.lod, lods.size() - 1);
+  while (lod + 1 < lods.size() &&
+         projected_error(lod + 1) <= lod_threshold * (1.0f - lod_hysteresis)) {
+    lod++;
+  }
+  while (lod > 0 &&
+         projected_error(lod) > lod_threshold * (1.0f + lod_hysteresis)) {
+    lod--;
+  }
+  return lod;
+}
+void MeshBuffer::prepare(const RenderView &view) {
+  stats = {};
+  
+  indirect = indirect_enabled && indirect_supported();
+  gpu_culled =
+      indirect && culling_enabled && gpu_culling.enabled && GpuCulling::supported();
+  const auto frustum = frustum_planes(view.view_projection);
+  
+  // renderers outlive their node when it's dropped from the scene, and go
+  // with it here. batched ones come out of their batch on the update.
+  std::erase_if(meshes, [&](const shared_ptr<MeshRenderer> &renderer) {
+    if (!renderer->node.expired()) {
+      return false;
+    }
+    static_batches.dirty = static_batches.dirty || renderer->batched;
+    return true;
+  });
+  if (static_batches.dirty) {
+    static_batches.update(*this);
+    shadows.invalidate();
+  }
+  const auto batching = static_batches.enabled;
+  
+  draws.clear();
+  shadow_casters.clear();
+  const auto add_draw = [&](MeshRenderer &mesh_renderer, const mat4 &transform,
+                            const bool is_static) {
+    const auto &mesh = mesh_renderer.mesh;
+    if (mesh->lods.empty()) {
+      return;
+    }
+    // casters out of the camera's view still shadow what's in it, so they're
+    // kept before the frustum test, each shadow view culls them on its own.
+    shadow_casters.push_back({&mesh_renderer, transform,
+                              world_sphere(*mesh, transform), is_static});
+    if (culling_enabled && !gpu_culled) {
+      const auto &sphere = shadow_casters.back().sphere;
+      if (!sphere_in_frustum(frustum, vec3(sphere), sphere.w)) {
+        stats.culled_objects++;
+        return;
+      }
+    }
+    mesh_renderer.lod = select_lod(mesh_renderer, transform, view);
+    draws.push_back({&mesh_renderer, transform, normal_matrix(transform)});
+  };
+  for (const auto &mesh_renderer : meshes) {
+    if (batching && mesh_renderer->batched) {
+      continue;
+    }
+    const auto node = mesh_renderer->node.lock();
+    add_draw(*mesh_renderer, node->get_transform(), node->is_static());
+  }
+  if (batching) {
+    // already in world space.
+    for (const auto &batch : static_batches.renderers) {
+      add_draw(*batch, glm::identity<mat4>(), true);
+    }
+  }
+  // the shadow pass sets it again, if it isn't culled.
+  shadows.active = false;
+  light_clusters.update(view);
+  if (occlusion.enabled) {
+    cull_occluded(view);
+  }
+  if (draw_bounds) {
+    for (const auto &draw : draws) {
+      const auto &mesh = *draw.renderer->mesh;
+      const auto box = glm::scale(
+          glm::translate(draw.transform, mesh.bounds_center()),
+          mesh.bounds_max - mesh.bounds_min);
+      // static batches in green.
+      debug::box(box, draw.renderer->node.expired() ? vec4(0, 1, 0, 1)
+                                                    : vec4(1, 1, 0, 1));
+    }
+  }
+  queried_draws.clear();
+  if (occlusion_queries.enabled) {
+    std::erase_if(draws, [&](const DrawItem &draw) {
+      if (!draw.renderer->occlusion_query) {
+        return false;
+      }
+      queried_draws.push_back(draw);
+      return true;
+    });
+  }
+}
+void MeshBuffer::render_opaque(const RenderView &view, const bool gbuffer) {
   glEnable(GL_DEPTH_TEST);
   glPolygonMode(GL_FRONT, GL_FILL_NV);
-  size_t indexOffset = 0;
-  glBindVertexArray(vao);
-  for (const auto &mesh_renderer : meshes) {
-    const auto &indexCount = mesh_renderer->mesh->indices.size();
-    Renderer::apply_uniforms(viewProjectionMatrix, mesh_renderer);
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT,
-                   (const void *)indexOffset);
-    indexOffset = indexOffset + indexCount * sizeof(unsigned int);
+  pass_features = gbuffer ? GBUFFER : shadows.active ? SHADOWED : 0;
+  if (indirect) {
+    render_indirect(view, gpu_culled);
+  } else {
+    render_batched(view);
+  }
+  // after everything else, so the boxes are tested against all of it.
+  render_queried(view);
+  frame++;
+}
+void MeshBuffer::render_depth(const mat4 &view_projection,
+                              const ShadowCasters casters) {
+  const auto frustum = frustum_planes(view_projection);
+  shadow_draws.clear();
+  for (const auto &caster : shadow_casters) {
+    if ((casters == ShadowCasters::Static && !caster.is_static) ||
+        (casters == ShadowCasters::Dynamic && caster.is_static)) {
+      continue;
+    }
+    if (culling_enabled &&
+        !sphere_in_frustum(frustum, vec3(caster.sphere), caster.sphere.w)) {
+      continue;
+    }
+    shadow_draws.push_back({caster.renderer, caster.transform, mat3(1.0f)});
+  }
+  if (shadow_draws.empty()) {
+    return;
+  }
+  
+  // only the mesh matters without materials, so every group of those is one
+  // instanced draw. casters always draw full detail: the lods are picked for
+  // the camera, only for what's in view, and the cached static maps would keep
+  // whatever lod a caster had when they were drawn.
+  const auto group_key = [](const DrawItem &draw) {
+    return draw.renderer->mesh.get();
+  };
+  std::sort(shadow_draws.begin(), shadow_draws.end(),
+            [&](const DrawItem &a, const DrawItem &b) {
+              return group_key(a) < group_key(b);
+            });
+  shadow_instances.clear();
+  for (const auto &draw : shadow_draws) {
+    shadow_instances.push_back(draw.transform);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, shadow_instance_vbo);
+  glBufferData(GL_ARRAY_BUFFER, shadow_instances.size() * sizeof(mat4),
+               shadow_instances.data(), GL_STREAM_DRAW);
+  
+  glBindVertexArray(shadow_vao);
+  for (size_t first = 0, last; first < shadow_draws.size(); first = last) {
+    last = first + 1;
+    while (last < shadow_draws.size() &&
+           group_key(shadow_draws[last]) == group_key(shadow_draws[first])) {
+      last++;
+    }
+    const auto &mesh = *shadow_draws[first].renderer->mesh;
+    const auto &lod = mesh.lods.front();
+    bind_shadow_instances(first);
+    glDrawElementsInstancedBaseVertex(
+        GL_TRIANGLES, lod.index_count,
+        mesh.has_short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+        (const void *)(mesh.index_offset + lod.first_index * mesh.index_size()),
+        last - first, mesh.position_base);
+    stats.shadow_draw_calls++;
+  }
+  stats.shadow_casters += shadow_draws.size();
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void MeshBuffer::render_queried(const RenderView &view) {
+  if (queried_draws.empty()) {
+    occlusion_queries.update(frame);
+    return;
+  }
+  // the boxes for next frame first, that way a mesh never hides its own box.
+  occlusion_queries.begin_tests(view.view_projection);
+  vector<GLuint> previous_queries(queried_draws.size(), 0);
+  for (size_t i = 0; i < queried_draws.size(); i++) {
+    auto &renderer = *queried_draws[i].renderer;
+    // only a result from the frame right before says anything about now.
+    if (renderer.query != 0 && renderer.query_frame + 1 == frame) {
+      previous_queries[i] = renderer.query;
+    } else if (renderer.query != 0) {
+      occlusion_queries.release(renderer.query);
+    }
+    renderer.query = 0;
+    // with the camera inside the bounds the box can get clipped away, just
+    // draw it.
+    const auto sphere = world_sphere(*renderer.mesh, queried_draws[i].transform);
+    if (glm::length(vec3(sphere) - view.position) <= sphere.w) {
+      continue;
+    }
+    renderer.query = occlusion_queries.test(*renderer.mesh,
+                                            queried_draws[i].transform, frame);
+    renderer.query_frame = frame;
+  }
+  occlusion_queries.end_tests();
+  
+  GLuint bound_vao = 0;
+  for (size_t i = 0; i < queried_draws.size(); i++) {
+    const auto &draw = queried_draws[i];
+    const auto &renderer = *draw.renderer;
+    const auto &mesh = renderer.mesh;
+    const auto &lod = mesh->lods[renderer.lod];
+    const auto mesh_vao = mesh->format == VertexFormat::Packed ? packed_vao : vao;
+    if (mesh_vao != bound_vao) {
+      glBindVertexArray(mesh_vao);
+      bound_vao = mesh_vao;
+    }
+    ShaderFeatures format_features =
+        (mesh->format == VertexFormat::Packed ? PACKED_VERTICES : 0) |
+        pass_features;
+    if (renderer.material->atlased()) {
+      format_features |= ATLASED;
+    }
+    auto &variant = renderer.material->variant(format_features);
+    Renderer::apply_uniforms(view.view_projection, renderer, variant, draw);
+    
+    const auto previous = previous_queries[i];
+    if (previous != 0) {
+      // the gpu skips the draw if the box was hidden, or draws it anyway if
+      // the result isn't in yet. we never wait.
+      glBeginConditionalRender(previous, GL_QUERY_NO_WAIT);
+    }
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, lod.index_count,
+        mesh->has_short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+        (const void *)(mesh->index_offset + lod.first_index * mesh->index_size()),
+        mesh->base_vertex);
+    if (previous != 0) {
+      glEndConditionalRender();
+      occlusion_queries.release(previous);
+    }
+    stats.draw_calls++;
+    stats.queried_objects++;
+    stats.triangles += lod.index_count / 3;
+    stats.full_detail_triangles += mesh->lods[0].index_count / 3;
+  }
+  occlusion_queries.update(frame);
+}
+void MeshBuffer::cull_occluded(const RenderView &view) {
+  using clock = std::chrono::high_resolution_clock;
+  const auto milliseconds = [](const clock::duration duration) {
+    return std::chrono::duration<float, std::milli>(duration).count();
+  };
+  const auto start = clock::now();
+  occlusion.begin(view.view_projection);
+  for (const auto &draw : draws) {
+    if (draw.renderer->occluder) {
+      occlusion.add_occluder(*draw.renderer->mesh, draw.transform);
+    }
+  }
+  occlusion.rasterize();
+  const auto rasterized = clock::now();
+  occlusion.raster_ms = milliseconds(rasterized - start);
+  if (occlusion.triangle_count != 0) {
+    // occluders are always drawn, they'd mostly just hide themselves.
+    std::erase_if(draws, [&](const DrawItem &draw) {
+      if (draw.renderer->occluder ||
+          occlusion.visible(*draw.renderer->mesh, draw.transform)) {
+        return false;
+      }
+      stats.occluded_objects++;
+      return true;
+    });
+  }
+  occlusion.test_ms = milliseconds(clock::now() - rasterized);
+}
+bool MeshBuffer::indirect_supported() {
+  return GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters;
+}
+void MeshBuffer::render_batched(const RenderView &view) {
+  // line up everything that can share a draw, then state changes between
+  // the batches are as rare as they can be too.
+  const auto batch_key = [](const DrawItem &draw) {
+    const auto &renderer = *draw.renderer;
+    const auto &material = *renderer.material;
+    // materials that only differ by their slot in the atlas look the same to
+    // the shader, so they can share a batch.
+    const auto shared = material.atlased() && material.parameters.empty();
+    const void *identity =
+        shared ? (const void *)material.shader.get() : (const void *)&material;
+    return std::make_tuple(identity, material.features(), renderer.mesh.get(),
+                           renderer.lod);
+  };
+  std::sort(draws.begin(), draws.end(),
+            [&](const DrawItem &a, const DrawItem &b) {
+              return batch_key(a) < batch_key(b);
+            });
+  
+  // all the instance data for the frame goes up in one go.
+  instance_data.clear();
+  if (instancing_enabled) {
+    for (size_t first = 0, last; first < draws.size(); first = last) {
+      last = first + 1;
+      while (last < draws.size() && batch_key(draws[last]) == batch_key(draws[first])) {
+        last++;
+      }
+      if (last - first < min_instances) {
+        continue;
+      }
+      for (size_t i = first; i < last; i++) {
+        const auto &slot = draws[i].renderer->material->atlas_slot();
+        instance_data.push_back({draws[i].transform, draws[i].renderer->color,
+                                 draws[i].normal_matrix, slot.rect,
+                                 (float)slot.layer});
+      }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(InstanceData),
+                 instance_data.data(), GL_STREAM_DRAW);
+  }
+  
+  GLuint bound_vao = 0;
+  size_t next_instance = 0;
+  for (size_t first = 0, last; first < draws.size(); first = last) {
+    last = first + 1;
+    while (last < draws.size() && batch_key(draws[last]) == batch_key(draws[first])) {
+      last++;
+    }
+    const auto &renderer = *draws[first].renderer;
+    const auto &mesh = renderer.mesh;
+    const auto &lod = mesh->lods[renderer.lod];
+    const auto mesh_vao = mesh->format == VertexFormat::Packed ? packed_vao : vao;
+    if (mesh_vao != bound_vao) {
+      glBindVertexArray(mesh_vao);
+      bound_vao = mesh_vao;
+    }
+    ShaderFeatures format_features =
+        (mesh->format == VertexFormat::Packed ? PACKED_VERTICES : 0) |
+        pass_features;
+    if (renderer.material->atlased()) {
+      format_features |= ATLASED;
+    }
+    const auto index_type =
+        mesh->has_short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    const auto index_offset =
+        (const void *)(mesh->index_offset + lod.first_index * mesh->index_size());
+    const auto count = last - first;
+    
+    if (instancing_enabled && count >= min_instances) {
+      auto &variant = renderer.material->variant(format_features | INSTANCED);
+      Renderer::apply_material_uniforms(view.view_projection, *renderer.material,
+                                        variant, *mesh);
+      bind_instances(next_instance);
+      enable_instances(true);
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.index_count,
+                                        index_type, index_offset, count,
+                                        mesh->base_vertex);
+      enable_instances(false);
+      next_instance += count;
+      stats.draw_calls++;
+      stats.instanced_objects += count;
+    } else {
+      for (size_t i = first; i < last; i++) {
+        auto &variant = draws[i].renderer->material->variant(format_features);
+        Renderer::apply_uniforms(view.view_projection, *draws[i].renderer,
+                                 variant, draws[i]);
+        glDrawElementsBaseVertex(GL_TRIANGLES, lod.index_count, index_type,
+                                 index_offset, mesh->base_vertex);
+        stats.draw_calls++;
+      }
+    }
+    stats.triangles += count * lod.index_count / 3;
+    stats.full_detail_triangles += count * mesh->lods[0].index_count / 3;
   }
 }
 
-void MeshBuffer::erase_mesh(const MeshRenderer *mesh) {
-  // shared_ptr<MeshRenderer> renderer;
+void MeshBuffer::render_indirect(const RenderView &view, const bool gpu_culled) {
+  if (draws.empty()) {
+    return;
+  }
+  // everything a multi draw can't change between its commands: the vao, the
+  // index type, the program & the uniforms & textures that go with it.
+  // materials that only differ by their color or atlas slot end up together.
+  const auto bucket_key = [](const DrawItem &draw) {
+    const auto &material = *draw.renderer->material;
+    const auto &mesh = *draw.renderer->mesh;
+    const auto texture = material.texture.has_value() && !material.atlased()
+                             ? material.texture.value()->handle()
+                             : 0;
+    const void *parameters = material.parameters.empty() ? nullptr : &material;
+    return std::make_tuple(mesh.format, mesh.has_short_indices,
+                           material.shader.get(), material.features(),
+                           material.atlased(), texture, parameters);
+  };
+  std::sort(draws.begin(), draws.end(),
+            [&](const DrawItem &a, const DrawItem &b) {
+              return std::tuple_cat(bucket_key(a),
+                                    std::make_tuple(a.renderer->mesh.get())) <
+                     std::tuple_cat(bucket_key(b),
+                                    std::make_tuple(b.renderer->mesh.get()));
+            });
   
-  // int idx = -1;
-  // for (size_t i= 0; i < meshes.size();++i) {
-  //   if (meshes[i].get() == mesh) {
-  //     renderer = meshes[i];
-  //     idx = i;
-  //     break;
-  //   }
-  // }
+  commands.clear();
+  draw_data.clear();
+  cull_data.clear();
+  GLuint bucket = 0, bucket_first = 0;
+  for (size_t i = 0; i < draws.size(); i++) {
+    const auto &draw = draws[i];
+    const auto &renderer = *draw.renderer;
+    const auto &mesh = *renderer.mesh;
+    const auto &lod = mesh.lods[renderer.lod];
+    const auto &slot = renderer.material->atlas_slot();
+    if (i != 0 && bucket_key(draw) != bucket_key(draws[i - 1])) {
+      bucket++;
+      bucket_first = i;
+    }
+    commands.push_back({
+        .count = (GLuint)lod.index_count,
+        .instance_count = 1,
+        .first_index =
+            (GLuint)(mesh.index_offset / mesh.index_size() + lod.first_index),
+        .base_vertex = mesh.base_vertex,
+        .base_instance = 0,
+    });
+    draw_data.push_back({
+        .model = draw.transform,
+        .normal = {vec4(draw.normal_matrix[0], 0.0f),
+                   vec4(draw.normal_matrix[1], 0.0f),
+                   vec4(draw.normal_matrix[2], 0.0f)},
+        .color = renderer.color,
+        .atlas_rect = slot.rect,
+        .position_scale = vec4(mesh.position_scale(), 0.0f),
+        .position_offset = vec4(mesh.position_offset(), 0.0f),
+        .atlas_layer = (float)slot.layer,
+    });
+    cull_data.push_back({
+        .sphere = vec4(mesh.bounds_center(), mesh.bounds_radius()),
+        .bucket = bucket,
+        .bucket_first = bucket_first,
+    });
+    stats.triangles += lod.index_count / 3;
+    stats.full_detail_triangles += mesh.lods[0].index_count / 3;
+  }
+  const auto bucket_count = bucket + 1;
   
-  // if (!renderer || idx == -1) return;
+  // with gpu culling the compute shader writes the commands & draw data.
+  const auto counted = gpu_culled && GpuCulling::compaction_supported();
+  if (gpu_culled) {
+    gpu_culling.cull(commands, draw_data, cull_data, bucket_count,
+                     view.view_projection);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpu_culling.commands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu_culling.draws);
+    if (counted) {
+      glBindBuffer(GL_PARAMETER_BUFFER_ARB, gpu_culling.counts);
+    }
+    if (gpu_culling.validate) {
+      stats.culled_objects = draws.size() - gpu_culling.visible_count;
+    }
+  } else {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 commands.size() * sizeof(DrawElementsIndirectCommand),
+                 commands.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_data_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 draw_data.size() * sizeof(IndirectDrawData), draw_data.data(),
+                 GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, draw_data_buffer);
+  }
   
-  // auto it = std::ranges::find(meshes, renderer);
-  // meshes.erase(it);
-  // erase_interleaved_data(idx, renderer->mesh);
-  // refresh();  
-}
-
-void MeshBuffer::erase_interleaved_data(const size_t index,
-                                        const shared_ptr<Mesh> &mesh) {
-  const size_t vertexCount = interleaved_data.size() / 8;
-  const size_t mesh_vert_count = mesh->vertices.size() / 3;
-  const size_t start_pos = index * 8 * mesh_vert_count;
-
-  // Erase interleaved data
-  interleaved_data.erase(interleaved_data.begin() + start_pos,
-                         interleaved_data.begin() + start_pos +
-                             8 * mesh_vert_count);
-
-  // Adjust indices
-  auto it = std::remove_if(indices.begin(), indices.end(),
-                           [index, vertexCount, mesh_vert_count](size_t i) {
-                             return i >= index * vertexCount &&
-                                    i < (index + 1) * vertexCount;
-                           });
-  indices.erase(it, indices.end());
-}
-void MeshBuffer::refresh() {
-  interleaved_data.clear();
-  for (const auto &mr : meshes)
-    interleave_mesh(mr->mesh);
+  GLuint bound_vao = 0;
+  for (size_t first = 0, last; first < draws.size(); first = last) {
+    last = first + 1;
+    while (last < draws.size() &&
+           bucket_key(draws[last]) == bucket_key(draws[first])) {
+      last++;
+    }
+    const auto &renderer = *draws[first].renderer;
+    const auto &mesh = renderer.mesh;
+    const auto mesh_vao = mesh->format == VertexFormat::Packed ? packed_vao : vao;
+    if (mesh_vao != bound_vao) {
+      glBindVertexArray(mesh_vao);
+      bound_vao = mesh_vao;
+    }
+    ShaderFeatures features = INDIRECT | pass_features;
+    if (mesh->format == VertexFormat::Packed) {
+      features |= PACKED_VERTICES;
+    }
+    if (renderer.material->atlased()) {
+      features |= ATLASED;
+    }
+    auto &variant = renderer.material->variant(features);
+    Renderer::apply_material_uniforms(view.view_projection, *renderer.material,
+                                      variant, *mesh);
+    glUniform1i(variant.shader->location(Uniform::DrawOffset), first);
+    const auto index_type =
+        mesh->has_short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    const auto offset =
+        (const void *)(first * sizeof(DrawElementsIndirectCommand));
+    if (counted) {
+      // how many survived is only known on the gpu. 4.6 drivers don't have
+      // to advertise the extension, its entry point can be null there.
+      const auto count_offset = cull_data[first].bucket * sizeof(GLuint);
+      if (GLEW_VERSION_4_6) {
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, index_type, offset,
+                                         count_offset, last - first, 0);
+      } else {
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, index_type, offset,
+                                            count_offset, last - first, 0);
+      }
+    } else {
+      glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, offset,
+                                  last - first, 0);
+    }
+    stats.draw_calls++;
+    stats.indirect_objects += last - first;
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  
+  if (gpu_culled && gpu_culling.hiz_enabled) {
+    gpu_culling.build_hiz(view.view_projection);
+  }
+}
+
+void MeshBuffer::erase_mesh(const MeshRenderer *mesh) {
+  // meshes owns the renderers, so by the time one is destroyed it's already
+  // out of there. its query is all that's left to hand back.
+  if (mesh->query != 0) {
+    occlusion_queries.release(mesh->query);
+  }
 }
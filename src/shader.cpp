@@ -1,4 +1,8 @@
 #include "../include/shader.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <cstring>
 
 YAML::Node Shader::serialize() {
   YAML::Node out;
@@ -12,74 +16,438 @@ void Shader::deserialize(const YAML::Node &in) {
   compile_shader(vertex_path, frag_path);
 }
 
-void Shader::compile_shader(const std::string &vertex_path,
-                       const std::string &fragment_path) {
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  auto *vertexSource = read_file(vertex_path);
-  glShaderSource(vertexShader, 1, &vertexSource, NULL);
-  glCompileShader(vertexShader);
-  
-  delete[] vertexSource;
-  
+// puts our #defines right after the #version line, which has to come first.
+// some features need a newer glsl than the file asks for, min_version raises
+// the #version line to it.
+static std::string preprocess(const std::string &path,
+                              const vector<std::string> &defines,
+                              const int min_version = 0) {
+  auto *source = read_file(path);
+  if (!source) {
+    return "";
+  }
+  std::string out(source);
+  delete[] source;
+  const auto version = out.find("#version");
+  if (version != std::string::npos && min_version != 0) {
+    const auto number = out.find_first_of("0123456789", version);
+    const auto number_end = out.find_first_not_of("0123456789", number);
+    if (number != std::string::npos &&
+        std::stoi(out.substr(number, number_end - number)) < min_version) {
+      out.replace(number, number_end - number, std::to_string(min_version));
+    }
+  }
+  if (defines.empty()) {
+    return out;
+  }
+  std::string injected;
+  for (const auto &define : defines) {
+    injected += "#define " + define + "\n";
+  }
+  const auto line_end = version == std::string::npos ? 0 : out.find('\n', version);
+  const auto insert_at = line_end == std::string::npos ? out.size() : line_end + 1;
+  out.insert(insert_at, injected);
+  return out;
+}
+
+// the glsl version the defines need at least, 0 if the file's own is fine.
+// goes by the define so hand written ones get it too.
+static int glsl_version(const vector<std::string> &defines) {
+  const auto indirect = std::find(defines.begin(), defines.end(), "INDIRECT");
+  return indirect != defines.end() ? 430 : 0;
+}
+
+static bool check_stage(const GLuint shader, const char *name,
+                        std::string &error) {
   GLint success;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  if (success) {
+    return true;
+  }
   GLchar infoLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-              << infoLog << std::endl;
+  glGetShaderInfoLog(shader, 512, NULL, infoLog);
+  error += std::string("ERROR::SHADER::") + name + "::COMPILATION_FAILED\n" +
+           infoLog + "\n";
+  return false;
+}
+bool ShaderBuild::is_complete() const {
+  if (from_binary || !GLEW_KHR_parallel_shader_compile) {
+    return true;
   }
+  GLint complete = GL_FALSE;
+  glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+  return complete == GL_TRUE;
+}
+ShaderBuild Shader::begin_compile() const {
+  ShaderBuild build;
+  const auto vertex_source =
+      preprocess(vertex_path, defines, glsl_version(defines));
+  const auto fragment_source =
+      is_compute() ? "" : preprocess(frag_path, defines, glsl_version(defines));
+  build.binary_key = ShaderCache::binary_key(vertex_source, fragment_source);
   
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  auto *fragmentSource = read_file(fragment_path);
-  glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
-  glCompileShader(fragmentShader);
+  build.program = ShaderCache::load_program_binary(build.binary_key);
+  if (build.program != 0) {
+    build.from_binary = true;
+    return build;
+  }
   
-  delete[] fragmentSource;
+  // none of these block: the driver is free to do the work whenever, and we
+  // don't ask for a status until the build is complete.
+  build.vertex =
+      glCreateShader(is_compute() ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER);
+  const auto *vertexSource = vertex_source.c_str();
+  glShaderSource(build.vertex, 1, &vertexSource, NULL);
+  glCompileShader(build.vertex);
   
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+  build.program = glCreateProgram();
+  glAttachShader(build.program, build.vertex);
+  if (!is_compute()) {
+    build.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+    const auto *fragmentSource = fragment_source.c_str();
+    glShaderSource(build.fragment, 1, &fragmentSource, NULL);
+    glCompileShader(build.fragment);
+    glAttachShader(build.program, build.fragment);
+  }
+  glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                      GL_TRUE);
+  glLinkProgram(build.program);
+  return build;
+}
+bool Shader::finish_compile(ShaderBuild &build, std::string &error) {
+  auto success = build.from_binary;
+  if (!build.from_binary) {
+    success = is_compute()
+                  ? check_stage(build.vertex, "COMPUTE", error)
+                  : check_stage(build.vertex, "VERTEX", error) &
+                        check_stage(build.fragment, "FRAGMENT", error);
+    GLint linked;
+    glGetProgramiv(build.program, GL_LINK_STATUS, &linked);
+    if (success && !linked) {
+      GLchar infoLog[512];
+      glGetProgramInfoLog(build.program, 512, NULL, infoLog);
+      error += std::string("ERROR::SHADER::PROGRAM::LINKING_FAILED\n") +
+               infoLog + "\n";
+    }
+    success = success && linked;
+    glDeleteShader(build.vertex);
+    glDeleteShader(build.fragment);
+  }
   if (!success) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-              << infoLog << std::endl;
+    glDeleteProgram(build.program);
+    return false;
   }
+  if (!build.from_binary) {
+    ShaderCache::save_program_binary(build.binary_key, build.program);
+  }
+  if (program_id != 0) {
+    glDeleteProgram(program_id);
+  }
+  program_id = build.program;
+  generation++;
+  reflect_uniforms();
+  return true;
+}
+bool Shader::compile_shader(const std::string &vertex_path,
+                       const std::string &fragment_path) {
+  this->vertex_path = vertex_path;
+  this->frag_path = fragment_path;
+  auto build = begin_compile();
+  std::string error;
+  if (!finish_compile(build, error)) {
+    cout << vertex_path << " / " << fragment_path << " :\n"
+         << error << std::endl;
+    return false;
+  }
+  return true;
+}
+// must match the order of the Uniform enum.
+static const std::array<const char *, (size_t)Uniform::Count> engine_uniform_names = {
+    "viewProjectionMatrix", "modelMatrix",    "normalMatrix",
+    "color",                "lightPosition",  "lightColor",
+    "lightRadius",          "lightIntensity", "castShadows",
+    "textureSampler",       "positionScale",  "positionOffset",
+    "atlasSampler",         "atlasRect",      "atlasLayer",
+    "drawOffset",           "lightDirection", "directionalLight",
+    "shadowCascades",       "shadowCube",     "shadowMatrices",
+    "shadowFar",            "clusteredLights", "clusterLights",
+    "clusterGrid",          "clusterIndices", "viewMatrix",
+    "clusterScale",         "gbufferAlbedo",  "gbufferNormal",
+    "gbufferDepth",         "inverseViewProjection", "cameraPosition"};
+
+// must match the bit order of ShaderFeature.
+static const std::array<const char *, SHADER_FEATURE_COUNT> feature_names = {
+    "TEXTURED", "LIT", "SHADOWED", "INSTANCED", "PACKED_VERTICES", "ATLASED",
+    "INDIRECT", "GBUFFER"};
+
+vector<std::string> shader_feature_defines(const ShaderFeatures features) {
+  vector<std::string> defines;
+  for (size_t i = 0; i < feature_names.size(); i++) {
+    if (features & (1 << i)) {
+      defines.push_back(feature_names[i]);
+    }
+  }
+  return defines;
+}
+
+void Shader::reflect_uniforms() {
+  uniforms.clear();
+  uniform_blocks.clear();
+  engine_uniforms.fill(-1);
   
-  program_id = glCreateProgram();
-  glAttachShader(program_id, vertexShader);
-  glAttachShader(program_id, fragmentShader);
-  glLinkProgram(program_id);
+  GLint count = 0, max_length = 0;
+  glGetProgramiv(program_id, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+  vector<GLchar> name(std::max(max_length, 1));
   
-  glGetProgramiv(program_id, GL_LINK_STATUS, &success);
-  if (!success) {
-    glGetProgramInfoLog(program_id, 512, NULL, infoLog);
-    cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-              << infoLog << std::endl;
+  uniforms.resize(count);
+  for (GLuint i = 0; i < (GLuint)count; i++) {
+    auto &uniform = uniforms[i];
+    GLsizei length = 0;
+    glGetActiveUniform(program_id, i, name.size(), &length, &uniform.size,
+                       &uniform.type, name.data());
+    uniform.name = std::string(name.data(), length);
+    // arrays are reported as "name[0]", we want to look them up by "name".
+    if (uniform.name.ends_with("[0]")) {
+      uniform.name.resize(uniform.name.size() - 3);
+    }
+    glGetActiveUniformsiv(program_id, 1, &i, GL_UNIFORM_BLOCK_INDEX,
+                          &uniform.block_index);
+    if (uniform.block_index == -1) {
+      uniform.location = glGetUniformLocation(program_id, name.data());
+    } else {
+      glGetActiveUniformsiv(program_id, 1, &i, GL_UNIFORM_OFFSET,
+                            &uniform.block_offset);
+    }
   }
   
+  GLint block_count = 0;
+  glGetProgramiv(program_id, GL_ACTIVE_UNIFORM_BLOCKS, &block_count);
+  uniform_blocks.resize(block_count);
+  for (GLuint i = 0; i < (GLuint)block_count; i++) {
+    auto &block = uniform_blocks[i];
+    block.index = i;
+    GLint length = 0;
+    glGetActiveUniformBlockiv(program_id, i, GL_UNIFORM_BLOCK_NAME_LENGTH,
+                              &length);
+    vector<GLchar> block_name(std::max(length, 1));
+    glGetActiveUniformBlockName(program_id, i, block_name.size(), nullptr,
+                                block_name.data());
+    block.name = block_name.data();
+    glGetActiveUniformBlockiv(program_id, i, GL_UNIFORM_BLOCK_DATA_SIZE,
+                              &block.size);
+    glGetActiveUniformBlockiv(program_id, i, GL_UNIFORM_BLOCK_BINDING,
+                              &block.binding);
+  }
   
-  
-  // get uniform locations
-  // add new uniforms here if your shader calls for it.
-  static const auto uniforms = std::vector<std::string>{
-      "viewProjectionMatrix", "modelMatrix", "color",
-      "lightPosition",        "lightColor",  "lightRadius",
-      "lightIntensity",       "castShadows", "hasTexture",
-      "textureSampler"};
-  glUseProgram(program_id);
-  for (auto i = 0; i < uniforms.size(); i++) {
-    const auto uniform_path = uniforms[i].c_str();
-    const auto location = glGetUniformLocation(program_id, uniform_path);
-    if (location != -1)
-      uniform_locations[uniforms[i]] = location;
-    else  {
-      //cout << "shader : " << fragment_path << "uniform : " << uniform_path << "not found" << std::endl;
+  for (size_t i = 0; i < engine_uniform_names.size(); i++) {
+    const auto index = find_uniform(engine_uniform_names[i]);
+    if (index != -1) {
+      engine_uniforms[i] = uniforms[index].location;
     }
   }
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
 }
-Shader::Shader(const std::string vertex_path, const std::string fragment_path)
-    : vertex_path(vertex_path), frag_path(fragment_path) {
+int Shader::find_uniform(const std::string &name) const {
+  for (size_t i = 0; i < uniforms.size(); i++) {
+    if (uniforms[i].name == name) {
+      return i;
+    }
+  }
+  return -1;
+}
+Shader::Shader(const std::string vertex_path, const std::string fragment_path,
+               const vector<std::string> &defines)
+    : vertex_path(vertex_path), frag_path(fragment_path), defines(defines) {
+  // a first compile that fails never gets as far as reflecting them.
+  engine_uniforms.fill(-1);
   compile_shader(vertex_path, fragment_path);
 }
-Shader::~Shader() { glDeleteProgram(program_id); }
\ No newline at end of file
+Shader::~Shader() { glDeleteProgram(program_id); }
+
+// ShaderCache
+std::string ShaderCache::directory = ".shader_cache";
+std::unique_ptr<FileWatcher> ShaderCache::watcher = nullptr;
+
+unordered_map<std::string, shared_ptr<Shader>> &ShaderCache::shaders() {
+  static unordered_map<std::string, shared_ptr<Shader>> shaders;
+  return shaders;
+}
+vector<std::pair<weak_ptr<Shader>, ShaderBuild>> &ShaderCache::pending() {
+  static vector<std::pair<weak_ptr<Shader>, ShaderBuild>> pending;
+  return pending;
+}
+
+shared_ptr<Shader> ShaderCache::get(const std::string &vertex_path,
+                                    const std::string &frag_path,
+                                    const vector<std::string> &defines) {
+  auto key = vertex_path + "|" + frag_path;
+  for (const auto &define : defines) {
+    key += "|" + define;
+  }
+  auto it = shaders().find(key);
+  if (it != shaders().end()) {
+    return it->second;
+  }
+  auto shader = make_shared<Shader>(vertex_path, frag_path, defines);
+  shaders()[key] = shader;
+  
+  if (!watcher) {
+    watcher = std::make_unique<FileWatcher>();
+  }
+  for (const auto &path : {vertex_path, frag_path}) {
+    if (path.empty()) {
+      continue;
+    }
+    watcher->watch_directory(
+        std::filesystem::path(path).parent_path().string());
+  }
+  return shader;
+}
+shared_ptr<Shader> ShaderCache::get(const std::string &vertex_path,
+                                    const std::string &frag_path,
+                                    const ShaderFeatures features) {
+  auto shader = get(vertex_path, frag_path, shader_feature_defines(features));
+  shader->features = features;
+  return shader;
+}
+shared_ptr<Shader> ShaderCache::get_compute(const std::string &path,
+                                            const vector<std::string> &defines) {
+  return get(path, "", defines);
+}
+static void discard(const ShaderBuild &build) {
+  glDeleteShader(build.vertex);
+  glDeleteShader(build.fragment);
+  glDeleteProgram(build.program);
+}
+static bool same_file(const std::string &a, const std::string &b) {
+  return std::filesystem::path(a).lexically_normal() ==
+         std::filesystem::path(b).lexically_normal();
+}
+void ShaderCache::reload(const std::string &path) {
+  for (const auto &[_, shader] : shaders()) {
+    if (!same_file(shader->vertex_path, path) &&
+        !same_file(shader->frag_path, path)) {
+      continue;
+    }
+    // a newer edit supersedes a build that's still in flight.
+    std::erase_if(pending(), [&](auto &entry) {
+      if (entry.first.lock() != shader) {
+        return false;
+      }
+      discard(entry.second);
+      return true;
+    });
+    pending().push_back({shader, shader->begin_compile()});
+  }
+}
+void ShaderCache::update() {
+  if (watcher) {
+    for (const auto &path : watcher->poll_changes()) {
+      reload(path);
+    }
+  }
+  std::erase_if(pending(), [](auto &entry) {
+    auto &[weak_shader, build] = entry;
+    if (!build.is_complete()) {
+      return false;
+    }
+    auto shader = weak_shader.lock();
+    if (!shader) {
+      discard(build);
+      return true;
+    }
+    std::string error;
+    if (shader->finish_compile(build, error)) {
+      cout << "reloaded shader : " << shader->vertex_path << " / "
+           << shader->frag_path << std::endl;
+    } else {
+      cout << "shader reload failed, keeping the previous program : "
+           << shader->vertex_path << " / " << shader->frag_path << "\n"
+           << error << std::endl;
+    }
+    return true;
+  });
+}
+void ShaderCache::clear() {
+  for (const auto &[_, build] : pending()) {
+    discard(build);
+  }
+  pending().clear();
+  shaders().clear();
+  watcher = nullptr;
+}
+bool ShaderCache::binaries_supported() {
+  static const bool supported = [] {
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+  }();
+  return supported;
+}
+std::string ShaderCache::binary_key(const std::string &vertex_source,
+                                    const std::string &frag_source) {
+  // 64 bit fnv-1a, we only need to tell versions of our own sources apart.
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const auto feed = [&hash](const std::string &data) {
+    for (const unsigned char c : data) {
+      hash = (hash ^ c) * 0x100000001b3ull;
+    }
+    hash = (hash ^ 0xff) * 0x100000001b3ull;
+  };
+  feed(vertex_source);
+  feed(frag_source);
+  for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    const auto *value = (const char *)glGetString(name);
+    feed(value ? value : "");
+  }
+  std::stringstream out;
+  out << std::hex << hash;
+  return out.str();
+}
+GLuint ShaderCache::load_program_binary(const std::string &key) {
+  if (!binaries_supported()) {
+    return 0;
+  }
+  const auto path = directory + "/" + key + ".bin";
+  if (!file_exists(path)) {
+    return 0;
+  }
+  const auto data = read_binary_file(path);
+  GLenum format;
+  if (data.size() <= sizeof(format)) {
+    return 0;
+  }
+  std::memcpy(&format, data.data(), sizeof(format));
+  
+  const auto program = glCreateProgram();
+  glProgramBinary(program, format, data.data() + sizeof(format),
+                  data.size() - sizeof(format));
+  GLint success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // the driver can reject binaries whenever it likes, we just recompile.
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+void ShaderCache::save_program_binary(const std::string &key,
+                                      const GLuint program) {
+  if (!binaries_supported()) {
+    return;
+  }
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  GLenum format;
+  vector<char> data(sizeof(format) + length);
+  glGetProgramBinary(program, length, nullptr, &format,
+                     data.data() + sizeof(format));
+  std::memcpy(data.data(), &format, sizeof(format));
+  
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  write_binary_file(directory + "/" + key + ".bin", data);
+}
@@ -0,0 +1,221 @@
+#include "../include/shadows.hpp"
+#include "../include/engine.hpp"
+#include "../include/light.hpp"
+#include "../include/renderer.hpp"
+
+static GLuint create_depth_texture(const GLenum target, const int resolution) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(target, texture);
+  if (target == GL_TEXTURE_CUBE_MAP) {
+    for (int face = 0; face < 6; face++) {
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0,
+                   GL_DEPTH_COMPONENT24, resolution, resolution, 0,
+                   GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    }
+  } else {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution,
+                 resolution, ShadowMaps::CASCADE_COUNT, 0, GL_DEPTH_COMPONENT,
+                 GL_FLOAT, nullptr);
+  }
+  // linear with a compare mode gets us 2x2 pcf from the hardware.
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(target, 0);
+  return texture;
+}
+
+ShadowMaps::~ShadowMaps() {
+  const GLuint textures[] = {cascades, static_cascades, cube, static_cube};
+  for (const auto texture : textures) {
+    if (texture != 0) {
+      glDeleteTextures(1, &texture);
+    }
+  }
+  if (fbo != 0) {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteFramebuffers(1, &copy_fbo);
+  }
+}
+
+void ShadowMaps::allocate() {
+  if (fbo == 0) {
+    glGenFramebuffers(1, &fbo);
+    glGenFramebuffers(1, &copy_fbo);
+    // depth only.
+    for (const auto framebuffer : {fbo, copy_fbo}) {
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+      glDrawBuffer(GL_NONE);
+      glReadBuffer(GL_NONE);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    depth_shader = ShaderCache::get(
+        Engine::RESOURCE_DIR_PATH + "/shaders/shadow_vert.glsl",
+        Engine::RESOURCE_DIR_PATH + "/shaders/shadow_frag.glsl");
+    distance_shader = ShaderCache::get(
+        Engine::RESOURCE_DIR_PATH + "/shaders/shadow_vert.glsl",
+        Engine::RESOURCE_DIR_PATH + "/shaders/shadow_frag.glsl",
+        vector<std::string>{"DISTANCE"});
+  }
+  // only the kind the light needs, made again when the resolution changes.
+  if (directional && allocated_cascade_resolution != cascade_resolution) {
+    glDeleteTextures(1, &cascades);
+    glDeleteTextures(1, &static_cascades);
+    cascades = create_depth_texture(GL_TEXTURE_2D_ARRAY, cascade_resolution);
+    static_cascades = create_depth_texture(GL_TEXTURE_2D_ARRAY, cascade_resolution);
+    allocated_cascade_resolution = cascade_resolution;
+    invalidate();
+  }
+  if (!directional && allocated_cube_resolution != cube_resolution) {
+    glDeleteTextures(1, &cube);
+    glDeleteTextures(1, &static_cube);
+    cube = create_depth_texture(GL_TEXTURE_CUBE_MAP, cube_resolution);
+    static_cube = create_depth_texture(GL_TEXTURE_CUBE_MAP, cube_resolution);
+    allocated_cube_resolution = cube_resolution;
+    invalidate();
+  }
+}
+
+void ShadowMaps::attach(const GLuint target_fbo, const GLuint texture,
+                        const int layer, const bool is_cube) const {
+  glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+  if (is_cube) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                           GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer, texture, 0);
+  } else {
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0,
+                              layer);
+  }
+}
+
+void ShadowMaps::render(MeshBuffer &buffer, const RenderView &view) {
+  active = false;
+  const auto light_node = Engine::current().m_scene.light;
+  if (!enabled || !light_node) {
+    return;
+  }
+  const auto light = light_node->get_component<Light>();
+  if (!light || !light->cast_shadows) {
+    return;
+  }
+  if (directional != light->directional) {
+    directional = light->directional;
+    invalidate();
+  }
+  allocate();
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  // open meshes like the floor still have to cast, so nothing gets culled.
+  // the offset keeps surfaces from shadowing themselves.
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+
+  if (directional) {
+    const auto to_light = glm::normalize(vec3(light_node->get_transform()[2]));
+    const auto up = std::abs(to_light.y) > 0.99f ? vec3(0, 0, 1) : vec3(0, 1, 0);
+    const auto rotation = glm::lookAt(vec3(0), -to_light, up);
+    const auto inverse_rotation = glm::inverse(rotation);
+    // clip space to [0, 1] texture space.
+    const auto bias = glm::scale(glm::translate(glm::identity<mat4>(), vec3(0.5f)),
+                                 vec3(0.5f));
+    glViewport(0, 0, cascade_resolution, cascade_resolution);
+    glUseProgram(depth_shader->program_id);
+    for (int i = 0; i < CASCADE_COUNT; i++) {
+      const auto radius =
+          shadow_distance * std::pow(0.25f, (float)(CASCADE_COUNT - 1 - i));
+      // snapped in light space, so a cascade only moves (and its static map
+      // only gets redrawn) every quarter of its radius. rotating the camera
+      // doesn't move them at all.
+      const auto step = radius * 0.25f;
+      const auto snapped = glm::floor(vec3(rotation * vec4(view.position, 1.0f)) / step) * step;
+      const auto center = vec3(inverse_rotation * vec4(snapped, 1.0f));
+      const auto extent = radius + step;
+      const auto eye = center + to_light * (extent + caster_distance);
+      const auto projection = glm::ortho(-extent, extent, -extent, extent, 0.0f,
+                                         2.0f * extent + caster_distance);
+      const auto view_projection = projection * glm::lookAt(eye, center, up);
+      cascade_matrices[i] = bias * view_projection;
+      render_view(buffer, i, view_projection, false);
+    }
+  } else {
+    const auto position = light_node->get_position();
+    // the attenuation has dropped to about 5% by here.
+    far_plane = light->range * 20.0f;
+    const auto projection =
+        glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, far_plane);
+    // the faces in GL's cube map order, with the ups it expects.
+    const vec3 directions[6] = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                                {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+    const vec3 ups[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1},
+                         {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+    glViewport(0, 0, cube_resolution, cube_resolution);
+    glUseProgram(distance_shader->program_id);
+    glUniform3fv(distance_shader->location(Uniform::LightPosition), 1,
+                 glm::value_ptr(position));
+    glUniform1f(distance_shader->location(Uniform::ShadowFar), far_plane);
+    for (int face = 0; face < 6; face++) {
+      const auto view_projection =
+          projection * glm::lookAt(position, position + directions[face], ups[face]);
+      render_view(buffer, face, view_projection, true);
+    }
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glEnable(GL_CULL_FACE);
+  active = true;
+}
+
+void ShadowMaps::render_view(MeshBuffer &buffer, const int index,
+                             const mat4 &view_projection, const bool is_cube) {
+  const auto &shader = is_cube ? distance_shader : depth_shader;
+  const auto texture = is_cube ? cube : cascades;
+  const auto static_texture = is_cube ? static_cube : static_cascades;
+  const auto resolution = is_cube ? cube_resolution : cascade_resolution;
+  glUniformMatrix4fv(shader->location(Uniform::ViewProjectionMatrix), 1,
+                     GL_FALSE, glm::value_ptr(view_projection));
+  if (!cache_static) {
+    attach(fbo, texture, index, is_cube);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    buffer.render_depth(view_projection, ShadowCasters::All);
+    return;
+  }
+
+  auto &cached = views[index];
+  if (!cached.valid || cached.view_projection != view_projection) {
+    attach(fbo, static_texture, index, is_cube);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    buffer.render_depth(view_projection, ShadowCasters::Static);
+    cached = {view_projection, true};
+    static_redraws++;
+  }
+  // the static depth is where every frame starts, dynamic casters go on top.
+  attach(copy_fbo, static_texture, index, is_cube);
+  attach(fbo, texture, index, is_cube);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, copy_fbo);
+  glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  buffer.render_depth(view_projection, ShadowCasters::Dynamic);
+}
+
+void ShadowMaps::apply_uniforms(const Shader &shader) const {
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, cascades);
+  glUniform1i(shader.location(Uniform::ShadowCascades), 2);
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cube);
+  glUniform1i(shader.location(Uniform::ShadowCube), 3);
+  glActiveTexture(GL_TEXTURE0);
+  glUniformMatrix4fv(shader.location(Uniform::ShadowMatrices), CASCADE_COUNT,
+                     GL_FALSE, glm::value_ptr(cascade_matrices[0]));
+  glUniform1f(shader.location(Uniform::ShadowFar), far_plane);
+}
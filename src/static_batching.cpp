@@ -0,0 +1,251 @@
+#include "../include/static_batching.hpp"
+#include "../include/node.hpp"
+#include "../include/renderer.hpp"
+#include <algorithm>
+
+size_t StaticBatcher::batched_count() const {
+  size_t count = 0;
+  for (const auto &[_, batch] : batches) {
+    count += batch.members.size();
+  }
+  return count;
+}
+
+StaticBatcher::Key StaticBatcher::key(const MeshRenderer &renderer) {
+  const auto &color = renderer.color;
+  return {renderer.material.get(), color.x, color.y, color.z, color.w};
+}
+StaticBatcher::Cell StaticBatcher::cell(const vec3 &a, const vec3 &b,
+                                        const vec3 &c) const {
+  const auto cell = glm::floor((a + b + c) / (3.0f * cluster_size));
+  return {(int)cell.x, (int)cell.y, (int)cell.z};
+}
+
+void StaticBatcher::update(MeshBuffer &buffer) {
+  dirty = false;
+  vector<Key> changed;
+  // the ones leaving first, they're drawn on their own again from now on.
+  // renderers whose node is gone just go.
+  for (auto &[batch_key, batch] : batches) {
+    const auto removed = std::erase_if(batch.members, [](const auto &member) {
+      const auto node = member->node.lock();
+      if (node && node->is_static()) {
+        return false;
+      }
+      member->batched = false;
+      return true;
+    });
+    if (removed != 0) {
+      changed.push_back(batch_key);
+    }
+  }
+  for (const auto &renderer : buffer.meshes) {
+    // queried renderers need a draw of their own to make conditional.
+    if (renderer->batched || renderer->occlusion_query) {
+      continue;
+    }
+    const auto node = renderer->node.lock();
+    const auto &mesh = renderer->mesh;
+    if (!node || !node->is_static() || mesh->lods.empty() || !mesh->uploaded) {
+      continue;
+    }
+    const auto batch_key = key(*renderer);
+    batches[batch_key].members.push_back(renderer);
+    renderer->batched = true;
+    changed.push_back(batch_key);
+  }
+
+  std::ranges::sort(changed);
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+  // renderers mostly share meshes, each only gets read back once.
+  unordered_map<const Mesh *, Source> sources;
+  for (const auto &batch_key : changed) {
+    auto &batch = batches[batch_key];
+    if (!batch.members.empty()) {
+      rebuild(buffer, batch, sources);
+    }
+  }
+  // empty batches just leave their ranges behind, the pools are append only.
+  std::erase_if(batches, [](const auto &entry) {
+    return entry.second.members.empty();
+  });
+  renderers.clear();
+  for (const auto &[_, batch] : batches) {
+    for (const auto &[_, cluster] : batch.clusters) {
+      renderers.push_back(cluster.renderer);
+    }
+  }
+}
+
+void StaticBatcher::rebuild(MeshBuffer &buffer, Batch &batch,
+                            unordered_map<const Mesh *, Source> &sources) {
+  // what ends up in each cell. a vertex is copied into every cell one of its
+  // triangles lands in.
+  struct Geometry {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<vec3> occluder_vertices;
+    vector<uint32_t> occluder_indices;
+  };
+  std::map<Cell, Geometry> cells;
+  vector<Vertex> world;
+  vector<vec3> occluder_world;
+  for (const auto &member : batch.members) {
+    const auto &mesh = *member->mesh;
+    auto source = sources.find(&mesh);
+    if (source == sources.end()) {
+      source = sources.emplace(&mesh, read_back(buffer, mesh)).first;
+    }
+    const auto transform = member->node.lock()->get_transform();
+    const auto normals = normal_matrix(transform);
+    // mirroring flips the winding, flip it back so the right faces get culled.
+    const auto mirrored = glm::determinant(mat3(transform)) < 0.0f;
+    const size_t corners[] = {0, mirrored ? 2u : 1u, mirrored ? 1u : 2u};
+
+    world.clear();
+    for (const auto &vertex : source->second.vertices) {
+      const auto normal = normals * vertex.normal;
+      world.push_back({
+          .position = vec3(transform * vec4(vertex.position, 1.0f)),
+          .texcoord = vertex.texcoord,
+          .normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : normal,
+      });
+    }
+    // where each of the member's vertices went in each cell.
+    std::map<Cell, unordered_map<unsigned int, unsigned int>> remaps;
+    const auto &source_indices = source->second.indices;
+    for (size_t i = 0; i + 2 < source_indices.size(); i += 3) {
+      const auto triangle_cell =
+          cell(world[source_indices[i]].position,
+               world[source_indices[i + 1]].position,
+               world[source_indices[i + 2]].position);
+      auto &geometry = cells[triangle_cell];
+      auto &remap = remaps[triangle_cell];
+      for (const auto corner : corners) {
+        const auto index = source_indices[i + corner];
+        const auto [it, inserted] =
+            remap.insert({index, (unsigned int)geometry.vertices.size()});
+        if (inserted) {
+          geometry.vertices.push_back(world[index]);
+        }
+        geometry.indices.push_back(it->second);
+      }
+    }
+
+    if (!member->occluder) {
+      continue;
+    }
+    occluder_world.clear();
+    for (const auto &position : mesh.occluder_vertices) {
+      occluder_world.push_back(vec3(transform * vec4(position, 1.0f)));
+    }
+    remaps.clear();
+    const auto &occluder = mesh.occluder_indices;
+    for (size_t i = 0; i + 2 < occluder.size(); i += 3) {
+      const auto triangle_cell =
+          cell(occluder_world[occluder[i]], occluder_world[occluder[i + 1]],
+               occluder_world[occluder[i + 2]]);
+      auto &geometry = cells[triangle_cell];
+      auto &remap = remaps[triangle_cell];
+      for (const auto corner : corners) {
+        const auto index = occluder[i + corner];
+        const auto [it, inserted] = remap.insert(
+            {index, (unsigned int)geometry.occluder_vertices.size()});
+        if (inserted) {
+          geometry.occluder_vertices.push_back(occluder_world[index]);
+        }
+        geometry.occluder_indices.push_back(it->second);
+      }
+    }
+  }
+
+  // cells nothing lands in anymore leave their ranges behind.
+  std::erase_if(batch.clusters, [&](const auto &entry) {
+    return !cells.contains(entry.first) || cells[entry.first].indices.empty();
+  });
+  const auto &first = *batch.members.front();
+  for (auto &[cell_key, geometry] : cells) {
+    // only occluder triangles, nothing to draw.
+    if (geometry.indices.empty()) {
+      continue;
+    }
+    auto &cluster = batch.clusters[cell_key];
+    if (!cluster.renderer) {
+      cluster.renderer = make_shared<MeshRenderer>();
+      cluster.renderer->mesh = make_shared<Mesh>("static batch");
+      cluster.renderer->material = first.material;
+      cluster.renderer->color = first.color;
+      // the members may have been packed, the float variants might not exist.
+      const ShaderFeatures features = first.material->atlased() ? ATLASED : 0;
+      first.material->variant(features);
+      if (MeshBuffer::indirect_supported()) {
+        first.material->variant(features | INDIRECT);
+      }
+    }
+    auto &mesh = cluster.renderer->mesh;
+    mesh->set_data(std::move(geometry.vertices), std::move(geometry.indices));
+    mesh->occluder_vertices = std::move(geometry.occluder_vertices);
+    mesh->occluder_indices = std::move(geometry.occluder_indices);
+    cluster.renderer->occluder = !mesh->occluder_indices.empty();
+    cluster.renderer->lod = 0;
+    upload(buffer, cluster);
+  }
+}
+
+void StaticBatcher::upload(MeshBuffer &buffer, Cluster &cluster) const {
+  const auto &mesh = cluster.renderer->mesh;
+  const auto index_bytes = mesh->index_count * mesh->index_size();
+  if (mesh->uploaded && mesh->vertex_count <= cluster.vertex_capacity &&
+      index_bytes <= cluster.index_bytes_capacity &&
+      mesh->has_short_indices == cluster.short_indices) {
+    buffer.overwrite_mesh(mesh);
+    return;
+  }
+  // new or grew, the old range is left behind.
+  mesh->uploaded = false;
+  buffer.upload_mesh(mesh);
+  cluster.vertex_capacity = mesh->vertex_count;
+  cluster.index_bytes_capacity = index_bytes;
+  cluster.short_indices = mesh->has_short_indices;
+}
+
+StaticBatcher::Source StaticBatcher::read_back(const MeshBuffer &buffer,
+                                               const Mesh &mesh) {
+  Source source;
+  source.vertices.resize(mesh.vertex_count);
+  if (mesh.format == VertexFormat::Packed) {
+    vector<PackedVertex> packed(mesh.vertex_count);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer.packed_vertices.id);
+    glGetBufferSubData(GL_COPY_READ_BUFFER,
+                       mesh.base_vertex * sizeof(PackedVertex),
+                       packed.size() * sizeof(PackedVertex), packed.data());
+    std::ranges::transform(packed, source.vertices.begin(),
+                           [&](const PackedVertex &vertex) {
+                             return mesh.unpack(vertex);
+                           });
+  } else {
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer.vertices.id);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, mesh.base_vertex * sizeof(Vertex),
+                       source.vertices.size() * sizeof(Vertex),
+                       source.vertices.data());
+  }
+
+  // full detail only, batches have no lods of their own.
+  const auto &lod = mesh.lods[0];
+  const auto offset = mesh.index_offset + lod.first_index * mesh.index_size();
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer.indices.id);
+  if (mesh.has_short_indices) {
+    vector<uint16_t> short_indices(lod.index_count);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, offset,
+                       short_indices.size() * sizeof(uint16_t),
+                       short_indices.data());
+    source.indices.assign(short_indices.begin(), short_indices.end());
+  } else {
+    source.indices.resize(lod.index_count);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, offset,
+                       source.indices.size() * sizeof(unsigned int),
+                       source.indices.data());
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  return source;
+}
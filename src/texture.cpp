@@ -0,0 +1,447 @@
+#include "../include/renderer.hpp"
+#include "../include/texture_atlas.hpp"
+#include "../include/texture_streamer.hpp"
+#include "../include/thread_pool.hpp"
+#include <cstring>
+#include <filesystem>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../thirdparty/stb/stb_image.h"
+
+using texture_compression::BlockFormat;
+
+unordered_map<std::string, shared_ptr<Texture>> Texture::cache = {};
+
+shared_ptr<Texture> Texture::get(const std::string &path) {
+  auto it = cache.find(path);
+  if (it != cache.end()) {
+    return it->second;
+  }
+  auto texture = make_shared<Texture>();
+  texture->path = path;
+  cache[path] = texture;
+  TextureStreamer::current().request(texture);
+  return texture;
+}
+GLuint Texture::handle() const {
+  return resident() ? texture : TextureStreamer::current().placeholder();
+}
+size_t Texture::total_gpu_bytes() {
+  size_t total = 0;
+  for (const auto &[_, texture] : cache) {
+    total += texture->gpu_bytes;
+  }
+  return total;
+}
+
+YAML::Node Texture::serialize() {
+  YAML::Node out;
+  out["path"] = this->path;
+  return out;
+}
+
+void Texture::deserialize(const YAML::Node &in) {
+  path = in["path"].as<std::string>();
+  load_texture(path);
+}
+
+struct PixelFormat {
+  GLenum internal_format, format;
+  // how to spread the stored channels out to rgba when sampling.
+  GLint swizzle[4];
+};
+
+static PixelFormat pixel_format(const int channel_count) {
+  switch (channel_count) {
+  case 1:
+    return {GL_R8, GL_RED, {GL_RED, GL_RED, GL_RED, GL_ONE}};
+  case 2:
+    // grey & alpha.
+    return {GL_RG8, GL_RG, {GL_RED, GL_RED, GL_RED, GL_GREEN}};
+  case 3:
+    return {GL_RGB8, GL_RGB, {GL_RED, GL_GREEN, GL_BLUE, GL_ONE}};
+  default:
+    return {GL_RGBA8, GL_RGBA, {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}};
+  }
+}
+
+static int mip_level_count(const int width, const int height) {
+  int levels = 1;
+  while ((std::max(width, height) >> levels) > 0) {
+    levels++;
+  }
+  return levels;
+}
+
+static GLenum compressed_format(const BlockFormat compression) {
+  switch (compression) {
+  case BlockFormat::BC1:
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case BlockFormat::BC3:
+    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  default:
+    // bc5 is rgtc2, which is core since 3.0.
+    return GL_COMPRESSED_RG_RGTC2;
+  }
+}
+std::string Texture::baked_path(const std::string &path) {
+  return std::filesystem::path(path).replace_extension(".mtex").string();
+}
+
+void Texture::allocate(const int width, const int height,
+                       const int channel_count, const int levels,
+                       const BlockFormat compression) {
+  this->width = width;
+  this->height = height;
+  this->channel_count = channel_count;
+  this->levels = levels;
+  this->compression = compression;
+  const auto pixel = pixel_format(channel_count);
+  internal_format = compression == BlockFormat::None
+                        ? pixel.internal_format
+                        : compressed_format(compression);
+  format = pixel.format;
+  resident_level = levels;
+  
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (GLEW_ARB_texture_storage) {
+    glTexStorage2D(GL_TEXTURE_2D, levels, internal_format, width, height);
+  } else {
+    for (int level = 0; level < levels; level++) {
+      const auto level_width = std::max(width >> level, 1);
+      const auto level_height = std::max(height >> level, 1);
+      if (compression == BlockFormat::None) {
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format, level_width,
+                     level_height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+      } else {
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D, level, internal_format, level_width, level_height, 0,
+            texture_compression::level_bytes(compression, level_width,
+                                             level_height),
+            nullptr);
+      }
+    }
+  }
+  // bc5 holds two independent channels, not grey & alpha.
+  const GLint red_green[] = {GL_RED, GL_GREEN, GL_ZERO, GL_ONE};
+  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                   compression == BlockFormat::BC5 ? red_green : pixel.swizzle);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  
+  // drivers are free to pad rgb out to rgba, count what they most likely store.
+  const size_t texel_bytes = channel_count == 3 ? 4 : channel_count;
+  gpu_bytes = 0;
+  for (int level = 0; level < levels; level++) {
+    const auto level_width = std::max(width >> level, 1);
+    const auto level_height = std::max(height >> level, 1);
+    gpu_bytes += compression == BlockFormat::None
+                     ? size_t(level_width) * level_height * texel_bytes
+                     : texture_compression::level_bytes(compression, level_width,
+                                                        level_height);
+  }
+}
+
+void Texture::load_texture(const std::string &path) {
+  int width, height, channel_count;
+  stbi_set_flip_vertically_on_load(true);
+  auto *data = stbi_load(path.c_str(), &width, &height, &channel_count, 0);
+  if (!data) {
+    std::cerr << "Failed to load texture: " << path << " : "
+              << stbi_failure_reason() << std::endl;
+    return;
+  }
+  allocate(width, height, channel_count, mip_level_count(width, height));
+  
+  // stb packs rows tightly, so rgb & grey images usually aren't 4 byte aligned.
+  const auto row_bytes = width * channel_count;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, row_bytes % 4 == 0 ? 4 : 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format,
+                  GL_UNSIGNED_BYTE, data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  stbi_image_free(data);
+  
+  glGenerateMipmap(GL_TEXTURE_2D);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  resident_level = 0;
+}
+Texture::Texture(const std::string path) : path(path) { load_texture(path); }
+Texture::~Texture() { glDeleteTextures(1, &texture); }
+
+// TextureStreamer
+
+TextureStreamer::~TextureStreamer() {
+  for (auto &buffer : ring) {
+    glDeleteBuffers(1, &buffer.id);
+    if (buffer.fence) {
+      glDeleteSync(buffer.fence);
+    }
+  }
+  glDeleteTextures(1, &placeholder_texture);
+}
+GLuint TextureStreamer::placeholder() {
+  if (placeholder_texture == 0) {
+    // a grey checker, obviously not the real thing but not distracting.
+    const unsigned char pixels[] = {96, 160, 160, 96};
+    glGenTextures(1, &placeholder_texture);
+    glBindTexture(GL_TEXTURE_2D, placeholder_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 2, 2, 0, GL_RED, GL_UNSIGNED_BYTE,
+                 pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    const auto format = pixel_format(1);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  return placeholder_texture;
+}
+void TextureStreamer::decode(DecodedTexture &image, const std::string &path) {
+  stbi_set_flip_vertically_on_load_thread(true);
+  auto *data = stbi_load(path.c_str(), &image.width, &image.height,
+                         &image.channel_count, 0);
+  if (!data) {
+    std::cerr << "Failed to load texture: " << path << " : "
+              << stbi_failure_reason() << std::endl;
+    return;
+  }
+  image.levels = texture_compression::build_mip_chain(
+      data, image.width, image.height, image.channel_count);
+  stbi_image_free(data);
+}
+bool TextureStreamer::decode_baked(DecodedTexture &image,
+                                   const std::string &path,
+                                   const bool gpu_decodes) {
+  texture_compression::CompressedImage baked;
+  if (!texture_compression::read_container(path, baked)) {
+    std::cerr << "Failed to load baked texture: " << path << std::endl;
+    return false;
+  }
+  image.width = baked.width;
+  image.height = baked.height;
+  image.channel_count = baked.format == BlockFormat::BC5 ? 2
+                        : baked.format == BlockFormat::BC1 ? 3
+                                                           : 4;
+  // bc5 is rgtc which is core, only the s3tc formats can be missing.
+  if (gpu_decodes || baked.format == BlockFormat::BC5) {
+    image.compression = baked.format;
+    image.levels = std::move(baked.levels);
+    return true;
+  }
+  // no s3tc, so we pay for uncompressed memory but still skip the jpeg decode.
+  for (size_t level = 0; level < baked.levels.size(); level++) {
+    const auto width = std::max(baked.width >> level, 1);
+    const auto height = std::max(baked.height >> level, 1);
+    auto pixels = texture_compression::decode_image(
+        baked.format, baked.levels[level].data(), width, height, 4);
+    if (image.channel_count == 3) {
+      // bc1 decodes to rgba, drop the alpha we don't have.
+      for (size_t i = 0; i < size_t(width) * height; i++) {
+        std::memmove(&pixels[i * 3], &pixels[i * 4], 3);
+      }
+      pixels.resize(size_t(width) * height * 3);
+    }
+    image.levels.push_back(std::move(pixels));
+  }
+  return true;
+}
+void TextureStreamer::prepare_for_atlas(DecodedTexture &image) {
+  // the atlas is all rgba, & only keeps as many levels as its padding allows.
+  image.levels.resize(std::min<size_t>(image.levels.size(), TextureAtlas::LEVELS));
+  if (image.channel_count != 4) {
+    const auto format = pixel_format(image.channel_count);
+    for (auto &level : image.levels) {
+      const auto pixel_count = level.size() / image.channel_count;
+      vector<unsigned char> rgba(pixel_count * 4);
+      for (size_t i = 0; i < pixel_count; i++) {
+        const auto *source = &level[i * image.channel_count];
+        // the same spread the swizzle would have done.
+        for (int c = 0; c < 4; c++) {
+          const auto swizzle = format.swizzle[c];
+          rgba[i * 4 + c] = swizzle == GL_ONE ? 255 : source[swizzle - GL_RED];
+        }
+      }
+      level = std::move(rgba);
+    }
+    image.channel_count = 4;
+  }
+  image.for_atlas = true;
+}
+void TextureStreamer::request(const shared_ptr<Texture> &texture) {
+  decoding++;
+  weak_ptr<Texture> weak_texture = texture;
+  // prefer a baked copy sitting next to the source image.
+  const auto baked = Texture::baked_path(texture->path);
+  const auto has_baked = baked != texture->path && file_exists(baked);
+  const auto gpu_decodes = GLEW_EXT_texture_compression_s3tc;
+  const auto use_atlas = TextureAtlas::current().enabled;
+  ThreadPool::shared().submit([this, weak_texture, path = texture->path,
+                               baked, has_baked, gpu_decodes, use_atlas] {
+    DecodedTexture image;
+    image.texture = weak_texture;
+    if (!has_baked || !decode_baked(image, baked, gpu_decodes)) {
+      decode(image, path);
+    }
+    if (use_atlas && !image.levels.empty() &&
+        TextureAtlas::eligible(image.width, image.height, image.compression)) {
+      prepare_for_atlas(image);
+    }
+    std::lock_guard lock(mutex);
+    decoded.push_back(std::move(image));
+    decoding--;
+  });
+}
+void TextureStreamer::update() {
+  uploaded_bytes = 0;
+  {
+    std::lock_guard lock(mutex);
+    for (auto &image : decoded) {
+      auto texture = image.texture.lock();
+      if (!texture || image.levels.empty()) {
+        continue;
+      }
+      if (image.for_atlas) {
+        texture->atlas = TextureAtlas::current().allocate(image.width, image.height);
+      }
+      if (texture->atlased()) {
+        // under CELL pixels the chain is over before the atlas' levels are,
+        // and the rest of the slot would keep whatever was there. the chain
+        // ends at 1x1, which is what every level after it is too.
+        while (image.levels.size() < TextureAtlas::LEVELS) {
+          image.levels.push_back(image.levels.back());
+        }
+        texture->width = image.width;
+        texture->height = image.height;
+        texture->channel_count = 4;
+        texture->levels = image.levels.size();
+        texture->resident_level = texture->levels;
+      } else {
+        // the atlas is full, it can live on its own with the levels it has.
+        texture->allocate(image.width, image.height, image.channel_count,
+                          image.levels.size(), image.compression);
+      }
+      const auto coarsest = (int)image.levels.size() - 1;
+      uploads.push_back({texture, std::move(image), coarsest});
+    }
+    decoded.clear();
+  }
+  if (uploads.empty()) {
+    return;
+  }
+  
+  auto &buffer = ring[ring_index];
+  if (buffer.fence) {
+    // the gpu hasn't got to last time's copy out of this buffer, try again
+    // next frame rather than stall on it.
+    if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      return;
+    }
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+  }
+  // the budget has to fit at least one row of what's next in line.
+  const auto &next = *uploads.front().texture;
+  const auto capacity =
+      std::max(bytes_per_frame, size_t(next.width) * next.channel_count);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+  if (buffer.capacity != capacity) {
+    if (buffer.id == 0) {
+      glGenBuffers(1, &buffer.id);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+    }
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    buffer.capacity = capacity;
+  }
+  auto *mapped = (unsigned char *)glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, buffer.capacity,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  
+  // copy as many rows as fit, and remember where they go.
+  struct Copy {
+    shared_ptr<Texture> texture;
+    int level, y, width, rows;
+    size_t offset, size;
+    bool finishes_level;
+  };
+  vector<Copy> copies;
+  size_t used = 0;
+  while (!uploads.empty()) {
+    auto &upload = uploads.front();
+    const auto &texture = upload.texture;
+    const auto &data = upload.image.levels[upload.level];
+    const auto width = std::max(texture->width >> upload.level, 1);
+    const auto level_height = std::max(texture->height >> upload.level, 1);
+    const auto compressed = texture->compression != BlockFormat::None;
+    // compressed textures go up a row of 4x4 blocks at a time.
+    const auto height = compressed ? (level_height + 3) / 4 : level_height;
+    const size_t row_bytes =
+        compressed ? texture_compression::level_bytes(texture->compression, width, 1)
+                   : width * texture->channel_count;
+    const auto rows = std::min<size_t>(height - upload.next_row,
+                                       (buffer.capacity - used) / row_bytes);
+    if (rows == 0) {
+      break;
+    }
+    std::memcpy(mapped + used, data.data() + upload.next_row * row_bytes,
+                rows * row_bytes);
+    upload.next_row += rows;
+    const auto finishes_level = upload.next_row == height;
+    copies.push_back({texture, upload.level, upload.next_row - (int)rows,
+                      width, (int)rows, used, rows * row_bytes,
+                      finishes_level});
+    used += rows * row_bytes;
+    if (finishes_level) {
+      // free the level's pixels as soon as they're on their way.
+      upload.image.levels[upload.level] = {};
+      upload.next_row = 0;
+      if (--upload.level < 0) {
+        uploads.pop_front();
+      }
+    }
+  }
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (const auto &copy : copies) {
+    const auto &texture = *copy.texture;
+    if (texture.atlased()) {
+      const auto &slot = texture.atlas;
+      glBindTexture(GL_TEXTURE_2D_ARRAY, TextureAtlas::current().texture);
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, copy.level, slot.x >> copy.level,
+                      (slot.y >> copy.level) + copy.y, slot.layer, copy.width,
+                      copy.rows, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                      (const void *)copy.offset);
+      if (copy.finishes_level) {
+        copy.texture->resident_level = copy.level;
+      }
+      continue;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    if (texture.compression == BlockFormat::None) {
+      glTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, copy.y, copy.width,
+                      copy.rows, texture.format, GL_UNSIGNED_BYTE,
+                      (const void *)copy.offset);
+    } else {
+      // rows are block rows here, the last one can stick out of the level.
+      const auto level_height = std::max(texture.height >> copy.level, 1);
+      const auto y = copy.y * 4;
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, y, copy.width,
+                                std::min(copy.rows * 4, level_height - y),
+                                texture.internal_format, copy.size,
+                                (const void *)copy.offset);
+    }
+    if (copy.finishes_level) {
+      // commands run in order, so draws after this see the new level.
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level);
+      copy.texture->resident_level = copy.level;
+    }
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  
+  buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ring_index = (ring_index + 1) % RING_SIZE;
+  uploaded_bytes = used;
+}
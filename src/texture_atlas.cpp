@@ -0,0 +1,93 @@
+#include "../include/texture_atlas.hpp"
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "../thirdparty/imgui/imstb_rectpack.h"
+
+// stb_rectpack works in whole cells here, which keeps every slot aligned.
+struct AtlasPage {
+  stbrp_context context;
+  vector<stbrp_node> nodes;
+  AtlasPage() : nodes(TextureAtlas::PAGE_SIZE / TextureAtlas::CELL) {
+    const auto cells = TextureAtlas::PAGE_SIZE / TextureAtlas::CELL;
+    stbrp_init_target(&context, cells, cells, nodes.data(), nodes.size());
+  }
+};
+
+TextureAtlas::TextureAtlas() {}
+TextureAtlas::~TextureAtlas() { glDeleteTextures(1, &texture); }
+
+bool TextureAtlas::eligible(const int width, const int height,
+                            const texture_compression::BlockFormat compression) {
+  return compression == texture_compression::BlockFormat::None &&
+         width <= MAX_TEXTURE_SIZE && height <= MAX_TEXTURE_SIZE;
+}
+size_t TextureAtlas::gpu_bytes() const {
+  size_t bytes = 0;
+  for (int level = 0; level < LEVELS; level++) {
+    bytes += size_t(PAGE_SIZE >> level) * (PAGE_SIZE >> level) * 4;
+  }
+  return bytes * layer_count;
+}
+bool TextureAtlas::grow() {
+  const auto new_layer_count = std::max(1, layer_count * 2);
+  // moving the old layers over needs copy image, without it we only get the
+  // first allocation.
+  if (layer_count != 0 && !GLEW_ARB_copy_image) {
+    return false;
+  }
+  GLuint new_texture;
+  glGenTextures(1, &new_texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, new_texture);
+  if (GLEW_ARB_texture_storage) {
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, LEVELS, GL_RGBA8, PAGE_SIZE, PAGE_SIZE,
+                   new_layer_count);
+  } else {
+    for (int level = 0; level < LEVELS; level++) {
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, PAGE_SIZE >> level,
+                   PAGE_SIZE >> level, new_layer_count, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, nullptr);
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, LEVELS - 1);
+  if (layer_count != 0) {
+    for (int level = 0; level < LEVELS; level++) {
+      glCopyImageSubData(texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                         new_texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                         PAGE_SIZE >> level, PAGE_SIZE >> level, layer_count);
+    }
+    glDeleteTextures(1, &texture);
+  }
+  texture = new_texture;
+  for (int layer = layer_count; layer < new_layer_count; layer++) {
+    pages.push_back(std::make_unique<AtlasPage>());
+  }
+  layer_count = new_layer_count;
+  return true;
+}
+AtlasSlot TextureAtlas::allocate(const int width, const int height) {
+  AtlasSlot slot;
+  // one spare cell to the right & below keeps neighbours apart.
+  stbrp_rect rect = {};
+  rect.w = (width + CELL - 1) / CELL + 1;
+  rect.h = (height + CELL - 1) / CELL + 1;
+  
+  for (int attempt = 0; attempt < 2; attempt++) {
+    for (size_t layer = 0; layer < pages.size(); layer++) {
+      if (!stbrp_pack_rects(&pages[layer]->context, &rect, 1)) {
+        continue;
+      }
+      slot.layer = layer;
+      slot.x = rect.x * CELL;
+      slot.y = rect.y * CELL;
+      slot.rect = vec4(slot.x, slot.y, width, height) / float(PAGE_SIZE);
+      return slot;
+    }
+    if (!grow()) {
+      break;
+    }
+  }
+  return slot;
+}
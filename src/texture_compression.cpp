@@ -0,0 +1,547 @@
+#include "../include/texture_compression.hpp"
+#include "../include/thread_pool.hpp"
+#include <cstring>
+#include <fstream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace texture_compression {
+
+size_t block_bytes(const BlockFormat format) {
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+size_t level_bytes(const BlockFormat format, const int width, const int height) {
+  return size_t((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+BlockFormat parse_block_format(const std::string &name) {
+  if (name == "bc1") return BlockFormat::BC1;
+  if (name == "bc3") return BlockFormat::BC3;
+  if (name == "bc5") return BlockFormat::BC5;
+  return BlockFormat::None;
+}
+
+static uint16_t to_565(const int r, const int g, const int b) {
+  return uint16_t(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 |
+                  ((b * 31 + 127) / 255));
+}
+static void from_565(const uint16_t color, int *rgb) {
+  const auto r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+static void write_u16(uint8_t *out, const uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+// picks the endpoints of a color block from its bounding box, pulled in a
+// little so the interpolated colors land on the pixels more often.
+// (J.M.P. van Waveren, "Real-Time DXT Compression")
+struct ColorEndpoints {
+  uint16_t color0, color1;
+  // the palette the indices choose from, rgb.
+  int palette[4][3];
+};
+static ColorEndpoints color_endpoints(const uint8_t *min, const uint8_t *max) {
+  int low[3], high[3];
+  for (int c = 0; c < 3; c++) {
+    const auto inset = (max[c] - min[c]) >> 4;
+    low[c] = std::min(min[c] + inset, 255);
+    high[c] = std::max(max[c] - inset, 0);
+  }
+  ColorEndpoints endpoints;
+  endpoints.color0 = to_565(high[0], high[1], high[2]);
+  endpoints.color1 = to_565(low[0], low[1], low[2]);
+  // color0 > color1 selects the four color mode.
+  if (endpoints.color0 < endpoints.color1) {
+    std::swap(endpoints.color0, endpoints.color1);
+  }
+  auto &palette = endpoints.palette;
+  from_565(endpoints.color0, palette[0]);
+  from_565(endpoints.color1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+  return endpoints;
+}
+static void write_color_block(const ColorEndpoints &endpoints,
+                              const uint8_t *indices, uint8_t *out) {
+  write_u16(out, endpoints.color0);
+  write_u16(out + 2, endpoints.color1);
+  uint32_t bits = 0;
+  // equal endpoints leave nothing to choose between.
+  if (endpoints.color0 != endpoints.color1) {
+    for (int i = 0; i < 16; i++) {
+      bits |= uint32_t(indices[i]) << (i * 2);
+    }
+  }
+  std::memcpy(out + 4, &bits, 4);
+}
+
+// the 8 value mode of an alpha / bc4 block, a0 > a1.
+static void alpha_palette(const int a0, const int a1, int *palette) {
+  palette[0] = a0;
+  palette[1] = a1;
+  for (int k = 2; k < 8; k++) {
+    palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+  }
+}
+static void write_alpha_block(const int a0, const int a1,
+                              const uint8_t *indices, uint8_t *out) {
+  out[0] = a0;
+  out[1] = a1;
+  uint64_t bits = 0;
+  if (a0 != a1) {
+    for (int i = 0; i < 16; i++) {
+      bits |= uint64_t(indices[i]) << (i * 3);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = (bits >> (i * 8)) & 0xFF;
+  }
+}
+
+// scalar encoders
+
+static void encode_color_scalar(const uint8_t *rgba, uint8_t *out) {
+  uint8_t min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      min[c] = std::min(min[c], rgba[i * 4 + c]);
+      max[c] = std::max(max[c], rgba[i * 4 + c]);
+    }
+  }
+  const auto endpoints = color_endpoints(min, max);
+  uint8_t indices[16];
+  for (int i = 0; i < 16; i++) {
+    int best = 0, best_distance = INT32_MAX;
+    for (int k = 0; k < 4; k++) {
+      int distance = 0;
+      for (int c = 0; c < 3; c++) {
+        distance += std::abs(rgba[i * 4 + c] - endpoints.palette[k][c]);
+      }
+      if (distance < best_distance) {
+        best = k;
+        best_distance = distance;
+      }
+    }
+    indices[i] = best;
+  }
+  write_color_block(endpoints, indices, out);
+}
+static void encode_alpha_scalar(const uint8_t *rgba, const int channel,
+                                uint8_t *out) {
+  int a0 = 0, a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    a0 = std::max<int>(a0, rgba[i * 4 + channel]);
+    a1 = std::min<int>(a1, rgba[i * 4 + channel]);
+  }
+  int palette[8];
+  alpha_palette(a0, a1, palette);
+  uint8_t indices[16];
+  for (int i = 0; i < 16; i++) {
+    int best = 0, best_distance = INT32_MAX;
+    for (int k = 0; k < 8; k++) {
+      const auto distance = std::abs(rgba[i * 4 + channel] - palette[k]);
+      if (distance < best_distance) {
+        best = k;
+        best_distance = distance;
+      }
+    }
+    indices[i] = best;
+  }
+  write_alpha_block(a0, a1, indices, out);
+}
+void encode_bc1_block_scalar(const uint8_t *rgba, uint8_t *out) {
+  encode_color_scalar(rgba, out);
+}
+void encode_bc3_block_scalar(const uint8_t *rgba, uint8_t *out) {
+  encode_alpha_scalar(rgba, 3, out);
+  encode_color_scalar(rgba, out + 8);
+}
+void encode_bc5_block_scalar(const uint8_t *rgba, uint8_t *out) {
+  encode_alpha_scalar(rgba, 0, out);
+  encode_alpha_scalar(rgba, 1, out + 8);
+}
+
+#if defined(__SSE2__)
+
+// sse2 encoders. they make exactly the same choices as the scalar ones, the
+// bounding boxes come from byte wide min/max and the nearest palette entry is
+// found for 8 pixels at a time in 16 bit lanes.
+
+static __m128i abs_epi16(const __m128i x) {
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+static void reduce_min_max(__m128i min, __m128i max, uint8_t *out_min,
+                           uint8_t *out_max) {
+  // fold the 4 pixels in each register down to one.
+  min = _mm_min_epu8(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(1, 0, 3, 2)));
+  min = _mm_min_epu8(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(2, 3, 0, 1)));
+  max = _mm_max_epu8(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+  max = _mm_max_epu8(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+  const auto low = _mm_cvtsi128_si32(min), high = _mm_cvtsi128_si32(max);
+  std::memcpy(out_min, &low, 4);
+  std::memcpy(out_max, &high, 4);
+}
+// indices of the nearest of palette_size entries, for 16 pixels whose
+// channels are laid out in separate 16 bit arrays.
+static void nearest_indices(const int16_t (*channels)[16],
+                            const int channel_count, const int (*palette)[3],
+                            const int *scalar_palette, const int palette_size,
+                            uint8_t *indices) {
+  for (int half = 0; half < 2; half++) {
+    __m128i values[3];
+    for (int c = 0; c < channel_count; c++) {
+      values[c] = _mm_loadu_si128((const __m128i *)(channels[c] + half * 8));
+    }
+    auto best = _mm_set1_epi16(INT16_MAX);
+    auto best_index = _mm_setzero_si128();
+    for (int k = 0; k < palette_size; k++) {
+      auto distance = _mm_setzero_si128();
+      for (int c = 0; c < channel_count; c++) {
+        const auto entry = palette ? palette[k][c] : scalar_palette[k];
+        distance = _mm_add_epi16(
+            distance, abs_epi16(_mm_sub_epi16(values[c], _mm_set1_epi16(entry))));
+      }
+      // strictly less, so ties keep the lower index like the scalar loop.
+      const auto closer = _mm_cmplt_epi16(distance, best);
+      best = _mm_min_epi16(best, distance);
+      best_index = _mm_or_si128(_mm_andnot_si128(closer, best_index),
+                                _mm_and_si128(closer, _mm_set1_epi16(k)));
+    }
+    alignas(16) int16_t lanes[8];
+    _mm_store_si128((__m128i *)lanes, best_index);
+    for (int i = 0; i < 8; i++) {
+      indices[half * 8 + i] = lanes[i];
+    }
+  }
+}
+static void encode_color_sse2(const uint8_t *rgba, uint8_t *out) {
+  const auto *pixels = (const __m128i *)rgba;
+  auto min = _mm_loadu_si128(pixels), max = min;
+  for (int i = 1; i < 4; i++) {
+    const auto row = _mm_loadu_si128(pixels + i);
+    min = _mm_min_epu8(min, row);
+    max = _mm_max_epu8(max, row);
+  }
+  uint8_t low[4], high[4];
+  reduce_min_max(min, max, low, high);
+  const auto endpoints = color_endpoints(low, high);
+  
+  int16_t channels[3][16];
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      channels[c][i] = rgba[i * 4 + c];
+    }
+  }
+  uint8_t indices[16];
+  nearest_indices(channels, 3, endpoints.palette, nullptr, 4, indices);
+  write_color_block(endpoints, indices, out);
+}
+static void encode_alpha_sse2(const uint8_t *rgba, const int channel,
+                              uint8_t *out) {
+  alignas(16) uint8_t values[16];
+  int16_t channels[1][16];
+  for (int i = 0; i < 16; i++) {
+    values[i] = rgba[i * 4 + channel];
+    channels[0][i] = values[i];
+  }
+  auto min = _mm_load_si128((const __m128i *)values), max = min;
+  // fold all 16 bytes down to one.
+  min = _mm_min_epu8(min, _mm_srli_si128(min, 8));
+  max = _mm_max_epu8(max, _mm_srli_si128(max, 8));
+  min = _mm_min_epu8(min, _mm_srli_si128(min, 4));
+  max = _mm_max_epu8(max, _mm_srli_si128(max, 4));
+  min = _mm_min_epu8(min, _mm_srli_si128(min, 2));
+  max = _mm_max_epu8(max, _mm_srli_si128(max, 2));
+  min = _mm_min_epu8(min, _mm_srli_si128(min, 1));
+  max = _mm_max_epu8(max, _mm_srli_si128(max, 1));
+  const int a1 = _mm_cvtsi128_si32(min) & 0xFF;
+  const int a0 = _mm_cvtsi128_si32(max) & 0xFF;
+  int palette[8];
+  alpha_palette(a0, a1, palette);
+  uint8_t indices[16];
+  nearest_indices(channels, 1, nullptr, palette, 8, indices);
+  write_alpha_block(a0, a1, indices, out);
+}
+void encode_bc1_block(const uint8_t *rgba, uint8_t *out) {
+  encode_color_sse2(rgba, out);
+}
+void encode_bc3_block(const uint8_t *rgba, uint8_t *out) {
+  encode_alpha_sse2(rgba, 3, out);
+  encode_color_sse2(rgba, out + 8);
+}
+void encode_bc5_block(const uint8_t *rgba, uint8_t *out) {
+  encode_alpha_sse2(rgba, 0, out);
+  encode_alpha_sse2(rgba, 1, out + 8);
+}
+
+#else
+
+void encode_bc1_block(const uint8_t *rgba, uint8_t *out) {
+  encode_bc1_block_scalar(rgba, out);
+}
+void encode_bc3_block(const uint8_t *rgba, uint8_t *out) {
+  encode_bc3_block_scalar(rgba, out);
+}
+void encode_bc5_block(const uint8_t *rgba, uint8_t *out) {
+  encode_bc5_block_scalar(rgba, out);
+}
+
+#endif
+
+// decoders
+
+static void decode_color(const uint8_t *block, uint8_t *rgba,
+                         const bool four_colors_only) {
+  const uint16_t color0 = block[0] | block[1] << 8;
+  const uint16_t color1 = block[2] | block[3] << 8;
+  int palette[4][4];
+  from_565(color0, palette[0]);
+  from_565(color1, palette[1]);
+  palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+  const auto four_colors = four_colors_only || color0 > color1;
+  for (int c = 0; c < 3; c++) {
+    if (four_colors) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  if (!four_colors) {
+    palette[3][3] = 0;
+  }
+  uint32_t bits;
+  std::memcpy(&bits, block + 4, 4);
+  for (int i = 0; i < 16; i++) {
+    const auto &color = palette[(bits >> (i * 2)) & 3];
+    for (int c = 0; c < 4; c++) {
+      rgba[i * 4 + c] = color[c];
+    }
+  }
+}
+static void decode_alpha(const uint8_t *block, uint8_t *rgba, const int channel) {
+  const int a0 = block[0], a1 = block[1];
+  int palette[8];
+  if (a0 > a1) {
+    alpha_palette(a0, a1, palette);
+  } else {
+    palette[0] = a0;
+    palette[1] = a1;
+    for (int k = 2; k < 6; k++) {
+      palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+  uint64_t bits = 0;
+  for (int i = 0; i < 6; i++) {
+    bits |= uint64_t(block[2 + i]) << (i * 8);
+  }
+  for (int i = 0; i < 16; i++) {
+    rgba[i * 4 + channel] = palette[(bits >> (i * 3)) & 7];
+  }
+}
+void decode_block(const BlockFormat format, const uint8_t *block, uint8_t *rgba) {
+  switch (format) {
+  case BlockFormat::BC1:
+    decode_color(block, rgba, false);
+    break;
+  case BlockFormat::BC3:
+    decode_color(block + 8, rgba, true);
+    decode_alpha(block, rgba, 3);
+    break;
+  case BlockFormat::BC5:
+    for (int i = 0; i < 16; i++) {
+      rgba[i * 4 + 2] = 0;
+      rgba[i * 4 + 3] = 255;
+    }
+    decode_alpha(block, rgba, 0);
+    decode_alpha(block + 8, rgba, 1);
+    break;
+  default:
+    break;
+  }
+}
+
+// images
+
+static void encode_block_row(const BlockFormat format, const uint8_t *rgba,
+                             const int width, const int height, const int y,
+                             uint8_t *out) {
+  const auto blocks_x = (width + 3) / 4;
+  const auto size = block_bytes(format);
+  uint8_t block[64];
+  for (int bx = 0; bx < blocks_x; bx++) {
+    // images that aren't a multiple of 4 repeat their last row & column.
+    for (int py = 0; py < 4; py++) {
+      const auto sy = std::min(y * 4 + py, height - 1);
+      for (int px = 0; px < 4; px++) {
+        const auto sx = std::min(bx * 4 + px, width - 1);
+        std::memcpy(block + (py * 4 + px) * 4,
+                    rgba + (size_t(sy) * width + sx) * 4, 4);
+      }
+    }
+    auto *destination = out + bx * size;
+    switch (format) {
+    case BlockFormat::BC1:
+      encode_bc1_block(block, destination);
+      break;
+    case BlockFormat::BC3:
+      encode_bc3_block(block, destination);
+      break;
+    case BlockFormat::BC5:
+      encode_bc5_block(block, destination);
+      break;
+    default:
+      break;
+    }
+  }
+}
+vector<uint8_t> encode_image(const BlockFormat format, const uint8_t *rgba,
+                             const int width, const int height,
+                             ThreadPool *pool) {
+  vector<uint8_t> out(level_bytes(format, width, height));
+  const auto blocks_y = (height + 3) / 4;
+  const auto row_bytes = size_t((width + 3) / 4) * block_bytes(format);
+  const auto encode_rows = [&](size_t begin, size_t end) {
+    for (auto y = begin; y < end; y++) {
+      encode_block_row(format, rgba, width, height, y, out.data() + y * row_bytes);
+    }
+  };
+  if (pool) {
+    pool->parallel_for(blocks_y, encode_rows);
+  } else {
+    encode_rows(0, blocks_y);
+  }
+  return out;
+}
+vector<uint8_t> decode_image(const BlockFormat format, const uint8_t *data,
+                             const int width, const int height,
+                             const int channel_count) {
+  vector<uint8_t> out(size_t(width) * height * channel_count);
+  const auto blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+  const auto size = block_bytes(format);
+  uint8_t block[64];
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      decode_block(format, data + (size_t(by) * blocks_x + bx) * size, block);
+      for (int py = 0; py < 4 && by * 4 + py < height; py++) {
+        for (int px = 0; px < 4 && bx * 4 + px < width; px++) {
+          const auto pixel = size_t(by * 4 + py) * width + bx * 4 + px;
+          std::memcpy(out.data() + pixel * channel_count,
+                      block + (py * 4 + px) * 4, channel_count);
+        }
+      }
+    }
+  }
+  return out;
+}
+
+vector<vector<uint8_t>> build_mip_chain(const uint8_t *pixels, const int width,
+                                        const int height,
+                                        const int channels) {
+  vector<vector<uint8_t>> levels;
+  levels.emplace_back(pixels, pixels + size_t(width) * height * channels);
+  for (int level = 1; (std::max(width, height) >> level) > 0; level++) {
+    const auto &source = levels[level - 1];
+    const auto source_width = std::max(width >> (level - 1), 1);
+    const auto source_height = std::max(height >> (level - 1), 1);
+    const auto level_width = std::max(width >> level, 1);
+    const auto level_height = std::max(height >> level, 1);
+    vector<uint8_t> out(size_t(level_width) * level_height * channels);
+    // box filter, odd sizes reuse their last row / column.
+    for (int y = 0; y < level_height; y++) {
+      const auto y0 = std::min(y * 2, source_height - 1);
+      const auto y1 = std::min(y * 2 + 1, source_height - 1);
+      for (int x = 0; x < level_width; x++) {
+        const auto x0 = std::min(x * 2, source_width - 1);
+        const auto x1 = std::min(x * 2 + 1, source_width - 1);
+        for (int c = 0; c < channels; c++) {
+          const auto texel = [&](int sx, int sy) {
+            return (unsigned)source[(size_t(sy) * source_width + sx) * channels + c];
+          };
+          const auto sum = texel(x0, y0) + texel(x1, y0) + texel(x0, y1) +
+                           texel(x1, y1);
+          out[(size_t(y) * level_width + x) * channels + c] = (sum + 2) / 4;
+        }
+      }
+    }
+    levels.push_back(std::move(out));
+  }
+  return levels;
+}
+
+// container
+
+static const uint32_t CONTAINER_VERSION = 1;
+
+bool write_container(const std::string &path, const CompressedImage &image) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  const auto write = [&file](const uint32_t value) {
+    file.write((const char *)&value, sizeof(value));
+  };
+  file.write("MTEX", 4);
+  write(CONTAINER_VERSION);
+  write((uint32_t)image.format);
+  write(image.width);
+  write(image.height);
+  write(image.levels.size());
+  for (const auto &level : image.levels) {
+    write(level.size());
+    file.write((const char *)level.data(), level.size());
+  }
+  return file.good();
+}
+bool read_container(const std::string &path, CompressedImage &image) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  const auto read = [&file]() {
+    uint32_t value = 0;
+    file.read((char *)&value, sizeof(value));
+    return value;
+  };
+  char magic[4];
+  file.read(magic, 4);
+  if (!file || std::memcmp(magic, "MTEX", 4) != 0 || read() != CONTAINER_VERSION) {
+    return false;
+  }
+  image.format = (BlockFormat)read();
+  image.width = read();
+  image.height = read();
+  const auto level_count = read();
+  const auto known_format = image.format == BlockFormat::BC1 ||
+                            image.format == BlockFormat::BC3 ||
+                            image.format == BlockFormat::BC5;
+  if (!file || !known_format || image.width <= 0 || image.height <= 0 ||
+      level_count > 32) {
+    return false;
+  }
+  image.levels.resize(level_count);
+  for (uint32_t level = 0; level < level_count; level++) {
+    const auto size = read();
+    const auto expected =
+        level_bytes(image.format, std::max(image.width >> level, 1),
+                    std::max(image.height >> level, 1));
+    if (size != expected) {
+      return false;
+    }
+    image.levels[level].resize(size);
+    file.read((char *)image.levels[level].data(), size);
+  }
+  return (bool)file;
+}
+
+} // namespace texture_compression
@@ -0,0 +1,60 @@
+#include "../include/thread_pool.hpp"
+#include <latch>
+
+ThreadPool::ThreadPool(const size_t thread_count) {
+  for (size_t i = 0; i < thread_count; i++) {
+    threads.emplace_back(&ThreadPool::worker_loop, this);
+  }
+}
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+void ThreadPool::submit(std::function<void()> job) {
+  {
+    std::lock_guard lock(mutex);
+    jobs.push(std::move(job));
+  }
+  condition.notify_one();
+}
+void ThreadPool::parallel_for(const size_t count,
+                              const std::function<void(size_t, size_t)> &fn) {
+  if (count == 0) {
+    return;
+  }
+  // a few chunks per thread so uneven chunks even out.
+  const auto chunk_count = std::min(count, threads.size() * 4);
+  const auto chunk_size = (count + chunk_count - 1) / chunk_count;
+  std::latch done(chunk_count);
+  for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+    const auto begin = std::min(count, chunk * chunk_size);
+    const auto end = std::min(count, begin + chunk_size);
+    submit([&fn, &done, begin, end] {
+      fn(begin, end);
+      done.count_down();
+    });
+  }
+  done.wait();
+}
+void ThreadPool::worker_loop() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock lock(mutex);
+      condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+      // whatever is still queued when we shut down is dropped.
+      if (stopping) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop();
+    }
+    job();
+  }
+}
@@ -0,0 +1,95 @@
+// bakes images into block compressed .mtex files with their whole mip chain,
+// which Texture::get picks up in place of the source image when present.
+//
+//   make bake_textures
+//   bin/bake_textures [--bc1 | --bc3 | --bc5] res/textures/*.jpg
+//
+// without a format flag, images with an alpha channel get bc3 & the rest bc1.
+// bc5 is for normal maps, it keeps red & green only.
+
+#include "../include/texture_compression.hpp"
+#include "../include/thread_pool.hpp"
+#include <chrono>
+#include <filesystem>
+#define STB_IMAGE_IMPLEMENTATION
+#include "../thirdparty/stb/stb_image.h"
+
+using namespace texture_compression;
+
+static bool bake(const std::string &path, BlockFormat format, ThreadPool &pool) {
+  int width, height, channel_count;
+  // match what the engine does when it loads the source image.
+  stbi_set_flip_vertically_on_load(true);
+  auto *data = stbi_load(path.c_str(), &width, &height, &channel_count, 4);
+  if (!data) {
+    cout << path << " : " << stbi_failure_reason() << std::endl;
+    return false;
+  }
+  if (format == BlockFormat::None) {
+    format = channel_count == 4 || channel_count == 2 ? BlockFormat::BC3
+                                                      : BlockFormat::BC1;
+  }
+  CompressedImage image;
+  image.format = format;
+  image.width = width;
+  image.height = height;
+  const auto levels = build_mip_chain(data, width, height, 4);
+  stbi_image_free(data);
+  
+  size_t source_bytes = 0, baked_bytes = 0;
+  for (size_t level = 0; level < levels.size(); level++) {
+    image.levels.push_back(encode_image(format, levels[level].data(),
+                                        std::max(width >> level, 1),
+                                        std::max(height >> level, 1), &pool));
+    source_bytes += levels[level].size() / 4 * channel_count;
+    baked_bytes += image.levels.back().size();
+  }
+  
+  const auto out_path =
+      std::filesystem::path(path).replace_extension(".mtex").string();
+  if (!write_container(out_path, image)) {
+    cout << "unable to write " << out_path << std::endl;
+    return false;
+  }
+  cout << out_path << " : " << width << "x" << height << ", "
+       << levels.size() << " levels, bc" << (int)format << ", "
+       << source_bytes / 1024 << " kb -> " << baked_bytes / 1024 << " kb"
+       << std::endl;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  auto format = BlockFormat::None;
+  vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg.starts_with("--")) {
+      format = parse_block_format(arg.substr(2));
+      if (format == BlockFormat::None) {
+        cout << "unknown format " << arg << ", expected --bc1, --bc3 or --bc5"
+             << std::endl;
+        return 1;
+      }
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) {
+    cout << "usage : bake_textures [--bc1 | --bc3 | --bc5] <images...>"
+         << std::endl;
+    return 1;
+  }
+  
+  ThreadPool pool;
+  const auto start = std::chrono::high_resolution_clock::now();
+  int failed = 0;
+  for (const auto &path : paths) {
+    failed += !bake(path, format, pool);
+  }
+  const auto seconds = std::chrono::duration<float>(
+                           std::chrono::high_resolution_clock::now() - start)
+                           .count();
+  cout << "baked " << paths.size() - failed << " textures in " << seconds
+       << "s" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+// checks the sse2 froxel culling of the clustered lights against the scalar
+// version. no gl needed.
+//
+//   make check
+//
+// exits with 1 if anything failed.
+
+#include "../include/froxel_culling.hpp"
+#include <bit>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+
+static size_t failures = 0;
+
+static void expect(const bool condition, const std::string &what) {
+  if (!condition) {
+    cout << "FAILED : " << what << std::endl;
+    failures++;
+  }
+}
+
+// the light indices in each froxel, like LightClusters uploads them.
+static vector<vector<size_t>> to_lists(const vector<uint64_t> &masks,
+                                       const size_t words) {
+  vector<vector<size_t>> lists(masks.size() / words);
+  for (size_t cluster = 0; cluster < lists.size(); cluster++) {
+    for (size_t word = 0; word < words; word++) {
+      for (auto bits = masks[cluster * words + word]; bits != 0; bits &= bits - 1) {
+        lists[cluster].push_back(word * 64 + std::countr_zero(bits));
+      }
+    }
+  }
+  return lists;
+}
+
+// LightClusters' grid over a typical camera, with a few hundred lights so
+// every word of the masks gets bits. one slice at a time, like it does.
+static void check_culling() {
+  constexpr int GRID_X = 16, GRID_Y = 9, GRID_Z = 24;
+  constexpr size_t SLICE = GRID_X * GRID_Y, LIGHTS = 300,
+                   WORDS = (LIGHTS + 63) / 64;
+  const auto near = 0.1f, far = 300.0f;
+  const auto bounds = build_froxel_bounds(
+      glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, near, 1000.0f), near,
+      far, GRID_X, GRID_Y, GRID_Z);
+
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> side(-60.0f, 60.0f),
+      depth(-near, far), radius(0.05f, 20.0f);
+  vector<vec4> spheres;
+  for (size_t i = 0; i < LIGHTS; i++) {
+    spheres.push_back(vec4(side(random), side(random), -depth(random),
+                           radius(random)));
+  }
+  // right on a froxel's corner, and touching one from outside.
+  spheres[0] = vec4(bounds.max_x[5], bounds.max_y[5], bounds.max_z[5], 0.0f);
+  spheres[1] = vec4(bounds.min_x[200] - 1.0f, bounds.min_y[200],
+                    bounds.min_z[200], 1.0f);
+
+  size_t hits = 0;
+  for (size_t slice = 0; slice < GRID_Z; slice++) {
+    vector<uint64_t> simd(SLICE * WORDS, 0), scalar(SLICE * WORDS, 0);
+    for (size_t light = 0; light < LIGHTS; light++) {
+      const auto bit = (uint64_t)1 << (light % 64);
+      cull_froxels(bounds, slice * SLICE, SLICE, spheres[light], bit,
+                   simd.data() + light / 64, WORDS);
+      cull_froxels_scalar(bounds, slice * SLICE, SLICE, spheres[light], bit,
+                          scalar.data() + light / 64, WORDS);
+    }
+    const auto simd_lists = to_lists(simd, WORDS);
+    const auto scalar_lists = to_lists(scalar, WORDS);
+    size_t mismatches = 0;
+    for (size_t cluster = 0; cluster < SLICE; cluster++) {
+      mismatches += simd_lists[cluster] != scalar_lists[cluster];
+      hits += scalar_lists[cluster].size();
+    }
+    expect(mismatches == 0, "froxel culling of slice " + std::to_string(slice) +
+                                " differs from the scalar one in " +
+                                std::to_string(mismatches) + " froxels");
+  }
+  // two empty grids would match too.
+  expect(hits != 0, "froxel culling found no lights at all");
+}
+
+int main() {
+  check_culling();
+  if (failures != 0) {
+    cout << failures << " froxel culling checks failed." << std::endl;
+    return 1;
+  }
+  cout << "froxel culling checks passed." << std::endl;
+  return 0;
+}
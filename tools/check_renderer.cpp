@@ -0,0 +1,230 @@
+// checks of the renderer that need a gl context but no scene: gpu culling
+// against the cpu's frustum test, & the frame graph's culling & aliasing.
+//
+//   make check
+//
+// opens a hidden window, so ci needs a display & a driver with compute
+// shaders. mesa's llvmpipe has everything:
+//
+//   xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 make check
+//
+// exits with 1 if anything failed. without a context (or 4.3) the checks are
+// skipped, which is said loudly.
+
+#include "../include/culling.hpp"
+#include "../include/frame_graph.hpp"
+#include "../include/renderer.hpp"
+#include <random>
+
+static size_t failures = 0;
+
+static void expect(const bool condition, const std::string &what) {
+  if (!condition) {
+    cout << "FAILED : " << what << std::endl;
+    failures++;
+  }
+}
+
+static GLFWwindow *create_context() {
+  if (!glfwInit()) {
+    return nullptr;
+  }
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  auto window = glfwCreateWindow(64, 64, "check", nullptr, nullptr);
+  if (!window) {
+    // whatever the driver gives, the checks that need more skip themselves.
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    window = glfwCreateWindow(64, 64, "check", nullptr, nullptr);
+  }
+  if (!window) {
+    return nullptr;
+  }
+  glfwMakeContextCurrent(window);
+  glewExperimental = GL_TRUE;
+  glewInit();
+  return window;
+}
+
+// a few thousand spheres scattered around the camera in 8 buckets, culled
+// from a handful of views. GpuCulling::validate compares the survivor count
+// with the cpu, this also checks which draws survived per bucket.
+static void check_gpu_culling() {
+  if (!GpuCulling::supported()) {
+    cout << "SKIPPED : gpu culling, no gl 4.3" << std::endl;
+    return;
+  }
+  constexpr size_t COUNT = 4096, BUCKETS = 8, PER_BUCKET = COUNT / BUCKETS;
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f),
+      radius(0.1f, 5.0f), scale(0.5f, 2.0f);
+  vector<DrawElementsIndirectCommand> commands(COUNT);
+  vector<IndirectDrawData> draws(COUNT);
+  vector<CullData> cull_data(COUNT);
+  for (size_t i = 0; i < COUNT; i++) {
+    // first_index tells the draws apart once they're packed.
+    commands[i] = {.count = 3, .instance_count = 1, .first_index = (GLuint)i};
+    const auto model = glm::scale(
+        glm::translate(mat4(1.0f), vec3(position(random), position(random),
+                                        position(random))),
+        vec3(scale(random), scale(random), scale(random)));
+    draws[i] = {.model = model};
+    const auto bucket = (GLuint)(i / PER_BUCKET);
+    cull_data[i] = {.sphere = vec4(0.0f, 0.0f, 0.0f, radius(random)),
+                    .bucket = bucket,
+                    .bucket_first = bucket * (GLuint)PER_BUCKET};
+  }
+
+  GpuCulling culling;
+  culling.validate = true;
+  const auto projection =
+      glm::perspective(glm::radians(70.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+  const vec3 targets[] = {{1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 1, 0.01f},
+                          {1, -1, 1}};
+  for (const auto &target : targets) {
+    const auto view_projection =
+        projection * glm::lookAt(vec3(0.0f), target, vec3(0, 1, 0));
+    culling.cull(commands, draws, cull_data, BUCKETS, view_projection);
+
+    const auto frustum = frustum_planes(view_projection);
+    vector<vector<GLuint>> expected(BUCKETS);
+    for (size_t i = 0; i < COUNT; i++) {
+      const auto &model = draws[i].model;
+      const auto center = vec3(model * vec4(vec3(cull_data[i].sphere), 1.0f));
+      const auto largest = std::max({glm::length(vec3(model[0])),
+                                     glm::length(vec3(model[1])),
+                                     glm::length(vec3(model[2]))});
+      if (sphere_in_frustum(frustum, center, cull_data[i].sphere.w * largest)) {
+        expected[cull_data[i].bucket].push_back(i);
+      }
+    }
+
+    vector<GLuint> counts(BUCKETS);
+    vector<DrawElementsIndirectCommand> culled(COUNT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.counts);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, BUCKETS * sizeof(GLuint),
+                       counts.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culling.commands);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                       COUNT * sizeof(DrawElementsIndirectCommand),
+                       culled.data());
+    for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+      vector<GLuint> survivors;
+      for (size_t slot = bucket * PER_BUCKET; slot < (bucket + 1) * PER_BUCKET;
+           slot++) {
+        // packed from the bucket's start, or left in place with 0 instances.
+        if (GpuCulling::compaction_supported()
+                ? slot - bucket * PER_BUCKET < counts[bucket]
+                : culled[slot].instance_count != 0) {
+          survivors.push_back(culled[slot].first_index);
+        }
+      }
+      // the atomics pack them in any order.
+      std::sort(survivors.begin(), survivors.end());
+      expect(counts[bucket] == expected[bucket].size() &&
+                 survivors == expected[bucket],
+             "gpu culling bucket " + std::to_string(bucket) + " kept " +
+                 std::to_string(survivors.size()) + " draws, the cpu " +
+                 std::to_string(expected[bucket].size()));
+    }
+  }
+  expect(culling.validation_errors == 0, "gpu culling validation");
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// two transients like each other, one used & done with before the other is
+// created, and a third that nothing reads.
+struct TestGraph {
+  FrameResource first, second, unread;
+};
+static TestGraph build_graph(FrameGraph &graph, const int size) {
+  TestGraph test;
+  graph.reset();
+  const auto backbuffer = graph.import("backbuffer", 0);
+  graph.present(backbuffer);
+  const auto noop = [](FrameGraph &) {};
+  const TextureDesc desc = {size, size, GL_RGBA8};
+  graph.add_pass(
+      "first", [&](PassBuilder &pass) { test.first = pass.create("a", desc); },
+      noop);
+  graph.add_pass(
+      "use first",
+      [&](PassBuilder &pass) {
+        pass.read(test.first);
+        pass.write(backbuffer);
+      },
+      noop);
+  graph.add_pass(
+      "second", [&](PassBuilder &pass) { test.second = pass.create("b", desc); },
+      noop);
+  graph.add_pass(
+      "use second",
+      [&](PassBuilder &pass) {
+        pass.read(test.second);
+        pass.write(backbuffer);
+      },
+      noop);
+  graph.add_pass(
+      "unread",
+      [&](PassBuilder &pass) {
+        test.unread = pass.create("c", {size, size, GL_R8});
+      },
+      noop);
+  graph.compile();
+  return test;
+}
+
+static void check_frame_graph() {
+  FrameGraph graph;
+  auto test = build_graph(graph, 64);
+  expect(graph.texture(test.first) != 0 &&
+             graph.texture(test.first) == graph.texture(test.second),
+         "frame graph transients that never overlap share a texture");
+  expect(graph.texture(test.unread) == 0,
+         "frame graph gave a culled pass's transient a texture");
+  expect(graph.pooled_textures == 1, "frame graph pooled " +
+                                         std::to_string(graph.pooled_textures) +
+                                         " textures, not 1");
+  graph.execute();
+  const vector<bool> culled = {false, false, false, false, true};
+  expect(graph.stats.size() == culled.size() &&
+             std::ranges::equal(graph.stats, culled,
+                                [](const PassStats &stats, const bool culled) {
+                                  return stats.culled == culled;
+                                }),
+         "frame graph culled the pass nobody reads, & only that one");
+
+  // a resize frees the old size's texture instead of keeping it around.
+  test = build_graph(graph, 32);
+  expect(graph.pooled_textures == 1,
+         "frame graph kept " + std::to_string(graph.pooled_textures) +
+             " textures after a resize, not 1");
+
+  graph.aliasing = false;
+  test = build_graph(graph, 32);
+  expect(graph.texture(test.first) != graph.texture(test.second),
+         "frame graph aliased transients with aliasing off");
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+int main() {
+  auto window = create_context();
+  if (!window) {
+    cout << "SKIPPED : renderer checks, no gl context" << std::endl;
+    return 0;
+  }
+  check_gpu_culling();
+  check_frame_graph();
+  ShaderCache::clear();
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  if (failures != 0) {
+    cout << failures << " renderer checks failed." << std::endl;
+    return 1;
+  }
+  cout << "renderer checks passed." << std::endl;
+  return 0;
+}